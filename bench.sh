@@ -0,0 +1,122 @@
+#!/bin/bash
+
+set -eufo pipefail
+
+usage() {
+	cat <<EOS
+Usage: $0 [-r runs] [-w warmup] [-o output] [-b baseline] [-s] [NAME ...]
+
+Runs the Scheme benchmarks in bench/scheme (all of them if no names are given)
+and reports the median and variance of their running times.
+
+Options:
+	-r runs      Number of timed runs of each benchmark (default 5)
+	-w warmup    Number of untimed runs before timing (default 1)
+	-o output    Results file to write (default bench/out/results.tsv)
+	-b baseline  Results file to compare against (default bench/baseline.tsv)
+	-s           Also save the results as the new baseline
+EOS
+}
+
+cd "$(dirname "$0")"
+
+runs=5
+warmup=1
+output=bench/out/results.tsv
+baseline=bench/baseline.tsv
+save=n
+
+while getopts "hr:w:o:b:s" opt; do
+	case $opt in
+		h) usage; exit ;;
+		r) runs=$OPTARG ;;
+		w) warmup=$OPTARG ;;
+		o) output=$OPTARG ;;
+		b) baseline=$OPTARG ;;
+		s) save=y ;;
+		*) usage >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [[ $# -eq 0 ]]; then
+	names=()
+	while read -r f; do
+		base=${f##*/}
+		names+=("${base%.scm}")
+	done < <(find bench/scheme -name "*.scm" | sort)
+else
+	names=("$@")
+fi
+
+mkdir -p "$(dirname "$output")"
+
+# Print the elapsed time of one run of a benchmark in milliseconds.
+time_run() {
+	local start end
+	start=$EPOCHREALTIME
+	bin/eva "bench/scheme/$1.scm" > /dev/null
+	end=$EPOCHREALTIME
+	awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f\n", (e - s) * 1000 }'
+}
+
+# Read times from standard input and print the count, median, mean, variance,
+# minimum, and maximum, separated by tabs.
+summarize() {
+	sort -n | awk '
+		{ t[NR] = $1; sum += $1 }
+		END {
+			mean = sum / NR
+			for (i = 1; i <= NR; i++) {
+				var += (t[i] - mean) ^ 2
+			}
+			var = NR > 1 ? var / (NR - 1) : 0
+			if (NR % 2) {
+				median = t[(NR + 1) / 2]
+			} else {
+				median = (t[NR / 2] + t[NR / 2 + 1]) / 2
+			}
+			printf "%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", \
+				NR, median, mean, var, t[1], t[NR]
+		}'
+}
+
+# Print the median time of a benchmark in the baseline file, if present.
+baseline_median() {
+	if [[ -f $baseline ]]; then
+		awk -F '\t' -v n="$1" '$1 == n { print $3 }' "$baseline"
+	fi
+}
+
+printf "name\truns\tmedian_ms\tmean_ms\tvariance_ms2\tmin_ms\tmax_ms\n" \
+	> "$output"
+printf "%-12s %10s %10s %10s  %s\n" \
+	"benchmark" "median ms" "stddev ms" "min ms" "vs baseline"
+
+for name in "${names[@]}"; do
+	if [[ ! -f bench/scheme/$name.scm ]]; then
+		echo "$0: bench/scheme/$name.scm does not exist" >&2
+		exit 1
+	fi
+	for ((i = 0; i < warmup; i++)); do
+		bin/eva "bench/scheme/$name.scm" > /dev/null
+	done
+	stats=$(for ((i = 0; i < runs; i++)); do time_run "$name"; done \
+		| summarize)
+	printf "%s\t%s\n" "$name" "$stats" >> "$output"
+
+	IFS=$'\t' read -r _ median _ variance min _ <<< "$stats"
+	base=$(baseline_median "$name")
+	change=-
+	if [[ -n $base ]]; then
+		change=$(awk -v m="$median" -v b="$base" \
+			'BEGIN { printf "%+.1f%%", (m - b) / b * 100 }')
+	fi
+	printf "%-12s %10.2f %10.2f %10.2f  %s\n" "$name" "$median" \
+		"$(awk -v v="$variance" 'BEGIN { print sqrt(v) }')" "$min" "$change"
+done
+
+if [[ $save == y ]]; then
+	cp "$output" "$baseline"
+	echo "Saved baseline to $baseline"
+fi
@@ -0,0 +1,350 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+// Core data structure benchmarks. Measures interning, environment lookup and
+// binding, pair allocation, list conversion, parsing, and printing, and reports
+// the time and number of heap allocations per operation. Allocations are
+// counted by wrapping 'malloc', 'calloc', and 'realloc' at link time (see the
+// Makefile), so they include allocations that do not create boxes.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "env.h"
+#include "expr.h"
+#include "intern.h"
+#include "list.h"
+#include "parse.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Minimum time to run each benchmark, in seconds.
+#define MIN_TIME 0.2
+
+// Number of distinct symbols used by the intern and environment benchmarks.
+#define N_SYMBOLS 1024
+
+// Length of the list used by the list benchmarks.
+#define LIST_LENGTH 16
+
+// Approximate size of the text used by the parse and print benchmarks.
+#define TEXT_SIZE (1 << 20)
+
+static const char *const usage_message =
+	"usage: core [-t seconds] [name ...]\n";
+
+// Source code repeated to make the text for the parse and print benchmarks.
+static const char *const sample =
+	"(define (fold-left f acc xs)\n"
+	"  ;; Folds from the left.\n"
+	"  (if (null? xs)\n"
+	"      acc\n"
+	"      (fold-left f (f acc (car xs)) (cdr xs))))\n"
+	"(write (list 'a \"say \\\"hi\\\"\\n\" #\\x -42 #t (cons 1 2)))\n";
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+// Number of allocations since startup.
+static size_t allocations = 0;
+
+void *__wrap_malloc(size_t size) {
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	allocations++;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Time and allocations measured so far in the current run. Benchmarks call
+// 'resume_timer' after their setup and 'pause_timer' before their cleanup, so
+// that only the operations themselves are measured.
+static double elapsed;
+static size_t allocated;
+static double resumed_at;
+static size_t resumed_allocations;
+
+static void resume_timer(void) {
+	resumed_allocations = allocations;
+	resumed_at = now();
+}
+
+static void pause_timer(void) {
+	elapsed += now() - resumed_at;
+	allocated += allocations - resumed_allocations;
+}
+
+// Symbols and text shared by the benchmarks, created once in 'main'.
+static char names[N_SYMBOLS][16];
+static InternId symbols[N_SYMBOLS];
+static char *text;
+static size_t text_length;
+
+// Interns strings that have already been interned.
+static void bench_intern_hit(size_t n) {
+	resume_timer();
+	for (size_t i = 0; i < n; i++) {
+		const char *name = names[i % N_SYMBOLS];
+		intern_string_n(name, strlen(name));
+	}
+	pause_timer();
+}
+
+// Interns strings that have never been interned.
+static void bench_intern_miss(size_t n) {
+	static size_t next = 0;
+	char (*fresh)[24] = xmalloc(n * sizeof *fresh);
+	for (size_t i = 0; i < n; i++) {
+		snprintf(fresh[i], sizeof *fresh, "miss-%zu", next++);
+	}
+	resume_timer();
+	for (size_t i = 0; i < n; i++) {
+		intern_string_n(fresh[i], strlen(fresh[i]));
+	}
+	pause_timer();
+	free(fresh);
+}
+
+// Looks up symbols bound in the base environment from an environment 'depth'
+// levels below it, like a variable reference in a nested procedure.
+static void lookup_at_depth(size_t n, size_t depth) {
+	struct Environment *env = new_base_environment();
+	for (size_t i = 0; i < N_SYMBOLS; i++) {
+		bind_variable(env, symbols[i], new_number((Number)i));
+	}
+	for (size_t d = 0; d < depth; d++) {
+		struct Environment *child = new_environment(env, 0);
+		bind_variable(child, symbols[d], new_null());
+		release_environment(env);
+		env = child;
+	}
+	size_t found = 0;
+	resume_timer();
+	for (size_t i = 0; i < n; i++) {
+		found += lookup(env, symbols[i % N_SYMBOLS]) != NULL;
+	}
+	pause_timer();
+	if (found != n) {
+		fputs("lookup failed\n", stderr);
+		exit(1);
+	}
+	release_environment(env);
+}
+
+static void bench_lookup_0(size_t n) { lookup_at_depth(n, 0); }
+static void bench_lookup_4(size_t n) { lookup_at_depth(n, 4); }
+static void bench_lookup_16(size_t n) { lookup_at_depth(n, 16); }
+static void bench_lookup_64(size_t n) { lookup_at_depth(n, 64); }
+
+// Binds symbols in new child environments that start with no table, so that
+// the table is rehashed as it grows. Each operation is one binding.
+static void bench_bind_rehash(size_t n) {
+	struct Environment *base = new_base_environment();
+	resume_timer();
+	for (size_t i = 0; i < n; i += 64) {
+		struct Environment *env = new_environment(base, 0);
+		for (size_t j = 0; j < 64; j++) {
+			bind_variable(env, symbols[j], new_number((Number)j));
+		}
+		release_environment(env);
+	}
+	pause_timer();
+	release_environment(base);
+}
+
+// Builds lists of numbers and releases them. Each operation is one pair.
+static void bench_pair_churn(size_t n) {
+	resume_timer();
+	for (size_t i = 0; i < n; i += LIST_LENGTH) {
+		struct Expression list = new_null();
+		for (size_t j = 0; j < LIST_LENGTH; j++) {
+			list = new_pair(new_number((Number)j), list);
+		}
+		release_expression(list);
+	}
+	pause_timer();
+}
+
+// Converts a list to an array and frees the array.
+static void bench_list_to_array(size_t n) {
+	struct Expression list = new_null();
+	for (size_t j = 0; j < LIST_LENGTH; j++) {
+		list = new_pair(new_number((Number)j), list);
+	}
+	resume_timer();
+	for (size_t i = 0; i < n; i++) {
+		free_array(list_to_array(list, false));
+	}
+	pause_timer();
+	release_expression(list);
+}
+
+// Parses the text, starting over at the end. Each operation is one expression.
+static void bench_parse(size_t n) {
+	size_t offset = 0;
+	resume_timer();
+	for (size_t i = 0; i < n; i++) {
+		if (offset == text_length) {
+			offset = 0;
+		}
+		struct ParseResult result =
+			parse_n(text + offset, text_length - offset);
+		if (result.err_type != PARSE_SUCCESS) {
+			fputs("parse failed\n", stderr);
+			exit(1);
+		}
+		offset += result.chars_read;
+		release_expression(result.expr);
+	}
+	pause_timer();
+}
+
+// Prints the expressions parsed from the text. Each operation is one
+// expression, printed to a stream that discards its output.
+static void bench_print(size_t n) {
+	struct Array exprs = { .improper = false, .size = 0, .exprs = NULL };
+	size_t cap = 0;
+	for (size_t offset = 0; offset < text_length;) {
+		struct ParseResult result =
+			parse_n(text + offset, text_length - offset);
+		offset += result.chars_read;
+		if (exprs.size == cap) {
+			cap = MAX(16, cap * 2);
+			exprs.exprs = xrealloc(exprs.exprs, cap * sizeof *exprs.exprs);
+		}
+		exprs.exprs[exprs.size++] = result.expr;
+	}
+	FILE *stream = fopen("/dev/null", "w");
+	if (!stream) {
+		perror("/dev/null");
+		exit(1);
+	}
+	resume_timer();
+	for (size_t i = 0; i < n; i++) {
+		print_expression(exprs.exprs[i % exprs.size], stream);
+	}
+	pause_timer();
+	fclose(stream);
+	for (size_t i = 0; i < exprs.size; i++) {
+		release_expression(exprs.exprs[i]);
+	}
+	free(exprs.exprs);
+}
+
+// A benchmark performs 'n' operations. If 'text' is true, each operation
+// processes one expression of the shared text, and throughput is reported.
+struct Benchmark {
+	const char *name;
+	void (*fn)(size_t n);
+	bool text;
+};
+
+static const struct Benchmark benchmarks[] = {
+	{"intern-hit", bench_intern_hit, false},
+	{"intern-miss", bench_intern_miss, false},
+	{"lookup-depth-1", bench_lookup_0, false},
+	{"lookup-depth-5", bench_lookup_4, false},
+	{"lookup-depth-17", bench_lookup_16, false},
+	{"lookup-depth-65", bench_lookup_64, false},
+	{"bind-rehash", bench_bind_rehash, false},
+	{"pair-churn", bench_pair_churn, false},
+	{"list-to-array", bench_list_to_array, false},
+	{"parse", bench_parse, true},
+	{"print", bench_print, true},
+};
+
+#define N_BENCHMARKS (sizeof benchmarks / sizeof *benchmarks)
+
+// Runs a benchmark with increasing numbers of operations until it takes at
+// least 'min_time' seconds, and prints the results of the last run.
+static void run(
+		const struct Benchmark *b, double min_time, double exprs_per_byte) {
+	size_t n = 64;
+	for (;;) {
+		elapsed = 0;
+		allocated = 0;
+		b->fn(n);
+		if (elapsed >= min_time) {
+			break;
+		}
+		n = elapsed < min_time / 16 ? n * 16 : n * 2;
+	}
+	printf("%-16s %10zu %10.1f %10.2f", b->name, n,
+			elapsed / (double)n * 1e9, (double)allocated / (double)n);
+	if (b->text) {
+		double bytes = (double)n / exprs_per_byte;
+		printf(" %10.1f", bytes / elapsed / 1e6);
+	}
+	putchar('\n');
+}
+
+int main(int argc, char **argv) {
+	double min_time = MIN_TIME;
+	int i = 1;
+	for (; i < argc; i++) {
+		if (is_opt(argv[i], 't', "time") && i + 1 < argc) {
+			min_time = strtod(argv[++i], NULL);
+		} else if (argv[i][0] == '-') {
+			fputs(usage_message, stderr);
+			return 1;
+		} else {
+			break;
+		}
+	}
+	for (int j = i; j < argc; j++) {
+		bool found = false;
+		for (size_t k = 0; k < N_BENCHMARKS; k++) {
+			found |= strcmp(argv[j], benchmarks[k].name) == 0;
+		}
+		if (!found) {
+			fprintf(stderr, "core: unknown benchmark '%s'\n", argv[j]);
+			return 1;
+		}
+	}
+
+	for (size_t k = 0; k < N_SYMBOLS; k++) {
+		snprintf(names[k], sizeof names[k], "sym-%zu", k);
+		symbols[k] = intern_string(names[k]);
+	}
+	size_t sample_length = strlen(sample);
+	size_t copies = TEXT_SIZE / sample_length + 1;
+	text_length = copies * sample_length;
+	text = xmalloc(text_length);
+	for (size_t k = 0; k < copies; k++) {
+		memcpy(text + k * sample_length, sample, sample_length);
+	}
+	// Drop the final newline so that the text ends with an expression.
+	text_length--;
+	// The sample has two top-level expressions.
+	double exprs_per_byte = 2.0 / (double)sample_length;
+
+	printf("%-16s %10s %10s %10s %10s\n",
+			"benchmark", "ops", "ns/op", "allocs/op", "MB/s");
+	for (size_t k = 0; k < N_BENCHMARKS; k++) {
+		bool selected = i == argc;
+		for (int j = i; j < argc; j++) {
+			selected |= strcmp(argv[j], benchmarks[k].name) == 0;
+		}
+		if (selected) {
+			run(&benchmarks[k], min_time, exprs_per_byte);
+		}
+	}
+	free(text);
+	return 0;
+}
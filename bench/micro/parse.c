@@ -0,0 +1,204 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+// Parser benchmark. Parses a large generated program (or the files given on the
+// command line) from start to finish with 'parse_n', and reports throughput.
+// The generated program mixes nested lists, symbols, numbers, strings with
+// escapes, quotes, comments, and indentation, roughly like real source code.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "expr.h"
+#include "parse.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Default size of the generated program, in bytes.
+#define DEFAULT_SIZE (32 << 20)
+
+// Number of times to parse the text. The fastest run is reported.
+#define RUNS 5
+
+static const char *const usage_message =
+	"usage: parse [-s megabytes] [-o output] [file ...]\n";
+
+// State of the xorshift generator, fixed so that every run uses the same data.
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static unsigned rng(unsigned n) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (unsigned)(rng_state % n);
+}
+
+// A growable character buffer for building the generated program.
+struct Text {
+	char *data;
+	size_t length;
+	size_t cap;
+};
+
+static void append(struct Text *t, const char *s, size_t n) {
+	if (t->length + n > t->cap) {
+		t->cap = MAX(t->cap * 2, t->length + n);
+		t->data = xrealloc(t->data, t->cap);
+	}
+	memcpy(t->data + t->length, s, n);
+	t->length += n;
+}
+
+static void append_str(struct Text *t, const char *s) {
+	append(t, s, strlen(s));
+}
+
+static void indent(struct Text *t, int depth) {
+	append(t, "\n", 1);
+	for (int i = 0; i < depth; i++) {
+		append(t, "  ", 2);
+	}
+}
+
+// Appends a random expression, nested no deeper than 'depth'.
+static void gen_expr(struct Text *t, int depth) {
+	static const char *const words[] = {
+		"define", "lambda", "let", "if", "cond", "car", "cdr", "cons",
+		"list", "map", "x", "y", "acc", "string-append", "vector-ref",
+		"call-with-current-continuation", "+", "-", "*", "<=", "null?"
+	};
+	char num[32];
+	unsigned k = depth > 0 ? rng(10) : rng(6);
+	switch (k) {
+	case 0:
+	case 1:
+	case 2:
+		append_str(t, words[rng(sizeof words / sizeof *words)]);
+		break;
+	case 3:
+		snprintf(num, sizeof num, "%d", (int)rng(2000000) - 1000000);
+		append_str(t, num);
+		break;
+	case 4:
+		append_str(t, rng(2) ? "\"hello, world\"" : "\"say \\\"hi\\\"\\n\"");
+		break;
+	case 5:
+		append_str(t, rng(2) ? "#t" : "#\\a");
+		break;
+	case 6:
+		append(t, "'", 1);
+		gen_expr(t, depth - 1);
+		break;
+	default:;
+		unsigned n = 1 + rng(6);
+		append(t, "(", 1);
+		for (unsigned i = 0; i < n; i++) {
+			if (i > 0) {
+				if (rng(4) == 0) {
+					indent(t, 8 - depth);
+				} else {
+					append(t, " ", 1);
+				}
+			}
+			gen_expr(t, depth - 1);
+		}
+		append(t, ")", 1);
+		break;
+	}
+}
+
+// Generates a program of at least 'size' bytes made of top-level expressions.
+static struct Text generate(size_t size) {
+	struct Text t = { .data = NULL, .length = 0, .cap = 0 };
+	while (t.length < size) {
+		if (rng(8) == 0) {
+			append_str(&t, ";; A comment describing the next definition.\n");
+		}
+		gen_expr(&t, 8);
+		append_str(&t, "\n\n");
+	}
+	return t;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Parses all the expressions in the text, and reports the fastest of several
+// runs. Returns false if there is a parse error.
+static bool bench(const char *name, const char *text, size_t length) {
+	double best = 0;
+	size_t count = 0;
+	for (int run = 0; run < RUNS; run++) {
+		count = 0;
+		double start = now();
+		size_t offset = 0;
+		while (offset < length) {
+			struct ParseResult result = parse_n(text + offset, length - offset);
+			if (result.err_type != PARSE_SUCCESS) {
+				fprintf(stderr, "%s: parse error at offset %zu\n",
+						name, offset + result.chars_read);
+				return false;
+			}
+			release_expression(result.expr);
+			offset += result.chars_read;
+			count++;
+		}
+		double elapsed = now() - start;
+		if (run == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	printf("parse %s: %zu bytes, %zu exprs, %.1f ms, %.1f MB/s\n",
+			name, length, count, best * 1e3, (double)length / best / 1e6);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	size_t size = DEFAULT_SIZE;
+	const char *output = NULL;
+	int i = 1;
+	for (; i < argc; i++) {
+		if (is_opt(argv[i], 's', "size") && i + 1 < argc) {
+			size = (size_t)strtoul(argv[++i], NULL, 10) << 20;
+		} else if (is_opt(argv[i], 'o', "output") && i + 1 < argc) {
+			output = argv[++i];
+		} else if (argv[i][0] == '-') {
+			fputs(usage_message, stderr);
+			return 1;
+		} else {
+			break;
+		}
+	}
+
+	if (i < argc) {
+		bool success = true;
+		for (; i < argc; i++) {
+			struct FileContents contents;
+			if (!map_file(argv[i], &contents)) {
+				perror(argv[i]);
+				return 1;
+			}
+			success &= bench(argv[i], contents.data, contents.length);
+			unmap_file(contents);
+		}
+		return success ? 0 : 1;
+	}
+
+	struct Text t = generate(size);
+	if (output) {
+		FILE *f = fopen(output, "w");
+		if (!f || fwrite(t.data, 1, t.length, f) != t.length || fclose(f)) {
+			perror(output);
+			return 1;
+		}
+	}
+	bool success = bench("generated", t.data, t.length);
+	free(t.data);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+;; Ackermann function: very many calls with shallow arithmetic.
+
+(define (ack m n)
+  (cond
+    ((= m 0) (+ n 1))
+    ((= n 0) (ack (- m 1) 1))
+    (else (ack (- m 1) (ack m (- n 1))))))
+
+(print (ack 2 9))
+(print (ack 3 6))
@@ -0,0 +1,26 @@
+;; Association list lookups with assq and assv.
+
+(define (make-alist i n key)
+  (if (= i n)
+    '()
+    (cons (cons (key i) i) (make-alist (+ i 1) n key))))
+
+(define numbers (make-alist 0 200 (lambda (i) i)))
+(define symbols
+  (make-alist 0 200 (lambda (i) (string->symbol (number->string i)))))
+
+(define (lookups i n acc)
+  (if (= i n)
+    acc
+    (lookups (+ i 1) n
+             (+ acc
+                (cdr (assv (modulo i 200) numbers))
+                (cdr (assq (string->symbol (number->string (modulo (* i 7) 200)))
+                           symbols))))))
+
+(define (run n total)
+  (if (= n 0)
+    total
+    (run (- n 1) (+ total (lookups 0 500 0)))))
+
+(print (run 2 0))
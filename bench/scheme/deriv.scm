@@ -0,0 +1,29 @@
+;; Symbolic differentiation: symbols, map, and allocation of small lists.
+
+(define (deriv expr)
+  (cond
+    ((not (pair? expr)) (if (eq? expr 'x) 1 0))
+    ((eq? (car expr) '+)
+     (cons '+ (map deriv (cdr expr))))
+    ((eq? (car expr) '-)
+     (cons '- (map deriv (cdr expr))))
+    ((eq? (car expr) '*)
+     (list '*
+           expr
+           (cons '+ (map (lambda (e) (list '/ (deriv e) e)) (cdr expr)))))
+    ((eq? (car expr) '/)
+     (list '-
+           (list '/ (deriv (cadr expr)) (caddr* expr))
+           (list '/ (cadr expr)
+                 (list '* (caddr* expr) (caddr* expr) (deriv (caddr* expr))))))
+    (else (error "No derivation method available" (car expr)))))
+
+(define (caddr* expr) (car (cdr (cdr expr))))
+
+(define (run n result)
+  (if (= n 0)
+    result
+    (run (- n 1) (deriv '(+ (* 3 x x) (* a x x) (* b x) 5)))))
+
+(write (run 3000 '()))
+(newline)
@@ -0,0 +1,17 @@
+;; Doubly recursive Fibonacci with futures: the same work as fib.scm, split
+;; into tasks for the work-stealing scheduler. Compare the two to measure the
+;; speedup, for example with EVA_THREADS=1 and EVA_THREADS=4.
+
+(define (fib n)
+  (if (< n 2)
+    n
+    (+ (fib (- n 1)) (fib (- n 2)))))
+
+;; Below the cutoff, tasks are too small to be worth scheduling.
+(define (pfib n)
+  (if (< n 16)
+    (fib n)
+    (let ((f (future (pfib (- n 1)))))
+      (+ (pfib (- n 2)) (touch f)))))
+
+(print (pfib 26))
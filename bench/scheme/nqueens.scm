@@ -0,0 +1,34 @@
+;; Counts the solutions to the eight queens problem: list building, filtering,
+;; and backtracking.
+
+(define (iota1 n)
+  (define (loop i acc)
+    (if (= i 0) acc (loop (- i 1) (cons i acc))))
+  (loop n '()))
+
+(define (append2 a b)
+  (if (null? a) b (cons (car a) (append2 (cdr a) b))))
+
+(define (ok? row dist placed)
+  (or (null? placed)
+      (and (not (= (car placed) (+ row dist)))
+           (not (= (car placed) (- row dist)))
+           (ok? row (+ dist 1) (cdr placed)))))
+
+(define (try candidates rest placed)
+  (if (null? candidates)
+    (if (null? rest) 1 0)
+    (+ (if (ok? (car candidates) 1 placed)
+         (try (append2 (cdr candidates) rest) '() (cons (car candidates) placed))
+         0)
+       (try (cdr candidates) (cons (car candidates) rest) placed))))
+
+(define (queens n)
+  (try (iota1 n) '() '()))
+
+(define (run n total)
+  (if (= n 0)
+    total
+    (run (- n 1) (+ total (queens 8)))))
+
+(print (run 10 0))
@@ -0,0 +1,37 @@
+;; Merge sort of pseudo-random lists: list traversal and allocation.
+
+(define (random-list n seed)
+  (if (= n 0)
+    '()
+    (let ((next (modulo (+ (* seed 1103515245) 12345) 2147483648)))
+      (cons (modulo next 10000) (random-list (- n 1) next)))))
+
+(define (merge a b)
+  (cond
+    ((null? a) b)
+    ((null? b) a)
+    ((< (car b) (car a)) (cons (car b) (merge a (cdr b))))
+    (else (cons (car a) (merge (cdr a) b)))))
+
+(define (split lst a b)
+  (if (null? lst)
+    (cons a b)
+    (split (cdr lst) b (cons (car lst) a))))
+
+(define (merge-sort lst)
+  (if (or (null? lst) (null? (cdr lst)))
+    lst
+    (let ((halves (split lst '() '())))
+      (merge (merge-sort (car halves)) (merge-sort (cdr halves))))))
+
+(define (sorted? lst)
+  (or (null? lst)
+      (null? (cdr lst))
+      (and (<= (car lst) (car (cdr lst))) (sorted? (cdr lst)))))
+
+(define (run n ok)
+  (if (= n 0)
+    ok
+    (run (- n 1) (and ok (sorted? (merge-sort (random-list 1000 n)))))))
+
+(print (run 10 #t))
@@ -0,0 +1,18 @@
+;; String building: string-append, number->string, and substring.
+
+(define (build i n acc)
+  (if (= i n)
+    acc
+    (build (+ i 1) n (string-append acc (number->string i) ","))))
+
+(define (chunks s i acc)
+  (if (> (+ i 10) (string-length s))
+    acc
+    (chunks s (+ i 10) (+ acc (string-length (substring s i (+ i 10)))))))
+
+(define (run n total)
+  (if (= n 0)
+    total
+    (run (- n 1) (+ total (chunks (build 0 300 "") 0 0)))))
+
+(print (run 200 0))
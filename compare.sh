@@ -0,0 +1,2 @@
+#!/bin/bash
+vimdiff test/ref/load.ref test/out/load.out
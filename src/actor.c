@@ -0,0 +1,421 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "actor.h"
+
+#include "context.h"
+#include "env.h"
+#include "error.h"
+#include "intern.h"
+#include "load.h"
+#include "module.h"
+#include "parallel.h"
+#include "prelude.h"
+#include "repl.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Filename to use in the errors of actors that do not load a file.
+static const char *const actor_filename = "<actor>";
+
+// A Message is an expression encoded as a sequence of items, each starting
+// with a byte for its expression type. Pairs have no payload, and are followed
+// by their car and then their cdr. Strings and symbols are followed by their
+// length and characters, and actors by a pointer, which holds a reference.
+// Other types are followed by their value.
+struct Message {
+	struct Message *next;
+	size_t len;
+	unsigned char data[];
+};
+
+// The mailbox is a queue of messages protected by 'lock'. The actor is freed
+// when 'ref_count' reaches zero. The running thread holds one reference.
+struct Actor {
+	int ref_count;
+	pthread_mutex_t lock;
+	pthread_cond_t arrived;
+	struct Message *head;
+	struct Message *tail;
+};
+
+// What a new actor runs: the file 'filename' if it is not NULL, and otherwise
+// the expression in 'code'.
+struct Start {
+	struct Actor *actor;
+	char *filename;
+	struct Message *code;
+	bool prelude;
+};
+
+// The actor of the calling thread, or NULL if it has not been created yet.
+static _Thread_local struct Actor *current_actor = NULL;
+
+// A growable buffer for encoding messages.
+struct Buffer {
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+};
+
+// Appends 'n' bytes to the buffer.
+static void put(struct Buffer *buf, const void *bytes, size_t n) {
+	if (buf->len + n > buf->cap) {
+		while (buf->len + n > buf->cap) {
+			buf->cap = buf->cap ? buf->cap * 2 : 64;
+		}
+		buf->data = xrealloc(buf->data, buf->cap);
+	}
+	memcpy(buf->data + buf->len, bytes, n);
+	buf->len += n;
+}
+
+// Appends the encoding of 'expr' to the buffer, without retaining actors.
+// Returns true on success. Otherwise, stores the part that cannot be encoded
+// in 'bad' and returns false.
+static bool encode(
+		struct Buffer *buf, struct Expression expr, struct Expression *bad) {
+	for (;;) {
+		unsigned char tag = (unsigned char)expr.type;
+		put(buf, &tag, 1);
+		switch (expr.type) {
+		case E_VOID:
+		case E_EOF:
+		case E_NULL:
+			return true;
+		case E_SYMBOL:;
+			size_t len = find_string_length(expr.symbol_id);
+			put(buf, &len, sizeof len);
+			put(buf, find_string(expr.symbol_id), len);
+			return true;
+		case E_NUMBER:
+			put(buf, &expr.number, sizeof expr.number);
+			return true;
+		case E_BOOLEAN:
+			put(buf, &expr.boolean, sizeof expr.boolean);
+			return true;
+		case E_CHARACTER:
+			put(buf, &expr.character, sizeof expr.character);
+			return true;
+		case E_STDMACRO:
+			put(buf, &expr.stdmacro, sizeof expr.stdmacro);
+			return true;
+		case E_STDPROCMACRO:
+		case E_STDPROCEDURE:
+			put(buf, &expr.stdproc, sizeof expr.stdproc);
+			return true;
+		case E_PAIR:
+			if (!encode(buf, expr.box->car, bad)) {
+				return false;
+			}
+			expr = expr.box->cdr;
+			break;
+		case E_STRING:
+			put(buf, &expr.box->len, sizeof expr.box->len);
+			put(buf, expr.box->str, expr.box->len);
+			return true;
+		case E_ACTOR:
+			put(buf, &expr.box->actor, sizeof expr.box->actor);
+			return true;
+		case E_MACRO:
+		case E_PROCEDURE:
+		case E_PORT:
+		case E_FUTURE:
+		case E_CHANNEL:
+			*bad = expr;
+			return false;
+		}
+	}
+}
+
+// Calls 'fn' on each actor referenced by a message.
+static void for_each_actor(
+		const struct Message *msg, struct Actor *(*fn)(struct Actor *)) {
+	const unsigned char *p = msg->data;
+	const unsigned char *end = p + msg->len;
+	while (p < end) {
+		enum ExpressionType type = (enum ExpressionType)*p++;
+		size_t len;
+		switch (type) {
+		case E_SYMBOL:
+		case E_STRING:
+			memcpy(&len, p, sizeof len);
+			p += sizeof len + len;
+			break;
+		case E_NUMBER:
+			p += sizeof(Number);
+			break;
+		case E_BOOLEAN:
+			p += sizeof(bool);
+			break;
+		case E_CHARACTER:
+			p += sizeof(char);
+			break;
+		case E_STDMACRO:
+			p += sizeof(enum StandardMacro);
+			break;
+		case E_STDPROCMACRO:
+		case E_STDPROCEDURE:
+			p += sizeof(enum StandardProcedure);
+			break;
+		case E_ACTOR:;
+			struct Actor *actor;
+			memcpy(&actor, p, sizeof actor);
+			p += sizeof actor;
+			fn(actor);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Adapts 'release_actor' for 'for_each_actor'.
+static struct Actor *drop_actor(struct Actor *actor) {
+	release_actor(actor);
+	return NULL;
+}
+
+// Encodes 'expr' in a new message, retaining the actors it refers to. Returns
+// NULL and stores an error in 'err' if it cannot be encoded.
+static struct Message *new_message(
+		struct Expression expr, struct EvalError **err) {
+	struct Buffer buf = { .data = NULL, .len = 0, .cap = 0 };
+	struct Expression bad;
+	if (!encode(&buf, expr, &bad)) {
+		free(buf.data);
+		*err = new_eval_error_expr(ERR_MESSAGE, bad);
+		return NULL;
+	}
+	struct Message *msg = xmalloc(sizeof *msg + buf.len);
+	msg->next = NULL;
+	msg->len = buf.len;
+	memcpy(msg->data, buf.data, buf.len);
+	free(buf.data);
+	for_each_actor(msg, retain_actor);
+	return msg;
+}
+
+// Frees a message that will not be delivered, releasing its actors.
+static void free_message(struct Message *msg) {
+	for_each_actor(msg, drop_actor);
+	free(msg);
+}
+
+// Decodes the item at '*p' into a new expression in the current context, and
+// advances '*p' past it. The references to actors move to the expression.
+static struct Expression decode(const unsigned char **p) {
+	struct Expression result;
+	struct Expression *tail = &result;
+	for (;;) {
+		struct Expression expr = { .type = (enum ExpressionType)*(*p)++ };
+		size_t len;
+		switch (expr.type) {
+		case E_SYMBOL:
+			memcpy(&len, *p, sizeof len);
+			*p += sizeof len;
+			expr = new_symbol(intern_string_n((const char *)*p, len));
+			*p += len;
+			break;
+		case E_NUMBER:
+			memcpy(&expr.number, *p, sizeof expr.number);
+			*p += sizeof expr.number;
+			break;
+		case E_BOOLEAN:
+			memcpy(&expr.boolean, *p, sizeof expr.boolean);
+			*p += sizeof expr.boolean;
+			break;
+		case E_CHARACTER:
+			memcpy(&expr.character, *p, sizeof expr.character);
+			*p += sizeof expr.character;
+			break;
+		case E_STDMACRO:
+			memcpy(&expr.stdmacro, *p, sizeof expr.stdmacro);
+			*p += sizeof expr.stdmacro;
+			break;
+		case E_STDPROCMACRO:
+		case E_STDPROCEDURE:
+			memcpy(&expr.stdproc, *p, sizeof expr.stdproc);
+			*p += sizeof expr.stdproc;
+			break;
+		case E_PAIR:;
+			struct Expression car = decode(p);
+			expr = new_pair(car, new_null());
+			*tail = expr;
+			tail = &expr.box->cdr;
+			continue;
+		case E_STRING:
+			memcpy(&len, *p, sizeof len);
+			*p += sizeof len;
+			char *str = xmalloc(len);
+			memcpy(str, *p, len);
+			*p += len;
+			expr = new_string(str, len);
+			break;
+		case E_ACTOR:;
+			struct Actor *actor;
+			memcpy(&actor, *p, sizeof actor);
+			*p += sizeof actor;
+			expr = new_actor(actor);
+			break;
+		default:
+			break;
+		}
+		*tail = expr;
+		return result;
+	}
+}
+
+// Decodes a message into a new expression in the current context, and frees
+// the message.
+static struct Expression open_message(struct Message *msg) {
+	const unsigned char *p = msg->data;
+	struct Expression expr = decode(&p);
+	free(msg);
+	return expr;
+}
+
+// Creates an actor with one reference.
+static struct Actor *new_actor_state(void) {
+	struct Actor *actor = xmalloc(sizeof *actor);
+	actor->ref_count = 1;
+	pthread_mutex_init(&actor->lock, NULL);
+	pthread_cond_init(&actor->arrived, NULL);
+	actor->head = NULL;
+	actor->tail = NULL;
+	return actor;
+}
+
+// Runs an actor in a new context, and frees it when it is done.
+static void *actor_main(void *arg) {
+	struct Start *start = arg;
+	current_actor = start->actor;
+	struct EvaContext *ctx = new_context();
+	use_context(ctx);
+	set_module_prelude(start->prelude);
+	struct Environment *env = new_standard_environment();
+	if (start->prelude) {
+		execute(PRELUDE_FILENAME, prelude_source, strlen(prelude_source),
+				env, false);
+	}
+
+	if (start->filename) {
+		if (!load_file(start->filename, env)) {
+			print_file_error(start->filename);
+		}
+		free(start->filename);
+	} else {
+		struct Expression code = open_message(start->code);
+		struct EvalResult result = eval(code, env, true);
+		release_expression(code);
+		if (!result.err && (result.expr.type == E_PROCEDURE
+					|| result.expr.type == E_STDPROCEDURE)) {
+			struct Expression proc = result.expr;
+			result = apply_procedure(proc, NULL, 0, env);
+			release_expression(proc);
+		}
+		if (result.err) {
+			print_eval_error(actor_filename, result.err);
+			free_eval_error(result.err);
+		} else {
+			release_expression(result.expr);
+		}
+	}
+
+	release_environment(env);
+	free_context(ctx);
+	release_actor(current_actor);
+	current_actor = NULL;
+	free(start);
+	return NULL;
+}
+
+struct EvalResult spawn_actor(struct Expression source) {
+	struct EvalResult result = { .err = NULL };
+	struct Start *start = xmalloc(sizeof *start);
+	start->filename = NULL;
+	start->code = NULL;
+	start->prelude = module_prelude();
+	if (source.type == E_STRING) {
+		start->filename = null_terminated_string(source);
+	} else if (!(start->code = new_message(source, &result.err))) {
+		free(start);
+		return result;
+	}
+	// One reference for the thread, and one for the result.
+	struct Actor *actor = new_actor_state();
+	actor->ref_count = 2;
+	start->actor = actor;
+	if (!start_thread(actor_main, start)) {
+		perror("FATAL");
+		exit(2);
+	}
+	result.expr = new_actor(actor);
+	return result;
+}
+
+struct Actor *self_actor(void) {
+	if (!current_actor) {
+		current_actor = new_actor_state();
+	}
+	return current_actor;
+}
+
+struct EvalResult send_to_actor(
+		struct Actor *actor, struct Expression message) {
+	struct EvalResult result = { .err = NULL };
+	struct Message *msg = new_message(message, &result.err);
+	if (!msg) {
+		return result;
+	}
+	pthread_mutex_lock(&actor->lock);
+	if (actor->tail) {
+		actor->tail->next = msg;
+	} else {
+		actor->head = msg;
+	}
+	actor->tail = msg;
+	pthread_cond_signal(&actor->arrived);
+	pthread_mutex_unlock(&actor->lock);
+	result.expr = new_void();
+	return result;
+}
+
+struct Expression receive_message(void) {
+	struct Actor *actor = self_actor();
+	pthread_mutex_lock(&actor->lock);
+	while (!actor->head) {
+		pthread_cond_wait(&actor->arrived, &actor->lock);
+	}
+	struct Message *msg = actor->head;
+	actor->head = msg->next;
+	if (!actor->head) {
+		actor->tail = NULL;
+	}
+	pthread_mutex_unlock(&actor->lock);
+	return open_message(msg);
+}
+
+struct Actor *retain_actor(struct Actor *actor) {
+	__atomic_add_fetch(&actor->ref_count, 1, __ATOMIC_RELAXED);
+	return actor;
+}
+
+void release_actor(struct Actor *actor) {
+	if (__atomic_sub_fetch(&actor->ref_count, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+	while (actor->head) {
+		struct Message *next = actor->head->next;
+		free_message(actor->head);
+		actor->head = next;
+	}
+	pthread_cond_destroy(&actor->arrived);
+	pthread_mutex_destroy(&actor->lock);
+	free(actor);
+}
@@ -0,0 +1,43 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef ACTOR_H
+#define ACTOR_H
+
+#include "eval.h"
+#include "expr.h"
+
+// An Actor is an interpreter running on an OS thread of its own, with its own
+// context, global environment, and heap. Actors share nothing: they only
+// communicate by sending messages to each other's mailboxes, and messages are
+// copied into the receiving actor's heap. Only data can be sent (numbers,
+// characters, booleans, strings, symbols, lists, standard procedures, and
+// actors), not closures, ports, futures, or channels. The thread running the
+// main program is an actor too, which is created when it is first needed.
+struct Actor;
+
+// Starts an actor. If 'source' is a string, the actor loads the file it names.
+// Otherwise, it evaluates a copy of 'source' in its global environment, and if
+// the result is a procedure, calls it with no arguments. Errors are printed,
+// and end the actor. Returns the new actor, or an error if 'source' cannot be
+// copied.
+struct EvalResult spawn_actor(struct Expression source);
+
+// Returns the actor of the calling thread.
+struct Actor *self_actor(void);
+
+// Copies 'message' to the mailbox of 'actor'. Returns void, or an error if the
+// message contains something that cannot be copied.
+struct EvalResult send_to_actor(struct Actor *actor, struct Expression message);
+
+// Removes the oldest message from the calling actor's mailbox and returns it,
+// waiting for one to arrive if it is empty.
+struct Expression receive_message(void);
+
+// Adds a reference to the actor, and returns it.
+struct Actor *retain_actor(struct Actor *actor);
+
+// Drops a reference to the actor. The actor is freed once it has finished and
+// there are no references left.
+void release_actor(struct Actor *actor);
+
+#endif
@@ -0,0 +1,48 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#include "context.h"
+
+#include "eval.h"
+#include "foreign.h"
+#include "heap.h"
+#include "intern.h"
+#include "load.h"
+#include "module.h"
+#include "repl.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+// The context used by threads that have not switched to another one. It is
+// zero-initialized like a context from 'new_context'.
+static struct EvaContext default_context;
+
+_Thread_local struct EvaContext *current_context = &default_context;
+
+struct EvaContext *new_context(void) {
+	return xcalloc(1, sizeof(struct EvaContext));
+}
+
+void free_context(struct EvaContext *ctx) {
+	// Free the state while the context is current, so that the boxes released
+	// along the way are counted in the right place. Modules and cached code
+	// refer to interned strings, so the intern table goes last.
+	struct EvaContext *prev = use_context(ctx);
+	free_modules();
+	free_load_cache();
+	free_repl_state();
+	release_retired_code();
+	free_alloc_sites();
+	free_foreign();
+	free_intern_table();
+	use_context(prev == ctx ? &default_context : prev);
+	if (ctx != &default_context) {
+		free(ctx);
+	}
+}
+
+struct EvaContext *use_context(struct EvaContext *ctx) {
+	struct EvaContext *prev = current_context;
+	current_context = ctx;
+	return prev;
+}
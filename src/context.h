@@ -0,0 +1,132 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "expr.h"
+#include "heap.h"
+#include "intern.h"
+#include "load.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct Arena;
+struct Box;
+struct CacheEntry;
+struct Environment;
+struct Foreign;
+struct Loading;
+struct Module;
+struct Parser;
+struct Port;
+struct Site;
+struct Slot;
+
+// An EvaContext holds all the state of an interpreter: the intern table, heap
+// statistics, the load cache, the registered modules and foreign procedures,
+// and the input state of the REPL. Each group of fields belongs to the file
+// named in its comment, and no other file should touch it. Every thread has a
+// current context, which 'eval', 'parse', 'execute', and everything they call
+// use implicitly.
+//
+// Threads using different contexts do not interfere with each other, so several
+// interpreters can run in one process. Expressions and environments belong to
+// the context they were created in, and must never be used with another one
+// (in particular, symbols from different contexts are unrelated). The profiler
+// and the command line options are still shared by the whole process.
+struct EvaContext {
+	// Intern table (intern.c).
+	struct {
+		struct Slot *slots;
+		size_t slots_cap;
+		const char **strings;
+		size_t strings_len;
+		size_t strings_cap;
+		struct Arena *arena;
+		size_t arena_count;
+		size_t arena_bytes;
+		size_t arena_used;
+		size_t string_bytes;
+	} intern;
+
+	// Heap statistics and allocation sites (heap.c), and reference count
+	// logging (expr.c).
+	struct {
+		struct HeapStats stats;
+		struct Box *alloc_site;
+		struct Site *sites;
+		size_t sites_len;
+		size_t sites_cap;
+		size_t unattributed_count;
+		size_t unattributed_bytes;
+		int total_box_count;
+		int total_ref_count;
+	} heap;
+
+	// Evaluation counter and code replaced by rewrites (eval.c).
+	struct {
+		size_t count;
+		struct Expression retired;
+	} eval;
+
+	// File cache (load.c).
+	struct {
+		struct CacheEntry *cache;
+		size_t cache_len;
+		size_t cache_cap;
+		struct LoadStats stats;
+	} load;
+
+	// Module registry (module.c).
+	struct {
+		struct Module *modules;
+		size_t modules_len;
+		size_t modules_cap;
+		struct Loading *loading;
+		size_t loading_len;
+		size_t loading_cap;
+		struct Environment *base;
+		bool without_prelude;
+	} module;
+
+	// Foreign procedures (foreign.c).
+	struct {
+		struct Foreign *procs;
+		size_t len;
+		size_t cap;
+	} foreign;
+
+	// Stream that error messages are printed to, or NULL for standard error
+	// (error.c, but it may be set by anyone).
+	FILE *error_stream;
+
+	// Standard input state (repl.c).
+	struct {
+		char *saved_buffer;
+		size_t saved_buffer_length;
+		size_t saved_buffer_offset;
+		struct Parser *read_parser;
+		struct Port *stdin_port;
+	} repl;
+};
+
+// The current context of the calling thread. Every thread starts out using the
+// same default context, which is all the main program needs. Other threads that
+// run code concurrently must switch to contexts of their own.
+extern _Thread_local struct EvaContext *current_context;
+
+// Creates a new, empty context. It has no interned strings, so standard
+// environments must be created after switching to it.
+struct EvaContext *new_context(void);
+
+// Frees a context created by 'new_context', along with everything it owns. The
+// context must not be current in any thread other than the calling one.
+void free_context(struct EvaContext *ctx);
+
+// Makes 'ctx' the current context of the calling thread, and returns the
+// context that was current before.
+struct EvaContext *use_context(struct EvaContext *ctx);
+
+#endif
@@ -2,7 +2,9 @@
 
 #include "env.h"
 
+#include "heap.h"
 #include "intern.h"
+#include "parallel.h"
 #include "util.h"
 
 #include <assert.h>
@@ -33,6 +35,7 @@ struct Bucket {
 struct Environment {
 	int ref_count;
 	struct Environment *parent;
+	size_t depth;
 	size_t size;
 	size_t total_entries;
 	struct Bucket *table;
@@ -42,9 +45,11 @@ struct Environment *new_base_environment(void) {
 	struct Environment *env = xmalloc(sizeof *env);
 	env->ref_count = 1;
 	env->parent = NULL;
+	env->depth = 1;
 	env->size = BASE_TABLE_SIZE;
 	env->total_entries = 0;
 	env->table = xcalloc(env->size, sizeof *env->table);
+	count_environment(env->depth);
 	return env;
 }
 
@@ -53,43 +58,78 @@ struct Environment *new_environment(
 	struct Environment *env = xmalloc(sizeof *env);
 	env->ref_count = 1;
 	env->parent = retain_environment(parent);
+	env->depth = parent ? parent->depth + 1 : 1;
 	env->size = size_estimate;
 	env->total_entries = 0;
 	env->table = env->size == 0 ? NULL : xcalloc(env->size, sizeof *env->table);
+	count_environment(env->depth);
 	return env;
 }
 
-static void dealloc_environment(struct Environment *env) {
-	for (size_t i = 0; i < env->size; i++) {
-		size_t len = env->table[i].len;
-		struct Entry *ents = env->table[i].entries;
+// Releases the expressions in a table of 'size' buckets, and frees it.
+static void free_table(struct Bucket *table, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		size_t len = table[i].len;
+		struct Entry *ents = table[i].entries;
 		for (size_t j = 0; j < len; j++) {
 			release_expression(ents[j].expr);
 		}
 		free(ents);
 	}
+	free(table);
+}
+
+static void dealloc_environment(struct Environment *env) {
+	free_table(env->table, env->size);
+	count_environment_free(env->depth);
 	release_environment(env->parent);
-	free(env->table);
 	free(env);
 }
 
 struct Environment *retain_environment(struct Environment *env) {
 	if (env) {
-		env->ref_count++;
+		adjust_ref_count(&env->ref_count, 1);
 	}
 	return env;
 }
 
 void release_environment(struct Environment *env) {
 	if (env) {
-		assert(env->ref_count > 0);
-		env->ref_count--;
-		if (env->ref_count == 0) {
+		assert(__atomic_load_n(&env->ref_count, __ATOMIC_RELAXED) > 0);
+		if (adjust_ref_count(&env->ref_count, -1) == 0) {
 			dealloc_environment(env);
 		}
 	}
 }
 
+void clear_environment(struct Environment *env) {
+	// Detach the table first, since releasing the expressions can look up or
+	// bind variables in the environment.
+	struct Bucket *table = env->table;
+	size_t size = env->size;
+	env->table = NULL;
+	env->size = 0;
+	env->total_entries = 0;
+	free_table(table, size);
+}
+
+struct Environment *parent_environment(const struct Environment *env) {
+	return env->parent;
+}
+
+void for_each_binding(
+		const struct Environment *env,
+		void (*fn)(InternId key, struct Expression expr, void *data),
+		void *data) {
+	for (size_t i = 0; i < env->size; i++) {
+		size_t len = env->table[i].len;
+		struct Entry *ents = env->table[i].entries;
+		for (size_t j = 0; j < len; j++) {
+			fn(ents[j].key, ents[j].expr, data);
+		}
+	}
+}
+
 struct Expression *lookup(const struct Environment *env, InternId key) {
 	while (env) {
 		if (env->table) {
@@ -112,7 +152,6 @@ struct Expression *lookup(const struct Environment *env, InternId key) {
 
 static void bind_unchecked(
 		struct Environment *env, InternId key, struct Expression expr) {
-	env->total_entries++;
 	struct Bucket *bucket = env->table + (key % env->size);
 	if (!bucket->entries) {
 		// Initialize the bucket if it is empty.
@@ -142,7 +181,8 @@ static void bind_unchecked(
 	env->total_entries++;
 }
 
-void bind(struct Environment *env, InternId key, struct Expression expr) {
+void bind_variable(
+		struct Environment *env, InternId key, struct Expression expr) {
 	// Check if the load factor is greater than 0.75.
 	if (env->size == 0 || 4 * env->total_entries >= 3 * env->size) {
 		size_t old_size = env->size;
@@ -150,11 +190,14 @@ void bind(struct Environment *env, InternId key, struct Expression expr) {
 		// Create a table with double the number of buckets.
 		env->size = old_size == 0 ? CHILD_TABLE_SIZE : old_size * 2;
 		env->table = xcalloc(env->size, sizeof *env->table);
-		// Bind all the expressions into the new table.
+		env->total_entries = 0;
+		// Move all the expressions into the new table, which retains them, so
+		// release the references held by the old table.
 		for (size_t i = 0; i < old_size; i++) {
 			for (size_t j = 0; j < old_table[i].len; j++) {
 				struct Entry ent = old_table[i].entries[j];
 				bind_unchecked(env, ent.key, ent.expr);
+				release_expression(ent.expr);
 			}
 			if (old_table[i].entries) {
 				free(old_table[i].entries);
@@ -28,6 +28,22 @@ struct Environment *retain_environment(struct Environment *env);
 // all its bound expressions, if the reference count reaches zero.
 void release_environment(struct Environment *env);
 
+// Removes all the bindings from the environment (not including its parents),
+// releasing their expressions. Procedures bound in an environment usually refer
+// back to it, so this is needed to free it completely when it is no longer
+// used.
+void clear_environment(struct Environment *env);
+
+// Returns the parent of the environment, or NULL if it is a base environment.
+struct Environment *parent_environment(const struct Environment *env);
+
+// Calls 'fn' for each binding in the environment (not including its parents),
+// passing along 'data'. The order is unspecified.
+void for_each_binding(
+		const struct Environment *env,
+		void (*fn)(InternId key, struct Expression expr, void *data),
+		void *data);
+
 // Looks up the expression bound to 'key' in the environment and returns a
 // pointer to it. If it can't be found, searches in the chain of parents all the
 // way to the base environment. If none contain the key, returns NULL.
@@ -36,6 +52,7 @@ struct Expression *lookup(const struct Environment *env, InternId key);
 // Binds 'key' to 'expr' in the environment, retaining 'expr'. If 'key' has
 // previously been bound in the environment (not including its parents), this
 // overwrites the old expression.
-void bind(struct Environment *env, InternId key, struct Expression expr);
+void bind_variable(
+		struct Environment *env, InternId key, struct Expression expr);
 
 #endif
@@ -2,6 +2,7 @@
 
 #include "error.h"
 
+#include "context.h"
 #include "util.h"
 
 #include <assert.h>
@@ -33,13 +34,22 @@ static const char *const parse_error_messages[N_PARSE_ERROR_TYPES] = {
 // Strings to use for evaluation error types.
 static const char *const eval_error_messages[N_EVAL_ERROR_TYPES] = {
 	[ERR_ARITY]          = NULL,
+	[ERR_CLOSED_PORT]    = "Port is closed: ",
 	[ERR_CUSTOM]         = NULL,
+	[ERR_DEADLOCK]       = "All threads are blocked",
 	[ERR_DEFINE]         = "Invalid use of 'define'",
 	[ERR_DIV_ZERO]       = "Division by zero",
 	[ERR_DUP_PARAM]      = "Duplicate parameter '%s'",
+	[ERR_FOREIGN]        = NULL,
+	[ERR_FUTURE]         = "Evaluation of the future already failed",
+	[ERR_IMPORT_CYCLE]   = "Circular import of module '%s'",
 	[ERR_LOAD]           = "Error loading file: ",
+	[ERR_MESSAGE]        = "Cannot send to an actor: ",
+	[ERR_MODULE]         = "Unknown module '%s'",
 	[ERR_NEGATIVE_SIZE]  = "Size is negative: ",
 	[ERR_NON_EXHAUSTIVE] = "Non-exhaustive 'cond'",
+	[ERR_OPEN]           = "Error opening file: ",
+	[ERR_PORT_DIRECTION] = "Wrong direction for port: ",
 	[ERR_RANGE]          = "Index out of range: ",
 	[ERR_READ]           = NULL,
 	[ERR_SYNTAX]         = "Invalid syntax",
@@ -51,10 +61,14 @@ static const char *const eval_error_messages[N_EVAL_ERROR_TYPES] = {
 };
 
 struct ParseError *new_parse_error(
-		enum ParseErrorType type, char *owned_text, size_t index) {
+		enum ParseErrorType type,
+		char *owned_text,
+		size_t length,
+		size_t index) {
 	struct ParseError *err = xmalloc(sizeof *err);
 	err->type = type;
 	err->owned_text = owned_text;
+	err->length = length;
 	err->index = index;
 	return err;
 }
@@ -129,8 +143,13 @@ void free_eval_error(struct EvalError *err) {
 	case ERR_READ:
 		free_parse_error(err->parse_err);
 		break;
+	case ERR_CLOSED_PORT:
+	case ERR_FOREIGN:
 	case ERR_LOAD:
+	case ERR_MESSAGE:
 	case ERR_NEGATIVE_SIZE:
+	case ERR_OPEN:
+	case ERR_PORT_DIRECTION:
 	case ERR_RANGE:
 	case ERR_TYPE_OPERAND:
 	case ERR_TYPE_OPERATOR:
@@ -146,22 +165,30 @@ void free_eval_error(struct EvalError *err) {
 	free(err);
 }
 
+FILE *error_stream(void) {
+	FILE *stream = current_context->error_stream;
+	return stream ? stream : stderr;
+}
+
 void print_error(const char *context, const char *err_msg) {
-	fprintf(stderr, "%s: %s: %s\n", prefix, context, err_msg);
+	FILE *out = error_stream();
+	fprintf(out, "%s: %s: %s\n", prefix, context, err_msg);
 }
 
 void print_file_error(const char *filename) {
-	fprintf(stderr, "%s: %s: %s\n", prefix, filename, strerror(errno));
+	FILE *out = error_stream();
+	fprintf(out, "%s: %s: %s\n", prefix, filename, strerror(errno));
 }
 
 void print_parse_error(const char *filename, const struct ParseError *err) {
+	FILE *out = error_stream();
 	// Find the start and end of the line.
-	size_t start = err->index;
-	size_t end = err->index;
+	size_t start = MIN(err->index, err->length);
+	size_t end = start;
 	while (start > 0 && err->text[start-1] != '\n') {
 		start--;
 	}
-	while (err->text[end] && err->text[end] != '\n') {
+	while (end < err->length && err->text[end] != '\n') {
 		end++;
 	}
 
@@ -175,7 +202,7 @@ void print_parse_error(const char *filename, const struct ParseError *err) {
 	}
 
 	// Print the file information, error message, and the line of code.
-	fprintf(stderr, "%s: %s:%zu:%zu: %s\n%s%.*s\n%s%*s^\n",
+	fprintf(out, "%s: %s:%zu:%zu: %s\n%s%.*s\n%s%*s^\n",
 			prefix, filename, row, col, parse_error_messages[err->type],
 			indentation,
 			(int)(end - start), err->text + start,
@@ -191,7 +218,8 @@ void print_eval_error(const char *filename, const struct EvalError *err) {
 	}
 
 	// Print the error message.
-	fprintf(stderr, "%s: %s: ", prefix, filename);
+	FILE *out = error_stream();
+	fprintf(out, "%s: %s: ", prefix, filename);
 	const char *format = eval_error_messages[err->type];
 	switch (err->type) {
 	case ERR_READ:
@@ -199,46 +227,57 @@ void print_eval_error(const char *filename, const struct EvalError *err) {
 		break;
 	case ERR_CUSTOM:
 		break;
+	case ERR_FOREIGN:
+		fwrite(err->expr.box->str, 1, err->expr.box->len, out);
+		break;
+	case ERR_CLOSED_PORT:
+	case ERR_DEADLOCK:
 	case ERR_DEFINE:
 	case ERR_DIV_ZERO:
+	case ERR_FUTURE:
 	case ERR_LOAD:
+	case ERR_MESSAGE:
 	case ERR_NEGATIVE_SIZE:
 	case ERR_NON_EXHAUSTIVE:
+	case ERR_OPEN:
+	case ERR_PORT_DIRECTION:
 	case ERR_RANGE:
 	case ERR_SYNTAX:
 	case ERR_UNQUOTE:
-		fputs(format, stderr);
+		fputs(format, out);
 		break;
 	case ERR_DUP_PARAM:
+	case ERR_IMPORT_CYCLE:
+	case ERR_MODULE:
 	case ERR_UNBOUND_VAR:
-		fprintf(stderr, format, find_string(err->symbol_id));
+		fprintf(out, format, find_string(err->symbol_id));
 		break;
 	case ERR_TYPE_OPERAND:
-		fprintf(stderr, format,
+		fprintf(out, format,
 				err->arg_pos + 1,
 				expression_type_name(err->expected_type),
 				expression_type_name(err->expr.type));
 		break;
 	case ERR_TYPE_OPERATOR:
-		fprintf(stderr, format,
+		fprintf(out, format,
 				expression_type_name(E_MACRO),
 				expression_type_name(E_PROCEDURE),
 				expression_type_name(err->expr.type));
 		break;
 	case ERR_TYPE_VAR:
-		fprintf(stderr, format,
+		fprintf(out, format,
 				expression_type_name(E_SYMBOL),
 				expression_type_name(err->expr.type));
 		break;
 	case ERR_ARITY:
 		assert(err->arity != 0);
 		if (err->arity >= 0) {
-			fprintf(stderr, "Expected %d argument%s, got %zu",
+			fprintf(out, "Expected %d argument%s, got %zu",
 					err->arity,
 					err->arity == 1 ? "" : "s",
 					err->n_args);
 		} else {
-			fprintf(stderr, "Expected at least %d argument%s, got %zu",
+			fprintf(out, "Expected at least %d argument%s, got %zu",
 					ATLEAST(err->arity),
 					err->arity == -2 ? "" : "s",
 					err->n_args);
@@ -251,28 +290,32 @@ void print_eval_error(const char *filename, const struct EvalError *err) {
 	case ERR_CUSTOM:
 		for (size_t i = 0; i < err->array.size; i++) {
 			if (i > 0) {
-				putc(' ', stderr);
+				putc(' ', out);
 			}
-			print_expression(err->array.exprs[i], stderr);
+			print_expression(err->array.exprs[i], out);
 		}
 		break;
+	case ERR_CLOSED_PORT:
 	case ERR_LOAD:
+	case ERR_MESSAGE:
 	case ERR_NEGATIVE_SIZE:
+	case ERR_OPEN:
+	case ERR_PORT_DIRECTION:
 	case ERR_RANGE:
 	case ERR_TYPE_OPERAND:
 	case ERR_TYPE_OPERATOR:
 	case ERR_TYPE_VAR:
-		print_expression(err->expr, stderr);
+		print_expression(err->expr, out);
 		break;
 	default:
 		break;
 	}
-	putc('\n', stderr);
+	putc('\n', out);
 
 	// Print the context of the error.
 	if (err->has_code) {
-		fputs(indentation, stderr);
-		print_expression(err->code, stderr);
-		putc('\n', stderr);
+		fputs(indentation, out);
+		print_expression(err->code, out);
+		putc('\n', out);
 	}
 }
@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 // Filename to use when input is from a command-line argument.
 extern const char *const argv_filename;
@@ -28,17 +29,26 @@ enum ParseErrorType {
 };
 
 // Error types for evaluation errors.
-#define N_EVAL_ERROR_TYPES 16
+#define N_EVAL_ERROR_TYPES 25
 enum EvalErrorType {
 	                    // Fields of EvalErorr used:
 	ERR_ARITY,          // code, arity, n_args
+	ERR_CLOSED_PORT,    // code, expr
 	ERR_CUSTOM,         // code, array
+	ERR_DEADLOCK,       // code
 	ERR_DEFINE,         // code
 	ERR_DIV_ZERO,       // code
 	ERR_DUP_PARAM,      // code, symbol_id
+	ERR_FOREIGN,        // code, expr
+	ERR_FUTURE,         // code
+	ERR_IMPORT_CYCLE,   // code, symbol_id
 	ERR_LOAD,           // code, expr
+	ERR_MESSAGE,        // code, expr
+	ERR_MODULE,         // code, symbol_id
 	ERR_NEGATIVE_SIZE,  // code, expr
 	ERR_NON_EXHAUSTIVE, // code
+	ERR_OPEN,           // code, expr
+	ERR_PORT_DIRECTION, // code, expr
 	ERR_RANGE,          // code, expr
 	ERR_READ,           // parse_err
 	ERR_SYNTAX,         // code
@@ -51,14 +61,16 @@ enum EvalErrorType {
 
 // An error that causes the parse to fail. Errors created on the stack usually
 // use the 'text' field. Errors allocated by 'new_parse_error' use 'owned_text',
-// which is freed upon calling 'free_parse_error'.
+// which is freed upon calling 'free_parse_error'. The text does not need to be
+// null-terminated.
 struct ParseError {
 	enum ParseErrorType type;
 	union {
 		const char *text; // full text being parsed
 		char *owned_text; // same thing, but the error owns the memory
 	};
-	size_t index; // index in 'text' or 'owned_text' where the error occurred
+	size_t length; // length of 'text' or 'owned_text'
+	size_t index;  // index in 'text' or 'owned_text' where the error occurred
 };
 
 // A runtime error that occurs during code evaluation. These are usually created
@@ -77,7 +89,8 @@ struct EvalError {
 		};
 		// Used by ERR_CUSTOM:
 		struct Array array;
-		// Used by ERR_DUP_PARAM and ERR_UNBOUND_VAR:
+		// Used by ERR_DUP_PARAM, ERR_IMPORT_CYCLE, ERR_MODULE, and
+		// ERR_UNBOUND_VAR:
 		InternId symbol_id;
 		// Used by ERR_READ:
 		struct ParseError *parse_err;
@@ -92,7 +105,10 @@ struct EvalError {
 
 // Constructors for parse errors and evaluation errors.
 struct ParseError *new_parse_error(
-		enum ParseErrorType type, char *owned_text, size_t index);
+		enum ParseErrorType type,
+		char *owned_text,
+		size_t length,
+		size_t index);
 struct EvalError *new_eval_error(enum EvalErrorType type);
 struct EvalError *new_eval_error_expr(
 		enum EvalErrorType type, struct Expression expr);
@@ -113,17 +129,21 @@ struct EvalError *attach_code(struct EvalError *err, struct Expression code);
 void free_parse_error(struct ParseError *err);
 void free_eval_error(struct EvalError *err);
 
-// Prints a generic error message to standard error.
+// Returns the stream that errors are printed to: the current context's
+// 'error_stream' if it is set, and standard error otherwise.
+FILE *error_stream(void);
+
+// Prints a generic error message to the error stream.
 void print_error(const char *context, const char *err_msg);
 
-// Prints a file error to standard error based on the value of global 'errno'.
+// Prints a file error to the error stream based on the value of global 'errno'.
 void print_file_error(const char *filename);
 
-// Prints a parse error to standard error. Prints the filename, line number,
+// Prints a parse error to the error stream. Prints the filename, line number,
 // column, error message, and the problematic line of code.
 void print_parse_error(const char *filename, const struct ParseError *err);
 
-// Prints an evaluation error to standard error. Prints the filename, error
+// Prints an evaluation error to the error stream. Prints the filename, error
 // message, and other information stored in the evaluation error.
 void print_eval_error(const char *filename, const struct EvalError *err);
 
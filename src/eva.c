@@ -0,0 +1,451 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "eva.h"
+
+#include "context.h"
+#include "env.h"
+#include "error.h"
+#include "eval.h"
+#include "expr.h"
+#include "foreign.h"
+#include "intern.h"
+#include "module.h"
+#include "parse.h"
+#include "prelude.h"
+#include "repl.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Filename used in error messages for code evaluated through the interface.
+static const char *const api_filename = "<api>";
+
+// Message used when a registered function fails without calling 'eva_raise'.
+static const char *const err_native = "Foreign procedure failed";
+
+// A C function registered with 'eva_register'. This is the data pointer of the
+// foreign procedure, which calls it through 'call_native'.
+struct Native {
+	struct Eva *eva;
+	EvaFunction fn;
+	void *data;
+	struct Native *next;
+};
+
+struct Eva {
+	struct EvaContext *ctx;
+	struct Environment *env;
+	char *error;
+	struct Native *natives;
+};
+
+struct EvaValue {
+	struct Eva *eva;
+	struct Expression expr;
+};
+
+// Types of values, indexed by expression type.
+static const enum EvaType value_types[] = {
+	[E_VOID]         = EVA_VOID,
+	[E_EOF]          = EVA_OTHER,
+	[E_NULL]         = EVA_NULL,
+	[E_SYMBOL]       = EVA_SYMBOL,
+	[E_NUMBER]       = EVA_NUMBER,
+	[E_BOOLEAN]      = EVA_BOOLEAN,
+	[E_CHARACTER]    = EVA_CHARACTER,
+	[E_STDMACRO]     = EVA_OTHER,
+	[E_STDPROCMACRO] = EVA_OTHER,
+	[E_STDPROCEDURE] = EVA_PROCEDURE,
+	[E_PAIR]         = EVA_PAIR,
+	[E_STRING]       = EVA_STRING,
+	[E_MACRO]        = EVA_OTHER,
+	[E_PROCEDURE]    = EVA_PROCEDURE,
+	[E_PORT]         = EVA_OTHER,
+	[E_FUTURE]       = EVA_OTHER,
+	[E_CHANNEL]      = EVA_OTHER,
+	[E_ACTOR]        = EVA_OTHER
+};
+
+// Makes the context of 'eva' current, and returns the previous one. Every
+// function that touches expressions must do this first, and restore the
+// previous context with 'use_context' before returning.
+static struct EvaContext *enter(const struct Eva *eva) {
+	return use_context(eva->ctx);
+}
+
+// Wraps an expression in a new value, taking ownership of it.
+static struct EvaValue *wrap(struct Eva *eva, struct Expression expr) {
+	struct EvaValue *value = xmalloc(sizeof *value);
+	value->eva = eva;
+	value->expr = expr;
+	return value;
+}
+
+// Replaces the last error message with 'message', taking ownership of it.
+static void set_error(struct Eva *eva, char *message) {
+	free(eva->error);
+	eva->error = message;
+}
+
+// Starts capturing error messages printed in the current context, and returns
+// the stream they are written to.
+static FILE *start_capture(char **text, size_t *length) {
+	FILE *stream = open_memstream(text, length);
+	current_context->error_stream = stream;
+	return stream;
+}
+
+// Stops capturing error messages, and stores what was printed as the last
+// error message of 'eva'.
+static void finish_capture(
+		struct Eva *eva, FILE *stream, char **text, size_t *length) {
+	current_context->error_stream = NULL;
+	if (!stream) {
+		set_error(eva, NULL);
+		return;
+	}
+	fclose(stream);
+	if (*length > 0 && (*text)[*length - 1] == '\n') {
+		(*text)[--*length] = '\0';
+	}
+	set_error(eva, *text);
+}
+
+// Stores the message for an evaluation error as the last error, and frees it.
+static void capture_eval_error(struct Eva *eva, struct EvalError *err) {
+	char *text;
+	size_t length;
+	FILE *stream = start_capture(&text, &length);
+	if (stream) {
+		print_eval_error(api_filename, err);
+	}
+	finish_capture(eva, stream, &text, &length);
+	free_eval_error(err);
+}
+
+// Stores the message for a parse error in 'code' as the last error.
+static void capture_parse_error(
+		struct Eva *eva, const char *code, size_t length, size_t index,
+		int type) {
+	struct ParseError err = {
+		.type = (enum ParseErrorType)type,
+		.text = code,
+		.length = length,
+		.index = index
+	};
+	char *text;
+	size_t text_length;
+	FILE *stream = start_capture(&text, &text_length);
+	if (stream) {
+		print_parse_error(api_filename, &err);
+	}
+	finish_capture(eva, stream, &text, &text_length);
+}
+
+struct Eva *eva_new(bool prelude) {
+	struct Eva *eva = xmalloc(sizeof *eva);
+	eva->ctx = new_context();
+	eva->error = NULL;
+	eva->natives = NULL;
+	struct EvaContext *prev = enter(eva);
+	set_module_prelude(prelude);
+	eva->env = new_standard_environment();
+	if (prelude) {
+		execute(PRELUDE_FILENAME, prelude_source, strlen(prelude_source),
+				eva->env, false);
+	}
+	use_context(prev);
+	return eva;
+}
+
+void eva_free(struct Eva *eva) {
+	struct EvaContext *prev = enter(eva);
+	clear_environment(eva->env);
+	release_environment(eva->env);
+	use_context(prev);
+	free_context(eva->ctx);
+	while (eva->natives) {
+		struct Native *next = eva->natives->next;
+		free(eva->natives);
+		eva->natives = next;
+	}
+	free(eva->error);
+	free(eva);
+}
+
+const char *eva_error(const struct Eva *eva) {
+	return eva->error;
+}
+
+struct EvaValue *eva_eval(struct Eva *eva, const char *code) {
+	return eva_eval_n(eva, code, strlen(code));
+}
+
+struct EvaValue *eva_eval_n(struct Eva *eva, const char *code, size_t length) {
+	struct EvaContext *prev = enter(eva);
+	set_error(eva, NULL);
+	struct Expression last = new_void();
+	size_t offset = 0;
+	for (;;) {
+		offset += skip_whitespace(code + offset, length - offset);
+		if (offset == length) {
+			break;
+		}
+		struct ParseResult parsed = parse_n(code + offset, length - offset);
+		if (parsed.err_type != PARSE_SUCCESS) {
+			capture_parse_error(eva, code, length,
+					offset + parsed.chars_read, parsed.err_type);
+			release_expression(last);
+			use_context(prev);
+			return NULL;
+		}
+		struct EvalResult result = eval(parsed.expr, eva->env, true);
+		release_expression(parsed.expr);
+		if (result.err) {
+			capture_eval_error(eva, result.err);
+			release_expression(last);
+			use_context(prev);
+			return NULL;
+		}
+		release_expression(last);
+		last = result.expr;
+		offset += parsed.chars_read;
+	}
+	use_context(prev);
+	return wrap(eva, last);
+}
+
+struct EvaValue *eva_lookup(struct Eva *eva, const char *name) {
+	struct EvaContext *prev = enter(eva);
+	struct Expression *expr = lookup(eva->env, intern_string(name));
+	struct EvaValue *value =
+		expr ? wrap(eva, retain_expression(*expr)) : NULL;
+	use_context(prev);
+	return value;
+}
+
+void eva_define(struct Eva *eva, const char *name, struct EvaValue *value) {
+	struct EvaContext *prev = enter(eva);
+	bind_variable(eva->env, intern_string(name), value->expr);
+	use_context(prev);
+}
+
+struct EvaValue *eva_call(
+		struct Eva *eva,
+		struct EvaValue *proc,
+		struct EvaValue *const *args,
+		size_t n) {
+	struct EvaContext *prev = enter(eva);
+	set_error(eva, NULL);
+	struct Expression *exprs = NULL;
+	if (n > 0) {
+		exprs = xmalloc(n * sizeof *exprs);
+		for (size_t i = 0; i < n; i++) {
+			exprs[i] = args[i]->expr;
+		}
+	}
+	struct EvalResult result =
+		apply_procedure(proc->expr, exprs, n, eva->env);
+	struct EvaValue *value = NULL;
+	if (result.err) {
+		// An error raised by "error" itself owns the argument array.
+		if (result.err->type == ERR_CUSTOM
+				&& result.err->array.exprs == exprs) {
+			exprs = NULL;
+		}
+		capture_eval_error(eva, result.err);
+	} else {
+		value = wrap(eva, result.expr);
+	}
+	free(exprs);
+	use_context(prev);
+	return value;
+}
+
+// Calls a registered C function. This is the ForeignFunction of every
+// procedure registered with 'eva_register'.
+static struct EvalResult call_native(
+		struct Expression *args, size_t n, void *data) {
+	struct Native *native = data;
+	struct Eva *eva = native->eva;
+	struct EvaValue **values = NULL;
+	if (n > 0) {
+		values = xmalloc(n * sizeof *values);
+		for (size_t i = 0; i < n; i++) {
+			values[i] = wrap(eva, retain_expression(args[i]));
+		}
+	}
+	set_error(eva, NULL);
+	struct EvaValue *value = native->fn(eva, values, n, native->data);
+	for (size_t i = 0; i < n; i++) {
+		eva_release(values[i]);
+	}
+	free(values);
+
+	struct EvalResult result;
+	result.err = NULL;
+	if (value) {
+		result.expr = value->expr;
+		free(value);
+	} else {
+		result.err = new_foreign_error(eva->error ? eva->error : err_native);
+	}
+	return result;
+}
+
+void eva_register(
+		struct Eva *eva,
+		const char *name,
+		int arity,
+		EvaFunction fn,
+		void *data) {
+	struct Native *native = xmalloc(sizeof *native);
+	native->eva = eva;
+	native->fn = fn;
+	native->data = data;
+	native->next = eva->natives;
+	eva->natives = native;
+	struct EvaContext *prev = enter(eva);
+	struct Expression expr = new_foreign(name, arity, call_native, native);
+	bind_variable(eva->env, intern_string(name), expr);
+	use_context(prev);
+}
+
+struct EvaValue *eva_raise(struct Eva *eva, const char *message) {
+	size_t length = strlen(message);
+	char *copy = xmalloc(length + 1);
+	memcpy(copy, message, length + 1);
+	set_error(eva, copy);
+	return NULL;
+}
+
+void eva_release(struct EvaValue *value) {
+	if (value) {
+		struct EvaContext *prev = enter(value->eva);
+		release_expression(value->expr);
+		use_context(prev);
+		free(value);
+	}
+}
+
+enum EvaType eva_type(const struct EvaValue *value) {
+	return value_types[value->expr.type];
+}
+
+struct EvaValue *eva_void(struct Eva *eva) {
+	return wrap(eva, new_void());
+}
+
+struct EvaValue *eva_null(struct Eva *eva) {
+	return wrap(eva, new_null());
+}
+
+struct EvaValue *eva_boolean(struct Eva *eva, bool boolean) {
+	return wrap(eva, new_boolean(boolean));
+}
+
+struct EvaValue *eva_number(struct Eva *eva, long number) {
+	return wrap(eva, new_number(number));
+}
+
+struct EvaValue *eva_character(struct Eva *eva, char character) {
+	return wrap(eva, new_character(character));
+}
+
+struct EvaValue *eva_string(struct Eva *eva, const char *str, size_t length) {
+	char *copy = xmalloc(length + 1);
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	struct EvaContext *prev = enter(eva);
+	struct EvaValue *value = wrap(eva, new_string(copy, length));
+	use_context(prev);
+	return value;
+}
+
+struct EvaValue *eva_symbol(struct Eva *eva, const char *name) {
+	struct EvaContext *prev = enter(eva);
+	struct EvaValue *value = wrap(eva, new_symbol(intern_string(name)));
+	use_context(prev);
+	return value;
+}
+
+struct EvaValue *eva_cons(
+		struct Eva *eva, struct EvaValue *car, struct EvaValue *cdr) {
+	struct EvaContext *prev = enter(eva);
+	struct EvaValue *value = wrap(eva, new_pair(
+			retain_expression(car->expr), retain_expression(cdr->expr)));
+	use_context(prev);
+	return value;
+}
+
+bool eva_to_number(const struct EvaValue *value, long *out) {
+	if (value->expr.type != E_NUMBER) {
+		return false;
+	}
+	*out = value->expr.number;
+	return true;
+}
+
+bool eva_to_character(const struct EvaValue *value, char *out) {
+	if (value->expr.type != E_CHARACTER) {
+		return false;
+	}
+	*out = value->expr.character;
+	return true;
+}
+
+bool eva_to_string(
+		const struct EvaValue *value, const char **out, size_t *length) {
+	if (value->expr.type != E_STRING) {
+		return false;
+	}
+	*out = value->expr.box->str;
+	*length = value->expr.box->len;
+	return true;
+}
+
+bool eva_to_symbol(const struct EvaValue *value, const char **out) {
+	if (value->expr.type != E_SYMBOL) {
+		return false;
+	}
+	struct EvaContext *prev = enter(value->eva);
+	*out = find_string(value->expr.symbol_id);
+	use_context(prev);
+	return true;
+}
+
+bool eva_truthy(const struct EvaValue *value) {
+	return expression_truthy(value->expr);
+}
+
+struct EvaValue *eva_car(const struct EvaValue *value) {
+	if (value->expr.type != E_PAIR) {
+		return NULL;
+	}
+	return wrap(value->eva, retain_expression(value->expr.box->car));
+}
+
+struct EvaValue *eva_cdr(const struct EvaValue *value) {
+	if (value->expr.type != E_PAIR) {
+		return NULL;
+	}
+	return wrap(value->eva, retain_expression(value->expr.box->cdr));
+}
+
+char *eva_to_text(const struct EvaValue *value) {
+	char *text = NULL;
+	size_t length = 0;
+	FILE *stream = open_memstream(&text, &length);
+	if (!stream) {
+		return NULL;
+	}
+	struct EvaContext *prev = enter(value->eva);
+	print_expression(value->expr, stream);
+	use_context(prev);
+	fclose(stream);
+	return text;
+}
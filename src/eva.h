@@ -0,0 +1,162 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef EVA_H
+#define EVA_H
+
+// This is the public interface of libeva, for embedding the interpreter in
+// other programs. It is the only header that embedders should include, and it
+// does not depend on any of the others. All the types are opaque, so programs
+// built against one version of the library keep working with later ones that
+// have the same EVA_API_VERSION.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Version of the interface. It changes whenever a function is removed or its
+// behavior changes incompatibly.
+#define EVA_API_VERSION 1
+
+// Marks the functions exported by the shared library.
+#if defined(__GNUC__)
+#define EVA_API __attribute__((visibility("default")))
+#else
+#define EVA_API
+#endif
+
+// Arity for procedures that take at least 'n' arguments.
+#define EVA_ATLEAST(n) (-(n) - 1)
+
+// An Eva is an interpreter with its own global environment. Interpreters are
+// independent of each other: different threads can use different interpreters
+// at the same time, but an interpreter must only be used by one thread at a
+// time.
+struct Eva;
+
+// An EvaValue is a reference to a Scheme value held by the caller. Every value
+// returned by a function below is a new reference, which must be released
+// with 'eva_release'. Values belong to the interpreter that created them, and
+// must not be passed to another one.
+struct EvaValue;
+
+// Types of values.
+enum EvaType {
+	EVA_VOID,
+	EVA_NULL,
+	EVA_BOOLEAN,
+	EVA_NUMBER,
+	EVA_CHARACTER,
+	EVA_STRING,
+	EVA_SYMBOL,
+	EVA_PAIR,
+	EVA_PROCEDURE,
+	EVA_OTHER // macros, ports, and the end-of-file object
+};
+
+// A C function registered as a Scheme procedure. It receives the 'n' arguments
+// in 'args', which it must not release, and the data pointer given when it was
+// registered. It returns a new value on success. To signal an error, it returns
+// the result of 'eva_raise'.
+typedef struct EvaValue *(*EvaFunction)(
+		struct Eva *eva, struct EvaValue *const *args, size_t n, void *data);
+
+// Creates an interpreter. If 'prelude' is true, the prelude (procedures such as
+// "map" and "list") is loaded into its global environment.
+EVA_API struct Eva *eva_new(bool prelude);
+
+// Frees an interpreter. All its values must be released first.
+EVA_API void eva_free(struct Eva *eva);
+
+// Returns the error message of the last call to 'eva_eval', 'eva_eval_n', or
+// 'eva_call', or NULL if it succeeded. The message is formatted like the ones
+// printed by the eva program. It is valid until the next call to one of those
+// functions.
+EVA_API const char *eva_error(const struct Eva *eva);
+
+// Evaluates all the expressions in 'code' in the global environment, and
+// returns the value of the last one (void if there are none). Definitions are
+// allowed. Returns NULL if there is an error.
+EVA_API struct EvaValue *eva_eval(struct Eva *eva, const char *code);
+
+// Like 'eva_eval', but takes the length of the code, which does not need to be
+// null-terminated.
+EVA_API struct EvaValue *eva_eval_n(
+		struct Eva *eva, const char *code, size_t length);
+
+// Returns the value of the global variable 'name', or NULL if it is unbound.
+EVA_API struct EvaValue *eva_lookup(struct Eva *eva, const char *name);
+
+// Binds the global variable 'name' to 'value'.
+EVA_API void eva_define(
+		struct Eva *eva, const char *name, struct EvaValue *value);
+
+// Calls the procedure 'proc' with the 'n' arguments in 'args', and returns the
+// result. Returns NULL if there is an error.
+EVA_API struct EvaValue *eva_call(
+		struct Eva *eva,
+		struct EvaValue *proc,
+		struct EvaValue *const *args,
+		size_t n);
+
+// Registers 'fn' as a new standard procedure, and binds it to 'name' in the
+// global environment. It accepts exactly 'arity' arguments, or at least 'n' if
+// 'arity' is EVA_ATLEAST(n). The interpreter checks the number of arguments
+// before calling it, but the function must check their types.
+EVA_API void eva_register(
+		struct Eva *eva,
+		const char *name,
+		int arity,
+		EvaFunction fn,
+		void *data);
+
+// Records an error with the given message, and returns NULL. An EvaFunction
+// returns this to make the procedure call fail.
+EVA_API struct EvaValue *eva_raise(struct Eva *eva, const char *message);
+
+// Releases a value. This is a no-op if 'value' is NULL.
+EVA_API void eva_release(struct EvaValue *value);
+
+// Returns the type of a value.
+EVA_API enum EvaType eva_type(const struct EvaValue *value);
+
+// Constructors for values.
+EVA_API struct EvaValue *eva_void(struct Eva *eva);
+EVA_API struct EvaValue *eva_null(struct Eva *eva);
+EVA_API struct EvaValue *eva_boolean(struct Eva *eva, bool boolean);
+EVA_API struct EvaValue *eva_number(struct Eva *eva, long number);
+EVA_API struct EvaValue *eva_character(struct Eva *eva, char character);
+EVA_API struct EvaValue *eva_string(
+		struct Eva *eva, const char *str, size_t length);
+EVA_API struct EvaValue *eva_symbol(struct Eva *eva, const char *name);
+EVA_API struct EvaValue *eva_cons(
+		struct Eva *eva, struct EvaValue *car, struct EvaValue *cdr);
+
+// Conversions to C types. Each returns false if the value has the wrong type,
+// and otherwise stores the result in 'out' and returns true. For strings and
+// symbols, the characters are owned by the value (they are null-terminated for
+// symbols, but not necessarily for strings).
+EVA_API bool eva_to_number(const struct EvaValue *value, long *out);
+EVA_API bool eva_to_character(const struct EvaValue *value, char *out);
+EVA_API bool eva_to_string(
+		const struct EvaValue *value, const char **out, size_t *length);
+EVA_API bool eva_to_symbol(const struct EvaValue *value, const char **out);
+
+// Returns false if the value is #f, and true otherwise.
+EVA_API bool eva_truthy(const struct EvaValue *value);
+
+// Returns the car or the cdr of a pair, or NULL if the value is not a pair.
+EVA_API struct EvaValue *eva_car(const struct EvaValue *value);
+EVA_API struct EvaValue *eva_cdr(const struct EvaValue *value);
+
+// Returns the external representation of a value, as printed by "write", in a
+// newly allocated string that the caller must free.
+EVA_API char *eva_to_text(const struct EvaValue *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,23 +1,44 @@
 // Copyright 2016 Mitchell Kember. Subject to the MIT License.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "eval.h"
 
+#include "actor.h"
+#include "context.h"
 #include "env.h"
 #include "error.h"
+#include "foreign.h"
+#include "future.h"
+#include "green.h"
+#include "heap.h"
 #include "list.h"
+#include "load.h"
 #include "macro.h"
+#include "parallel.h"
+#include "port.h"
 #include "prelude.h"
+#include "profile.h"
 #include "proc.h"
 #include "repl.h"
+#include "timing.h"
 #include "type.h"
 #include "util.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Counter that the calling thread counts calls to 'eval' in instead of its
+// context, or NULL (see 'redirect_eval_count').
+static _Thread_local size_t *thread_evals = NULL;
+
+// Serializes code rewrites while parallel operations are running.
+static pthread_mutex_t rewrite_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Function prototypes.
 static struct EvalResult apply(
 		struct Expression expr,
@@ -86,10 +107,15 @@ static struct EvalResult quasiquote(
 				if (result.err) {
 					break;
 				}
-				if (!concat_list(&list, result.expr, list)) {
+				struct Expression spliced;
+				bool ok = concat_list(&spliced, result.expr, list);
+				release_expression(result.expr);
+				if (!ok) {
 					result.err = new_syntax_error(expr);
 					break;
 				}
+				release_expression(list);
+				list = spliced;
 			} else {
 				result = quasiquote(array.exprs[i], env);
 				if (result.err) {
@@ -159,7 +185,9 @@ static struct EvalResult apply_stdprocedure(
 		free_array(array);
 		break;
 	case S_READ:;
-		struct ParseError *parse_err = read_sexpr(&result.expr);
+		struct ParseError *parse_err = n == 1
+				? port_read_sexpr(args[0].box->port, &result.expr)
+				: read_sexpr(&result.expr);
 		if (parse_err) {
 			result.err = new_read_error(parse_err);
 		}
@@ -177,20 +205,79 @@ static struct EvalResult apply_stdprocedure(
 		const size_t len = strlen(PRELUDE_FILENAME);
 		if (args[0].box->len == len
 				&& strncmp(args[0].box->str, PRELUDE_FILENAME, len) == 0) {
-			execute(PRELUDE_FILENAME, prelude_source, env, false);
+			execute(PRELUDE_FILENAME, prelude_source, strlen(prelude_source),
+					env, false);
 			break;
 		}
 		char* filename = null_terminated_string(args[0]);
-		char* contents = read_file(filename);
-		if (contents == NULL) {
+		if (!load_file(filename, env)) {
 			result.err = new_eval_error_expr(ERR_LOAD, args[0]);
-		} else {
-			execute(filename, contents, env, false);
-			free(contents);
 		}
 		free(filename);
 		break;
+	case S_OPEN_INPUT_FILE:
+	case S_OPEN_OUTPUT_FILE:
+	case S_CALL_INPUT_FILE:
+	case S_CALL_OUTPUT_FILE:
+		filename = null_terminated_string(args[0]);
+		struct Port *port =
+				stdproc == S_OPEN_INPUT_FILE || stdproc == S_CALL_INPUT_FILE
+				? open_input_port(filename)
+				: open_output_port(filename);
+		free(filename);
+		if (!port) {
+			result.err = new_eval_error_expr(ERR_OPEN, args[0]);
+			break;
+		}
+		result.expr = new_port(port);
+		if (stdproc == S_CALL_INPUT_FILE || stdproc == S_CALL_OUTPUT_FILE) {
+			// Call the procedure, and then close the port.
+			struct Expression port_expr = result.expr;
+			result = apply(args[1], &port_expr, 1, env);
+			close_port(port);
+			release_expression(port_expr);
+		}
+		break;
+	case S_CALL_WITH_TIMING:;
+		struct Timing start = timing_now();
+		result = apply(args[0], NULL, 0, env);
+		if (!result.err) {
+			struct Timing timing = timing_since(start);
+			result.expr = new_pair(result.expr, timing_to_list(timing));
+		}
+		break;
+	case S_PMAP:
+		result = parallel_map(args[0], args[1], env);
+		break;
+	case S_PFOR_EACH:
+		result = parallel_for_each(args[0], args[1], env);
+		break;
+	case S_PREDUCE:
+		result = parallel_reduce(args[0], args[1], args[2], env);
+		break;
+	case S_TOUCH:
+		result = touch_future(args[0].box->future);
+		break;
+	case S_SPAWN:
+		result = spawn_green_thread(args[0], env);
+		break;
+	case S_CHANNEL_SEND:
+		result = channel_send(args[0].box->channel, args[1]);
+		break;
+	case S_CHANNEL_RECV:
+		result = channel_recv(args[0].box->channel);
+		break;
+	case S_SPAWN_ACTOR:
+		result = spawn_actor(args[0]);
+		break;
+	case S_ACTOR_SEND:
+		result = send_to_actor(args[0].box->actor, args[1]);
+		break;
 	default:
+		if (is_foreign(stdproc)) {
+			result = apply_foreign(stdproc, args, n);
+			break;
+		}
 		result.expr = invoke_stdprocedure(stdproc, args, n);
 		break;
 	}
@@ -211,6 +298,10 @@ static struct EvalResult apply(
 		return result;
 	}
 
+	bool profiled = profile_enabled && expr.type != E_STDMACRO;
+	if (profiled) {
+		profile_enter(expr);
+	}
 	switch (expr.type) {
 	case E_STDMACRO:
 		result = apply_stdmacro(expr.stdmacro, args, n, env);
@@ -232,7 +323,7 @@ static struct EvalResult apply(
 				new_environment(expr.box->env, (size_t)abs(arity));
 		size_t limit = arity < 0 ? (size_t)ATLEAST(arity) : (size_t)arity;
 		for (size_t i = 0; i < limit; i++) {
-			bind(aug, expr.box->params[i].symbol_id, args[i]);
+			bind_variable(aug, expr.box->params[i].symbol_id, args[i]);
 		}
 		// Collect extra arguments in a list.
 		if (arity < 0) {
@@ -242,7 +333,7 @@ static struct EvalResult apply(
 				.exprs = args + limit
 			};
 			struct Expression list = array_to_list(array);
-			bind(aug, expr.box->params[limit].symbol_id, list);
+			bind_variable(aug, expr.box->params[limit].symbol_id, list);
 			release_expression(list);
 		}
 		// Evaluate the body.
@@ -253,9 +344,32 @@ static struct EvalResult apply(
 		assert(false);
 		break;
 	}
+	if (profiled) {
+		profile_leave();
+	}
 	return result;
 }
 
+struct EvalResult apply_procedure(
+		struct Expression proc,
+		struct Expression *args,
+		size_t n,
+		struct Environment *env) {
+	struct EvalResult result;
+	result.err = NULL;
+	Arity arity;
+	if ((proc.type != E_STDPROCEDURE && proc.type != E_PROCEDURE)
+			|| !expression_arity(&arity, proc)) {
+		result.err = new_eval_error_expr(ERR_TYPE_OPERATOR, proc);
+		return result;
+	}
+	if (!arity_allows(arity, n)) {
+		result.err = new_arity_error(arity, n);
+		return result;
+	}
+	return apply(proc, args, n, env);
+}
+
 // Evaluates the 'n' expressions of 'args' in 'env', replacing each element of
 // the array with its evaluated result. Upon encountering an error, releases all
 // evaluation results created so far and returns the evaluation error.
@@ -335,19 +449,62 @@ static struct EvalResult eval_application(
 	return result;
 }
 
+// Replaces the pair that '*slot' refers to with 'pair'. Other threads may be
+// reading the code while it is rewritten, so the box is replaced with a single
+// atomic store, and the new pair is complete before it becomes visible.
+static void publish_pair(struct Expression *slot, struct Expression pair) {
+	assert(slot->type == E_PAIR && pair.type == E_PAIR);
+	__atomic_store_n(&slot->box, pair.box, __ATOMIC_RELEASE);
+}
+
+// Releases code that a rewrite has replaced. While parallel operations are
+// running, other threads may still be reading it, so it is kept until they
+// finish.
+static void retire_code(struct Expression code) {
+	if (parallel_active()) {
+		struct EvaContext *ctx = current_context;
+		ctx->eval.retired = new_pair(code, ctx->eval.retired);
+	} else {
+		release_expression(code);
+	}
+}
+
+// Returns true if 'rewrite_code' would change the application 'args' of the
+// standard macro 'stdmacro'.
+static bool needs_rewrite(
+		enum StandardMacro stdmacro, const struct Array *args) {
+	switch (stdmacro) {
+	case F_DEFINE:
+		return args->size == 1
+			|| (args->size >= 2 && args->exprs[0].type == E_PAIR);
+	case F_LAMBDA:
+	case F_LET:
+	case F_LET_STAR:
+		return args->size > 2;
+	case F_COND:
+		for (size_t i = 0; i < args->size; i++) {
+			if (args->exprs[i].type == E_PAIR
+					&& args->exprs[i].box->cdr.type == E_PAIR
+					&& args->exprs[i].box->cdr.box->cdr.type == E_PAIR) {
+				return true;
+			}
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
 // Applies rewrite rules on 'args' based on the operator. If the operator is
 // F_LAMBDA, F_LET_*, or F_COND and its body contains more than one expression,
 // wraps the expresions in an F_BEGIN block. If the operator is F_DEFINE and has
 // only one argument, rewrites it to assign a void value. If the operator is
 // F_DEFINE with the function definition syntax, rewrites it to use F_LAMBDA.
-static void rewrite_arguments(
+static void rewrite_code(
 		struct Expression code,
-		struct Expression operator,
+		enum StandardMacro stdmacro,
 		struct Array *args) {
-	if (operator.type != E_STDMACRO) {
-		return;
-	}
-	switch (operator.stdmacro) {
+	switch (stdmacro) {
 	case F_DEFINE:
 		if (args->size == 1) {
 			args->exprs = realloc(args->exprs, 2 * sizeof *args->exprs);
@@ -355,16 +512,19 @@ static void rewrite_arguments(
 			args->size = 2;
 		} else if (args->size >= 2 && args->exprs[0].type == E_PAIR) {
 			struct Expression cons = args->exprs[0];
-			struct Expression name = cons.box->car;
-			struct Expression list = cons.box->cdr;
-			struct Expression body = code.box->cdr.box->cdr;
-			code.box->cdr.box->car = name;
-			code.box->cdr.box->cdr = new_pair(cons, new_null());
-			cons.box->car = new_stdmacro(F_LAMBDA);
-			cons.box->cdr = new_pair(list, body);
+			struct Expression name = retain_expression(cons.box->car);
+			struct Expression lambda = new_pair(
+					new_stdmacro(F_LAMBDA),
+					new_pair(
+						retain_expression(cons.box->cdr),
+						retain_expression(code.box->cdr.box->cdr)));
+			struct Expression old = code.box->cdr;
+			publish_pair(&code.box->cdr,
+					new_pair(name, new_pair(lambda, new_null())));
+			retire_code(old);
 			args->size = 2;
 			args->exprs[0] = name;
-			args->exprs[1] = cons;
+			args->exprs[1] = lambda;
 		}
 		break;
 	case F_LAMBDA:
@@ -374,7 +534,8 @@ static void rewrite_arguments(
 			struct Expression block = new_pair(
 					new_stdmacro(F_BEGIN),
 					code.box->cdr.box->cdr);
-			code.box->cdr.box->cdr = new_pair(block, new_null());
+			publish_pair(&code.box->cdr.box->cdr,
+					new_pair(block, new_null()));
 			args->size = 2;
 			args->exprs[1] = block;
 		}
@@ -387,7 +548,8 @@ static void rewrite_arguments(
 				struct Expression block = new_pair(
 						new_stdmacro(F_BEGIN),
 						args->exprs[i].box->cdr);
-				args->exprs[i].box->cdr = new_pair(block, new_null());
+				publish_pair(&args->exprs[i].box->cdr,
+						new_pair(block, new_null()));
 			}
 		}
 		break;
@@ -396,10 +558,68 @@ static void rewrite_arguments(
 	}
 }
 
+// Rewrites the application 'code' of 'operator' with 'rewrite_code' if
+// necessary, updating its arguments 'args'. While parallel operations are
+// running, other threads may be evaluating the same code, so the rewrite is
+// done under a lock, and 'args' is made again from the code in case another
+// thread rewrote it first.
+static void rewrite_arguments(
+		struct Expression code,
+		struct Expression operator,
+		struct Array *args) {
+	if (operator.type != E_STDMACRO
+			|| !needs_rewrite(operator.stdmacro, args)) {
+		return;
+	}
+	if (!parallel_active()) {
+		rewrite_code(code, operator.stdmacro, args);
+		return;
+	}
+	pthread_mutex_lock(&rewrite_lock);
+	free_array(*args);
+	*args = list_to_array(code.box->cdr, false);
+	if (needs_rewrite(operator.stdmacro, args)) {
+		rewrite_code(code, operator.stdmacro, args);
+	}
+	pthread_mutex_unlock(&rewrite_lock);
+}
+
+size_t eval_count(void) {
+	return current_context->eval.count;
+}
+
+size_t *redirect_eval_count(size_t *counter) {
+	size_t *previous = thread_evals;
+	thread_evals = counter;
+	return previous;
+}
+
+void add_eval_count(size_t n) {
+	if (thread_evals) {
+		*thread_evals += n;
+	} else {
+		current_context->eval.count += n;
+	}
+}
+
+void release_retired_code(void) {
+	struct EvaContext *ctx = current_context;
+	release_expression(ctx->eval.retired);
+	ctx->eval.retired = new_null();
+}
+
 struct EvalResult eval(
 		struct Expression expr, struct Environment *env, bool allow_define) {
 	struct EvalResult result;
 	result.err = NULL;
+	if (thread_evals) {
+		(*thread_evals)++;
+	} else {
+		current_context->eval.count++;
+	}
+	if (green_budget != 0 && --green_budget == 0) {
+		preempt_green_thread();
+	}
 
 	switch (expr.type) {
 	case E_SYMBOL:;
@@ -418,6 +638,15 @@ struct EvalResult eval(
 			result.err = new_syntax_error(expr);
 			break;
 		}
+		// Attribute allocations to this application while evaluating it. The
+		// context is only touched when tracking is enabled, since worker
+		// threads may be sharing it (tracking disables parallelism).
+		struct EvaContext *ctx = current_context;
+		struct Box *outer_site = NULL;
+		if (alloc_sites_enabled) {
+			outer_site = ctx->heap.alloc_site;
+			ctx->heap.alloc_site = expr.box;
+		}
 		// Evaluate the application.
 		result = eval(expr.box->car, env, false);
 		if (!result.err) {
@@ -427,6 +656,9 @@ struct EvalResult eval(
 					result.expr, args.exprs, args.size, env, allow_define);
 			release_expression(operator);
 		}
+		if (alloc_sites_enabled) {
+			ctx->heap.alloc_site = outer_site;
+		}
 		if (!(result.err && result.err->type == ERR_CUSTOM)) {
 			free_array(args);
 		}
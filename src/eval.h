@@ -5,6 +5,8 @@
 
 #include "expr.h"
 
+#include <stddef.h>
+
 struct Environment;
 
 // EvalResult contains the result of evaluating code. The 'expr' field has a
@@ -20,4 +22,31 @@ struct EvalResult {
 struct EvalResult eval(
 		struct Expression expr, struct Environment *env, bool allow_define);
 
+// Applies the procedure 'proc' to the 'n' arguments in 'args', which are used
+// as they are, without being evaluated. Standard procedures that need an
+// environment, such as "eval", use 'env'. On success, returns a new expression.
+// Otherwise, allocates and returns an error.
+struct EvalResult apply_procedure(
+		struct Expression proc,
+		struct Expression *args,
+		size_t n,
+		struct Environment *env);
+
+// Returns the number of calls to 'eval' made so far in the current context.
+size_t eval_count(void);
+
+// Makes the calling thread count calls to 'eval' in '*counter' instead of in the
+// current context, or in the context again if 'counter' is NULL, and returns
+// the previous counter. This is used by worker threads like
+// 'redirect_heap_stats'.
+size_t *redirect_eval_count(size_t *counter);
+
+// Adds 'n' to the number of calls to 'eval' counted by the calling thread.
+void add_eval_count(size_t n);
+
+// Releases the code replaced by rewrites while parallel operations were running
+// (other threads might still have been reading it). Called when they finish,
+// and by 'free_context'.
+void release_retired_code(void);
+
 #endif
@@ -2,11 +2,21 @@
 
 #include "expr.h"
 
+#include "actor.h"
+#include "context.h"
 #include "env.h"
+#include "foreign.h"
+#include "future.h"
+#include "green.h"
+#include "heap.h"
+#include "parallel.h"
+#include "port.h"
 #include "util.h"
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -14,12 +24,16 @@
 #define REF_COUNT_LOGGING 0
 
 // Counters for the number of allocated boxes and the sum of all refernce
-// counts. Used for debugging memory bugs.
+// counts in the current context. Used for debugging memory bugs.
 #if REF_COUNT_LOGGING
-static int total_box_count = 0;
-static int total_ref_count = 0;
+#define total_box_count (current_context->heap.total_box_count)
+#define total_ref_count (current_context->heap.total_ref_count)
 #endif
 
+// Parameters of the 64-bit FNV-1a hash used by 'standard_names_hash'.
+#define FNV_OFFSET_BASIS_64 14695981039346656037u
+#define FNV_PRIME_64 1099511628211u
+
 const char *const NUMBER_FMT = "%ld";
 
 // A pair containing the name and arity of a macro or procedure.
@@ -31,6 +45,7 @@ struct NameArity {
 // User-facing expression type names.
 static const char *const expr_type_names[N_EXPRESSION_TYPES] = {
 	[E_VOID]         = "VOID",
+	[E_EOF]          = "EOF",
 	[E_NULL]         = "NULL",
 	[E_SYMBOL]       = "SYMBOL",
 	[E_NUMBER]       = "NUMBER",
@@ -42,7 +57,11 @@ static const char *const expr_type_names[N_EXPRESSION_TYPES] = {
 	[E_PAIR]         = "PAIR",
 	[E_STRING]       = "STRING",
 	[E_MACRO]        = "MACRO",
-	[E_PROCEDURE]    = "PROCEDURE"
+	[E_PROCEDURE]    = "PROCEDURE",
+	[E_PORT]         = "PORT",
+	[E_FUTURE]       = "FUTURE",
+	[E_CHANNEL]      = "CHANNEL",
+	[E_ACTOR]        = "ACTOR"
 };
 
 // Names and arities of standard macros.
@@ -60,7 +79,11 @@ static const struct NameArity stdmacro_name_arity[N_STANDARD_MACROS] = {
 	[F_LET]              = {"let", ATLEAST(2)},
 	[F_LET_STAR]         = {"let*", ATLEAST(2)},
 	[F_AND]              = {"and", ATLEAST(0)},
-	[F_OR]               = {"or", ATLEAST(0)}
+	[F_OR]               = {"or", ATLEAST(0)},
+	[F_DEFINE_MODULE]    = {"define-module", ATLEAST(2)},
+	[F_IMPORT]           = {"import", ATLEAST(1)},
+	[F_TIME]             = {"time", 1},
+	[F_FUTURE]           = {"future", 1}
 };
 
 // Names and arities of standard procedures.
@@ -69,6 +92,7 @@ static const struct NameArity stdproc_name_arity[N_STANDARD_PROCEDURES] = {
 	[S_APPLY]            = {"apply", ATLEAST(2)},
 	[S_MACRO]            = {"macro", 1},
 	[S_VOIDP]            = {"void?", 1},
+	[S_EOFP]             = {"eof-object?", 1},
 	[S_NULLP]            = {"null?", 1},
 	[S_SYMBOLP]          = {"symbol?", 1},
 	[S_NUMBERP]          = {"number?", 1},
@@ -76,8 +100,12 @@ static const struct NameArity stdproc_name_arity[N_STANDARD_PROCEDURES] = {
 	[S_CHARP]            = {"char?", 1},
 	[S_PAIRP]            = {"pair?", 1},
 	[S_STRINGP]          = {"string?", 1},
+	[S_PORTP]            = {"port?", 1},
 	[S_MACROP]           = {"macro?", 1},
 	[S_PROCEDUREP]       = {"procedure?", 1},
+	[S_FUTUREP]          = {"future?", 1},
+	[S_CHANNELP]         = {"channel?", 1},
+	[S_ACTORP]           = {"actor?", 1},
 	[S_EQ]               = {"eq?", 2},
 	[S_NUM_EQ]           = {"=", ATLEAST(0)},
 	[S_NUM_LT]           = {"<", ATLEAST(0)},
@@ -121,32 +149,89 @@ static const struct NameArity stdproc_name_arity[N_STANDARD_PROCEDURES] = {
 	[S_SYMBOL_TO_STRING] = {"symbol->string", 1},
 	[S_STRING_TO_NUMBER] = {"string->number", 1},
 	[S_NUMBER_TO_STRING] = {"number->string", 1},
-	[S_READ]             = {"read", 0},
-	[S_WRITE]            = {"write", 1},
-	[S_DISPLAY]          = {"display", 1},
-	[S_NEWLINE]          = {"newline", 0},
+	[S_READ]             = {"read", ATLEAST(0)},
+	[S_WRITE]            = {"write", ATLEAST(1)},
+	[S_WRITE_SHARED]     = {"write-shared", ATLEAST(1)},
+	[S_DISPLAY]          = {"display", ATLEAST(1)},
+	[S_NEWLINE]          = {"newline", ATLEAST(0)},
 	[S_ERROR]            = {"error", ATLEAST(1)},
-	[S_LOAD]             = {"load", 1}
+	[S_LOAD]             = {"load", 1},
+	[S_OPEN_INPUT_FILE]  = {"open-input-file", 1},
+	[S_OPEN_OUTPUT_FILE] = {"open-output-file", 1},
+	[S_CLOSE_PORT]       = {"close-port", 1},
+	[S_CALL_INPUT_FILE]  = {"call-with-input-file", 2},
+	[S_CALL_OUTPUT_FILE] = {"call-with-output-file", 2},
+	[S_READ_CHAR]        = {"read-char", 1},
+	[S_PEEK_CHAR]        = {"peek-char", 1},
+	[S_READ_LINE]        = {"read-line", 1},
+	[S_WRITE_STRING]     = {"write-string", ATLEAST(1)},
+	[S_HEAP_STATS]       = {"heap-stats", 0},
+	[S_CALL_WITH_TIMING] = {"call-with-timing", 1},
+	[S_PMAP]             = {"pmap", 2},
+	[S_PFOR_EACH]        = {"pfor-each", 2},
+	[S_PREDUCE]          = {"preduce", 3},
+	[S_TOUCH]            = {"touch", 1},
+	[S_SPAWN]            = {"spawn", 1},
+	[S_YIELD]            = {"yield", 0},
+	[S_MAKE_CHANNEL]     = {"make-channel", 0},
+	[S_CHANNEL_SEND]     = {"channel-send", 2},
+	[S_CHANNEL_RECV]     = {"channel-recv", 1},
+	[S_SPAWN_ACTOR]      = {"spawn-actor", 1},
+	[S_ACTOR_SELF]       = {"actor-self", 0},
+	[S_ACTOR_SEND]       = {"actor-send", 2},
+	[S_ACTOR_RECV]       = {"actor-recv", 0}
 };
 
 const char *expression_type_name(enum ExpressionType type) {
 	return expr_type_names[type];
 }
 
+const char *stdproc_name(enum StandardProcedure stdproc) {
+	if (is_foreign(stdproc)) {
+		return foreign_name(stdproc);
+	}
+	return stdproc_name_arity[stdproc].name;
+}
+
+// Combines the characters of 'str', including the null terminator, into the
+// 64-bit FNV-1a hash 'h'.
+static uint64_t hash_name(uint64_t h, const char *str) {
+	const char *s = str;
+	do {
+		h ^= (unsigned char)*s;
+		h *= FNV_PRIME_64;
+	} while (*s++);
+	return h;
+}
+
+uint64_t standard_names_hash(void) {
+	uint64_t h = FNV_OFFSET_BASIS_64;
+	for (int i = 0; i < N_EXPRESSION_TYPES; i++) {
+		h = hash_name(h, expr_type_names[i]);
+	}
+	for (int i = 0; i < N_STANDARD_MACROS; i++) {
+		h = hash_name(h, stdmacro_name_arity[i].name);
+	}
+	for (int i = 0; i < N_STANDARD_PROCEDURES; i++) {
+		h = hash_name(h, stdproc_name_arity[i].name);
+	}
+	return h;
+}
+
 struct Environment *new_standard_environment(void) {
 	struct Environment *env = new_base_environment();
 	// Bind standard macros.
 	for (int i = 0; i < N_STANDARD_MACROS; i++) {
 		InternId id = intern_string(stdmacro_name_arity[i].name);
-		bind(env, id, new_stdmacro((enum StandardMacro)i));
+		bind_variable(env, id, new_stdmacro((enum StandardMacro)i));
 	}
 	// Bind standard procedures.
 	for (int i = 0; i < N_STANDARD_PROCEDURES; i++) {
 		InternId id = intern_string(stdproc_name_arity[i].name);
-		bind(env, id, new_stdprocedure((enum StandardProcedure)i));
+		bind_variable(env, id, new_stdprocedure((enum StandardProcedure)i));
 	}
 	// Bind "else" to true (used in 'cond').
-	bind(env, intern_string("else"), new_boolean(true));
+	bind_variable(env, intern_string("else"), new_boolean(true));
 	return env;
 }
 
@@ -154,6 +239,10 @@ struct Expression new_void(void) {
 	return (struct Expression){ .type = E_VOID };
 }
 
+struct Expression new_eof(void) {
+	return (struct Expression){ .type = E_EOF };
+}
+
 struct Expression new_null(void) {
 	return (struct Expression){ .type = E_NULL };
 }
@@ -202,6 +291,7 @@ struct Expression new_pair(struct Expression car, struct Expression cdr) {
 	box->car = car;
 	box->cdr = cdr;
 	struct Expression expr = { .type = E_PAIR, .box = box };
+	count_allocation(expr);
 #if REF_COUNT_LOGGING
 	total_box_count++;
 	total_ref_count++;
@@ -216,6 +306,7 @@ struct Expression new_string(char *str, size_t len) {
 	box->str = str;
 	box->len = len;
 	struct Expression expr = { .type = E_STRING, .box = box };
+	count_allocation(expr);
 #if REF_COUNT_LOGGING
 	total_box_count++;
 	total_ref_count++;
@@ -250,10 +341,68 @@ struct Expression new_procedure(
 	struct Box *box = xmalloc(sizeof *box);
 	box->ref_count = 1;
 	box->arity = arity;
+	box->name = ANONYMOUS;
 	box->params = params;
 	box->body = body;
 	box->env = env;
 	struct Expression expr = { .type = E_PROCEDURE, .box = box };
+	count_allocation(expr);
+#if REF_COUNT_LOGGING
+	total_box_count++;
+	total_ref_count++;
+	log_ref_count("create", expr);
+#endif
+	return expr;
+}
+
+struct Expression new_port(struct Port *port) {
+	struct Box *box = xmalloc(sizeof *box);
+	box->ref_count = 1;
+	box->port = port;
+	struct Expression expr = { .type = E_PORT, .box = box };
+	count_allocation(expr);
+#if REF_COUNT_LOGGING
+	total_box_count++;
+	total_ref_count++;
+	log_ref_count("create", expr);
+#endif
+	return expr;
+}
+
+struct Expression new_future(struct Future *future) {
+	struct Box *box = xmalloc(sizeof *box);
+	box->ref_count = 1;
+	box->future = future;
+	struct Expression expr = { .type = E_FUTURE, .box = box };
+	count_allocation(expr);
+#if REF_COUNT_LOGGING
+	total_box_count++;
+	total_ref_count++;
+	log_ref_count("create", expr);
+#endif
+	return expr;
+}
+
+struct Expression new_channel(struct Channel *channel) {
+	struct Box *box = xmalloc(sizeof *box);
+	box->ref_count = 1;
+	box->channel = channel;
+	struct Expression expr = { .type = E_CHANNEL, .box = box };
+	count_allocation(expr);
+#if REF_COUNT_LOGGING
+	total_box_count++;
+	total_ref_count++;
+	log_ref_count("create", expr);
+#endif
+	return expr;
+}
+
+struct Expression new_actor(struct Actor *actor) {
+	struct Box *box = xmalloc(sizeof *box);
+	box->ref_count = 1;
+	box->actor = actor;
+	struct Expression expr = { .type = E_ACTOR, .box = box };
+	count_allocation(expr);
 #if REF_COUNT_LOGGING
 	total_box_count++;
 	total_ref_count++;
@@ -269,6 +418,10 @@ static void dealloc_expression(struct Expression expr) {
 	case E_STRING:
 	case E_MACRO:
 	case E_PROCEDURE:
+	case E_PORT:
+	case E_FUTURE:
+	case E_CHANNEL:
+	case E_ACTOR:
 		total_box_count--;
 		log_ref_count("dealloc", expr);
 		break;
@@ -278,6 +431,7 @@ static void dealloc_expression(struct Expression expr) {
 #endif
 
 	// Free the expression's box and release sub-boxes.
+	count_free(expr);
 	switch (expr.type) {
 	case E_PAIR:
 		release_expression(expr.box->car);
@@ -295,6 +449,22 @@ static void dealloc_expression(struct Expression expr) {
 		release_environment(expr.box->env);
 		free(expr.box);
 		break;
+	case E_PORT:
+		free_port(expr.box->port);
+		free(expr.box);
+		break;
+	case E_FUTURE:
+		free_future(expr.box->future);
+		free(expr.box);
+		break;
+	case E_CHANNEL:
+		free_channel(expr.box->channel);
+		free(expr.box);
+		break;
+	case E_ACTOR:
+		release_actor(expr.box->actor);
+		free(expr.box);
+		break;
 	default:
 		break;
 	}
@@ -307,7 +477,11 @@ struct Expression retain_expression(struct Expression expr) {
 	case E_STRING:
 	case E_MACRO:
 	case E_PROCEDURE:
-		expr.box->ref_count++;
+	case E_PORT:
+	case E_FUTURE:
+	case E_CHANNEL:
+	case E_ACTOR:
+		adjust_ref_count(&expr.box->ref_count, 1);
 #if REF_COUNT_LOGGING
 		total_ref_count++;
 		log_ref_count("retain", expr);
@@ -326,13 +500,17 @@ void release_expression(struct Expression expr) {
 	case E_STRING:
 	case E_MACRO:
 	case E_PROCEDURE:
-		assert(expr.box->ref_count > 0);
-		expr.box->ref_count--;
+	case E_PORT:
+	case E_FUTURE:
+	case E_CHANNEL:
+	case E_ACTOR:
+		assert(__atomic_load_n(&expr.box->ref_count, __ATOMIC_RELAXED) > 0);
+		int ref_count = adjust_ref_count(&expr.box->ref_count, -1);
 #if REF_COUNT_LOGGING
 		total_ref_count--;
 		log_ref_count("release", expr);
 #endif
-		if (expr.box->ref_count == 0) {
+		if (ref_count == 0) {
 			dealloc_expression(expr);
 		}
 		break;
@@ -353,6 +531,7 @@ bool expression_eq(struct Expression lhs, struct Expression rhs) {
 	// Compare the contents of the expressions.
 	switch (lhs.type) {
 	case E_VOID:
+	case E_EOF:
 	case E_NULL:
 		return true;
 	case E_SYMBOL:
@@ -372,6 +551,10 @@ bool expression_eq(struct Expression lhs, struct Expression rhs) {
 	case E_STRING:
 	case E_MACRO:
 	case E_PROCEDURE:
+	case E_PORT:
+	case E_FUTURE:
+	case E_CHANNEL:
+	case E_ACTOR:
 		return lhs.box == rhs.box;
 	}
 }
@@ -383,7 +566,9 @@ bool expression_arity(Arity *out, struct Expression expr) {
 		return true;
 	case E_STDPROCMACRO:
 	case E_STDPROCEDURE:
-		*out = stdproc_name_arity[expr.stdproc].arity;
+		*out = is_foreign(expr.stdproc)
+			? foreign_arity(expr.stdproc)
+			: stdproc_name_arity[expr.stdproc].arity;
 		return true;
 	case E_MACRO:
 	case E_PROCEDURE:
@@ -410,132 +595,418 @@ char* null_terminated_string(struct Expression expr) {
 	return buf;
 }
 
-// Prints a pair to the 'stream', assuming the left parenthesis has already been
-// printed. Uses standard Lisp s-expression notation.
-static void print_pair(struct Box *box, bool first, FILE *stream) {
-	if (!first) {
-		putc(' ', stream);
+// Size of the buffer that printers format into before writing to the stream.
+#define PRINT_BUFFER_SIZE 4096
+
+// Number of pairs a printer can be nested in before it allocates its stack.
+#define PRINT_STACK_SIZE 32
+
+// Initial capacity of the table of shared pairs.
+#define SHARED_TABLE_SIZE 64
+
+// Marks in the table of shared pairs. Pairs that have been labeled store their
+// label number instead, which is never negative.
+#define SEEN_ONCE (-2)
+#define SEEN_TWICE (-1)
+
+// A SharedTable maps pairs to their marks or labels, for 'write-shared'. It is
+// an open addressing hash table keyed by box pointers.
+struct SharedTable {
+	struct Box **keys;
+	long *labels;
+	size_t cap;
+	size_t count;
+	long next_label;
+};
+
+// A Printer formats expressions into a buffer, and writes the buffer to its
+// stream when it fills up and when printing is done. Lists are printed
+// iteratively: 'stack' holds the pairs whose cdr still needs to be printed,
+// and a NULL entry stands for a closing parenthesis after a dotted cdr.
+struct Printer {
+	FILE *stream;
+	size_t len;
+	struct SharedTable *shared;
+	struct Box **stack;
+	size_t depth;
+	size_t stack_cap;
+	struct Box *local_stack[PRINT_STACK_SIZE];
+	char buf[PRINT_BUFFER_SIZE];
+};
+
+static void flush_printer(struct Printer *p) {
+	fwrite(p->buf, 1, p->len, p->stream);
+	p->len = 0;
+}
+
+static void put_bytes(struct Printer *p, const char *bytes, size_t n) {
+	if (n > PRINT_BUFFER_SIZE - p->len) {
+		flush_printer(p);
+		if (n >= PRINT_BUFFER_SIZE) {
+			fwrite(bytes, 1, n, p->stream);
+			return;
+		}
 	}
-	print_expression(box->car, stream);
-	switch (box->cdr.type) {
-	case E_NULL:
-		putc(')', stream);
-		break;
-	case E_PAIR:
-		print_pair(box->cdr.box, false, stream);
-		break;
-	default:
-		// Print a dot before the last cdr if it is not null.
-		fputs(" . ", stream);
-		print_expression(box->cdr, stream);
-		putc(')', stream);
-		break;
+	memcpy(p->buf + p->len, bytes, n);
+	p->len += n;
+}
+
+static void put_char(struct Printer *p, char c) {
+	if (p->len == PRINT_BUFFER_SIZE) {
+		flush_printer(p);
 	}
+	p->buf[p->len++] = c;
+}
+
+static void put_str(struct Printer *p, const char *str) {
+	put_bytes(p, str, strlen(str));
+}
+
+// Formats an object that is printed as its address, such as a procedure.
+static void put_object(struct Printer *p, const char *kind, void *ptr) {
+	char tmp[64];
+	int n = snprintf(tmp, sizeof tmp, "#<%s %p>", kind, ptr);
+	put_bytes(p, tmp, (size_t)n);
+}
+
+static void put_number(struct Printer *p, Number number) {
+	char tmp[32];
+	char *end = tmp + sizeof tmp;
+	char *start = end;
+	unsigned long magnitude = number < 0
+		? -(unsigned long)number : (unsigned long)number;
+	do {
+		*--start = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (number < 0) {
+		*--start = '-';
+	}
+	put_bytes(p, start, (size_t)(end - start));
 }
 
 // Prints a character expression, handling special characters appropriately.
-static void print_character(char character, FILE* stream) {
-	putc('#', stream);
-	putc('\\', stream);
+static void put_character(struct Printer *p, char character) {
+	put_char(p, '#');
+	put_char(p, '\\');
 	switch (character) {
 	case ' ':
-		fputs("space", stream);
+		put_str(p, "space");
 		break;
 	case '\n':
-		fputs("newline", stream);
+		put_str(p, "newline");
 		break;
 	case '\r':
-		fputs("return", stream);
+		put_str(p, "return");
 		break;
 	case '\t':
-		fputs("tab", stream);
+		put_str(p, "tab");
 		break;
 	default:
-		putc(character, stream);
+		put_char(p, character);
 		break;
 	}
 }
 
-// Prints a string to 'stream' enclosed in double quote characters, with
-// embedded double quotes, newlines, carriage returns, tabs, and backslashes
-// escaped with backslashes.
-static void print_string(struct Box* box, FILE* stream) {
-	putc('"', stream);
+// Prints a string enclosed in double quote characters, with embedded double
+// quotes, newlines, carriage returns, tabs, and backslashes escaped with
+// backslashes. Runs of other characters are copied all at once.
+static void put_string(struct Printer *p, struct Box *box) {
+	put_char(p, '"');
+	size_t start = 0;
 	for (size_t i = 0; i < box->len; i++) {
-		char c = box->str[i];
-		switch (c) {
+		char escape;
+		switch (box->str[i]) {
 		case '"':
-			putc('\\', stream);
-			putc('"', stream);
+			escape = '"';
 			break;
 		case '\\':
-			putc('\\', stream);
-			putc('\\', stream);
+			escape = '\\';
 			break;
 		case '\n':
-			putc('\\', stream);
-			putc('n', stream);
+			escape = 'n';
 			break;
 		case '\r':
-			putc('\\', stream);
-			putc('r', stream);
+			escape = 'r';
 			break;
 		case '\t':
-			putc('\\', stream);
-			putc('t', stream);
+			escape = 't';
 			break;
 		default:
-			putc(c, stream);
-			break;
+			continue;
 		}
+		put_bytes(p, box->str + start, i - start);
+		put_char(p, '\\');
+		put_char(p, escape);
+		start = i + 1;
 	}
-	putc('"', stream);
+	put_bytes(p, box->str + start, box->len - start);
+	put_char(p, '"');
 }
 
-void print_expression(struct Expression expr, FILE *stream) {
+// Prints an expression that is not a pair.
+static void put_atom(struct Printer *p, struct Expression expr) {
 	switch (expr.type) {
 	case E_VOID:
-		fputs("#<void>", stream);
+		put_str(p, "#<void>");
+		break;
+	case E_EOF:
+		put_str(p, "#<eof>");
 		break;
 	case E_NULL:
-		fputs("()", stream);
+		put_str(p, "()");
 		break;
 	case E_SYMBOL:
-		fputs(find_string(expr.symbol_id), stream);
+		put_bytes(p, find_string(expr.symbol_id),
+				find_string_length(expr.symbol_id));
 		break;
 	case E_NUMBER:
-		fprintf(stream, "%ld", expr.number);
+		put_number(p, expr.number);
 		break;
 	case E_BOOLEAN:
-		fprintf(stream, "#%c", expr.boolean ? 't' : 'f');
+		put_str(p, expr.boolean ? "#t" : "#f");
 		break;
 	case E_CHARACTER:
-		print_character(expr.character, stream);
+		put_character(p, expr.character);
 		break;
 	case E_STDMACRO:
-		fprintf(stream, "#<macro %s>",
-				stdmacro_name_arity[expr.stdmacro].name);
+		put_str(p, "#<macro ");
+		put_str(p, stdmacro_name_arity[expr.stdmacro].name);
+		put_char(p, '>');
 		break;
 	case E_STDPROCMACRO:
-		fprintf(stream, "#<macro %s>",
-				stdproc_name_arity[expr.stdproc].name);
+		put_str(p, "#<macro ");
+		put_str(p, stdproc_name(expr.stdproc));
+		put_char(p, '>');
 		break;
 	case E_STDPROCEDURE:
-		fprintf(stream, "#<procedure %s>",
-				stdproc_name_arity[expr.stdproc].name);
+		put_str(p, "#<procedure ");
+		put_str(p, stdproc_name(expr.stdproc));
+		put_char(p, '>');
 		break;
 	case E_PAIR:
-		putc('(', stream);
-		print_pair(expr.box, true, stream);
+		assert(false);
 		break;
 	case E_STRING:
-		print_string(expr.box, stream);
+		put_string(p, expr.box);
 		break;
 	case E_MACRO:
-		fprintf(stream, "#<macro %p>", (void *)expr.box);
+		put_object(p, "macro", expr.box);
 		break;
 	case E_PROCEDURE:
-		fprintf(stream, "#<procedure %p>", (void *)expr.box);
+		put_object(p, "procedure", expr.box);
+		break;
+	case E_PORT:
+		put_object(p, port_is_input(expr.box->port)
+				? "input-port" : "output-port", expr.box);
+		break;
+	case E_FUTURE:
+		put_object(p, "future", expr.box);
+		break;
+	case E_CHANNEL:
+		put_object(p, "channel", expr.box);
+		break;
+	case E_ACTOR:
+		put_object(p, "actor", expr.box);
 		break;
 	}
 }
+
+static void push_pair(struct Printer *p, struct Box *box) {
+	if (p->depth == p->stack_cap) {
+		p->stack_cap *= 2;
+		if (p->stack == p->local_stack) {
+			p->stack = xmalloc(p->stack_cap * sizeof *p->stack);
+			memcpy(p->stack, p->local_stack, sizeof p->local_stack);
+		} else {
+			p->stack = xrealloc(p->stack, p->stack_cap * sizeof *p->stack);
+		}
+	}
+	p->stack[p->depth++] = box;
+}
+
+// Returns the slot for 'box' in the table, which is either empty or holds it.
+static size_t shared_slot(const struct SharedTable *table, struct Box *box) {
+	size_t mask = table->cap - 1;
+	size_t i = (size_t)(((uintptr_t)box >> 4) * 11400714819323198485u) & mask;
+	while (table->keys[i] && table->keys[i] != box) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+// Returns a pointer to the mark or label of 'box', or NULL if it has not been
+// seen.
+static long *find_shared(const struct SharedTable *table, struct Box *box) {
+	size_t i = shared_slot(table, box);
+	return table->keys[i] ? &table->labels[i] : NULL;
+}
+
+// Records that 'box' has been seen. Returns false if it had been seen before.
+static bool mark_shared(struct SharedTable *table, struct Box *box) {
+	if (2 * (table->count + 1) > table->cap) {
+		struct SharedTable old = *table;
+		table->cap *= 2;
+		table->keys = xcalloc(table->cap, sizeof *table->keys);
+		table->labels = xmalloc(table->cap * sizeof *table->labels);
+		for (size_t i = 0; i < old.cap; i++) {
+			if (old.keys[i]) {
+				size_t j = shared_slot(table, old.keys[i]);
+				table->keys[j] = old.keys[i];
+				table->labels[j] = old.labels[i];
+			}
+		}
+		free(old.keys);
+		free(old.labels);
+	}
+	size_t i = shared_slot(table, box);
+	if (table->keys[i]) {
+		table->labels[i] = SEEN_TWICE;
+		return false;
+	}
+	table->keys[i] = box;
+	table->labels[i] = SEEN_ONCE;
+	table->count++;
+	return true;
+}
+
+// Finds the pairs reachable from 'expr' more than once, whether because they
+// are shared or because they are part of a cycle. Uses the printer's stack.
+static void find_shared_pairs(struct Printer *p, struct Expression expr) {
+	if (expr.type != E_PAIR) {
+		return;
+	}
+	push_pair(p, expr.box);
+	while (p->depth > 0) {
+		struct Box *box = p->stack[--p->depth];
+		if (!mark_shared(p->shared, box)) {
+			continue;
+		}
+		if (box->cdr.type == E_PAIR) {
+			push_pair(p, box->cdr.box);
+		}
+		if (box->car.type == E_PAIR) {
+			push_pair(p, box->car.box);
+		}
+	}
+}
+
+// Returns true if 'box' was found to be reachable more than once.
+static bool is_shared(const struct Printer *p, struct Box *box) {
+	if (!p->shared) {
+		return false;
+	}
+	long *label = find_shared(p->shared, box);
+	return label && *label != SEEN_ONCE;
+}
+
+// Prints the expression, starting a list if it is a pair. With shared
+// structure detection, prints a label reference instead if the pair has
+// already been printed, and defines a label if it will be referenced later.
+// Returns true if a list was started.
+static bool put_item(struct Printer *p, struct Expression expr) {
+	if (expr.type != E_PAIR) {
+		put_atom(p, expr);
+		return false;
+	}
+	if (p->shared) {
+		long *label = find_shared(p->shared, expr.box);
+		if (*label >= 0) {
+			char tmp[32];
+			int n = snprintf(tmp, sizeof tmp, "#%ld#", *label);
+			put_bytes(p, tmp, (size_t)n);
+			return false;
+		}
+		if (*label == SEEN_TWICE) {
+			*label = p->shared->next_label++;
+			char tmp[32];
+			int n = snprintf(tmp, sizeof tmp, "#%ld=", *label);
+			put_bytes(p, tmp, (size_t)n);
+		}
+	}
+	put_char(p, '(');
+	push_pair(p, expr.box);
+	return true;
+}
+
+// Prints the expression using standard Lisp s-expression notation. Walks the
+// car of each pair by descending and the cdr by iterating, so neither long nor
+// deeply nested lists use any C stack.
+static void put_expression(struct Printer *p, struct Expression expr) {
+	struct Expression item = expr;
+	for (;;) {
+		if (put_item(p, item)) {
+			item = p->stack[p->depth - 1]->car;
+			continue;
+		}
+		// Finish the lists whose last element was just printed, until one has
+		// another element.
+		bool more = false;
+		while (p->depth > 0 && !more) {
+			struct Box *box = p->stack[p->depth - 1];
+			if (!box) {
+				put_char(p, ')');
+				p->depth--;
+				continue;
+			}
+			struct Expression cdr = box->cdr;
+			if (cdr.type == E_PAIR && !is_shared(p, cdr.box)) {
+				put_char(p, ' ');
+				p->stack[p->depth - 1] = cdr.box;
+				item = cdr.box->car;
+				more = true;
+			} else if (cdr.type == E_NULL) {
+				put_char(p, ')');
+				p->depth--;
+			} else {
+				// Print a dot before the last cdr if it is not null.
+				put_str(p, " . ");
+				p->stack[p->depth - 1] = NULL;
+				item = cdr;
+				more = true;
+			}
+		}
+		if (!more) {
+			return;
+		}
+	}
+}
+
+// Prints the expression to 'stream', detecting shared structure if 'shared'
+// is true.
+static void print(struct Expression expr, FILE *stream, bool shared) {
+	struct Printer p;
+	p.stream = stream;
+	p.len = 0;
+	p.shared = NULL;
+	p.stack = p.local_stack;
+	p.depth = 0;
+	p.stack_cap = PRINT_STACK_SIZE;
+	struct SharedTable table;
+	if (shared) {
+		table.cap = SHARED_TABLE_SIZE;
+		table.count = 0;
+		table.next_label = 0;
+		table.keys = xcalloc(table.cap, sizeof *table.keys);
+		table.labels = xmalloc(table.cap * sizeof *table.labels);
+		p.shared = &table;
+		find_shared_pairs(&p, expr);
+	}
+	put_expression(&p, expr);
+	flush_printer(&p);
+	if (p.stack != p.local_stack) {
+		free(p.stack);
+	}
+	if (shared) {
+		free(table.keys);
+		free(table.labels);
+	}
+}
+
+void print_expression(struct Expression expr, FILE *stream) {
+	print(expr, stream, false);
+}
+
+void print_expression_shared(struct Expression expr, FILE *stream) {
+	print(expr, stream, true);
+}
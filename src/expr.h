@@ -7,15 +7,21 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+struct Actor;
+struct Channel;
 struct Environment;
+struct Future;
+struct Port;
 
 // Types of expressions.
-#define N_EXPRESSION_TYPES 13
+#define N_EXPRESSION_TYPES 18
 enum ExpressionType {
 	// Immediate expressions
 	E_VOID,         // lack of a value
+	E_EOF,          // end of input
 	E_NULL,         // empty list
 	E_SYMBOL,       // interned string
 	E_NUMBER,       // signed integer
@@ -28,12 +34,16 @@ enum ExpressionType {
 	E_PAIR,         // cons cell
 	E_STRING,       // string of text
 	E_MACRO,        // user-defined macro
-	E_PROCEDURE     // user-defined procedure
+	E_PROCEDURE,    // user-defined procedure
+	E_PORT,         // input or output port
+	E_FUTURE,       // value being computed by another thread
+	E_CHANNEL,      // channel between green threads
+	E_ACTOR         // interpreter running on another thread
 };
 
 // Standard macros, also called special forms, are syntactical forms built into
 // the language that require special evaluation rules.
-#define N_STANDARD_MACROS 14
+#define N_STANDARD_MACROS 18
 enum StandardMacro {
 	// Definition and mutation
 	F_DEFINE, F_SET,
@@ -46,19 +56,26 @@ enum StandardMacro {
 	// Let bindings
 	F_LET, F_LET_STAR,
 	// Logical operators
-	F_AND, F_OR
+	F_AND, F_OR,
+	// Modules
+	F_DEFINE_MODULE, F_IMPORT,
+	// Timing
+	F_TIME,
+	// Parallelism
+	F_FUTURE
 };
 
 // Standard procedures are procedures implemented by the interpreter.
-#define N_STANDARD_PROCEDURES 62
+#define N_STANDARD_PROCEDURES 92
 enum StandardProcedure {
 	// Eval and apply
 	S_EVAL, S_APPLY,
 	// Macro creation
 	S_MACRO,
 	// Type predicates
-	S_VOIDP, S_NULLP, S_SYMBOLP, S_NUMBERP, S_BOOLEANP, S_CHARP,
-	S_PAIRP, S_STRINGP, S_MACROP, S_PROCEDUREP,
+	S_VOIDP, S_EOFP, S_NULLP, S_SYMBOLP, S_NUMBERP, S_BOOLEANP, S_CHARP,
+	S_PAIRP, S_STRINGP, S_PORTP, S_MACROP, S_PROCEDUREP, S_FUTUREP,
+	S_CHANNELP, S_ACTORP,
 	// Equality (identity)
 	S_EQ,
 	// Numeric comparisons
@@ -81,7 +98,19 @@ enum StandardProcedure {
 	S_STRING_TO_SYMBOL, S_SYMBOL_TO_STRING,
 	S_STRING_TO_NUMBER, S_NUMBER_TO_STRING,
 	// Input/output
-	S_READ, S_WRITE, S_DISPLAY, S_NEWLINE, S_ERROR, S_LOAD
+	S_READ, S_WRITE, S_WRITE_SHARED, S_DISPLAY, S_NEWLINE, S_ERROR, S_LOAD,
+	// Ports
+	S_OPEN_INPUT_FILE, S_OPEN_OUTPUT_FILE, S_CLOSE_PORT,
+	S_CALL_INPUT_FILE, S_CALL_OUTPUT_FILE,
+	S_READ_CHAR, S_PEEK_CHAR, S_READ_LINE, S_WRITE_STRING,
+	// Memory and timing
+	S_HEAP_STATS, S_CALL_WITH_TIMING,
+	// Parallelism
+	S_PMAP, S_PFOR_EACH, S_PREDUCE, S_TOUCH,
+	// Green threads
+	S_SPAWN, S_YIELD, S_MAKE_CHANNEL, S_CHANNEL_SEND, S_CHANNEL_RECV,
+	// Actors
+	S_SPAWN_ACTOR, S_ACTOR_SELF, S_ACTOR_SEND, S_ACTOR_RECV
 };
 
 // Number expressions are internally represented with long integers.
@@ -91,8 +120,8 @@ typedef long Number;
 extern const char *const NUMBER_FMT;
 
 // Expression is the algebraic data type used for all values in Eva. Code and
-// data are both represented as expressions. Seven types of expressions fit in
-// immediate values; the other three are stored in boxes.
+// data are both represented as expressions. Ten types of expressions fit in
+// immediate values; the other five are stored in boxes.
 struct Expression {
 	enum ExpressionType type;
 	union {
@@ -117,10 +146,14 @@ typedef int Arity;
 // It also performs the inverse: ATLEAST(ATLEAST(n)) == n.
 #define ATLEAST(n) (-((n)+1))
 
+// The name of a procedure or macro that has not been bound by 'define'.
+#define ANONYMOUS ((InternId)-1)
+
 // A box is a recursive structure that cannot be stored as an immediate value.
-// It contains a cons pair, macro, or procedure. The type tag is stored in the
-// expression pointing to the box, not in the box itself. Box memory is managed
-// by reference counting (see 'retain_expression' and 'release_expression').
+// It contains a cons pair, string, macro, procedure, or port. The type tag is
+// stored in the expression pointing to the box, not in the box itself. Box
+// memory is managed by reference counting (see 'retain_expression' and
+// 'release_expression').
 struct Box {
 	int ref_count;
 	union {
@@ -137,22 +170,40 @@ struct Box {
 		// Used by E_MACRO and E_PROCEDURE:
 		struct {
 			Arity arity;
+			InternId name; // set by 'define', or ANONYMOUS
 			struct Expression *params;
 			struct Expression body;
 			struct Environment *env;
 		};
+		// Used by E_PORT:
+		struct Port *port;
+		// Used by E_FUTURE:
+		struct Future *future;
+		// Used by E_CHANNEL:
+		struct Channel *channel;
+		// Used by E_ACTOR:
+		struct Actor *actor;
 	};
 };
 
 // Returns the user-facing name of the expression type in uppercase letters.
 const char *expression_type_name(enum ExpressionType type);
 
+// Returns the name of the standard procedure.
+const char *stdproc_name(enum StandardProcedure stdproc);
+
+// Returns a hash of the names of all expression types, standard macros, and
+// standard procedures, in order. Two builds with the same hash agree on what
+// the values of the enums above mean.
+uint64_t standard_names_hash(void);
+
 // Returns a base environment containing mappings for all standard macros, all
 // standard procedures, and the symbol "else".
 struct Environment *new_standard_environment(void);
 
 // Constructors for immediate expressions.
 struct Expression new_void(void);
+struct Expression new_eof(void);
 struct Expression new_null(void);
 struct Expression new_symbol(InternId symbol_id);
 struct Expression new_number(Number number);
@@ -174,15 +225,31 @@ struct Expression new_string(char *str, size_t len);
 // 'expr' without retaining it.
 struct Expression new_macro(struct Expression expr);
 
-// Creates a new procedure. Sets the reference count of the box to 1. Takes
-// ownership of 'params' without copying the array. Takes ownership of 'body'
-// and 'env' without retaining them.
+// Creates a new anonymous procedure. Sets the reference count of the box to 1.
+// Takes ownership of 'params' without copying the array. Takes ownership of
+// 'body' and 'env' without retaining them.
 struct Expression new_procedure(
 		Arity arity,
 		struct Expression *params,
 		struct Expression body,
 		struct Environment *env);
 
+// Creates a new port expression. Sets the reference count of the box to 1.
+// Takes ownership of 'port' and frees it on deallocation.
+struct Expression new_port(struct Port *port);
+
+// Creates a new future expression. Sets the reference count of the box to 1.
+// Takes ownership of 'future' and frees it on deallocation.
+struct Expression new_future(struct Future *future);
+
+// Creates a new channel expression. Sets the reference count of the box to 1.
+// Takes ownership of 'channel' and frees it on deallocation.
+struct Expression new_channel(struct Channel *channel);
+
+// Creates a new actor expression. Sets the reference count of the box to 1.
+// Takes over a reference to 'actor' and releases it on deallocation.
+struct Expression new_actor(struct Actor *actor);
+
 // Increments the reference count of the expression's box. This is a no-op for
 // immediates. Returns the expression for convenience.
 struct Expression retain_expression(struct Expression expr);
@@ -212,7 +279,12 @@ bool arity_allows(Arity arity, size_t n_args);
 // 'expr' has type E_STRING. The caller is responsible for freeing the result.
 char* null_terminated_string(struct Expression expr);
 
-// Prints the expression to 'stream' (not followed by a newline).
+// Prints the expression to 'stream' (not followed by a newline). The output is
+// formatted into a buffer and written in large blocks.
 void print_expression(struct Expression expr, FILE *stream);
 
+// Like 'print_expression', but labels pairs that are reachable more than once
+// in the notation of SRFI 38, such as "#0=(a . #0#)" for a cycle.
+void print_expression_shared(struct Expression expr, FILE *stream);
+
 #endif
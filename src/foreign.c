@@ -0,0 +1,83 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#include "foreign.h"
+
+#include "context.h"
+#include "error.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Initial capacity of the foreign procedure array.
+#define DEFAULT_FOREIGN_CAP 16
+
+// A registered foreign procedure. The context's 'foreign.procs' array holds
+// them in order of registration, indexed by 'stdproc - N_STANDARD_PROCEDURES'.
+struct Foreign {
+	char *name;
+	Arity arity;
+	ForeignFunction fn;
+	void *data;
+};
+
+// Returns the foreign procedure for 'stdproc' in the current context.
+static struct Foreign *find_foreign(enum StandardProcedure stdproc) {
+	return current_context->foreign.procs
+		+ ((size_t)stdproc - N_STANDARD_PROCEDURES);
+}
+
+struct Expression new_foreign(
+		const char *name, Arity arity, ForeignFunction fn, void *data) {
+	struct EvaContext *ctx = current_context;
+	if (ctx->foreign.len == ctx->foreign.cap) {
+		size_t cap = ctx->foreign.cap;
+		cap = cap == 0 ? DEFAULT_FOREIGN_CAP : cap * 2;
+		ctx->foreign.procs =
+			xrealloc(ctx->foreign.procs, cap * sizeof *ctx->foreign.procs);
+		ctx->foreign.cap = cap;
+	}
+	size_t len = strlen(name);
+	struct Foreign *foreign = ctx->foreign.procs + ctx->foreign.len;
+	foreign->name = xmalloc(len + 1);
+	memcpy(foreign->name, name, len + 1);
+	foreign->arity = arity;
+	foreign->fn = fn;
+	foreign->data = data;
+	return new_stdprocedure((enum StandardProcedure)
+			(N_STANDARD_PROCEDURES + ctx->foreign.len++));
+}
+
+const char *foreign_name(enum StandardProcedure stdproc) {
+	return find_foreign(stdproc)->name;
+}
+
+Arity foreign_arity(enum StandardProcedure stdproc) {
+	return find_foreign(stdproc)->arity;
+}
+
+struct EvalResult apply_foreign(
+		enum StandardProcedure stdproc, struct Expression *args, size_t n) {
+	struct Foreign *foreign = find_foreign(stdproc);
+	return foreign->fn(args, n, foreign->data);
+}
+
+struct EvalError *new_foreign_error(const char *message) {
+	size_t len = strlen(message);
+	char *str = xmalloc(len + 1);
+	memcpy(str, message, len);
+	struct Expression expr = new_string(str, len);
+	struct EvalError *err = new_eval_error_expr(ERR_FOREIGN, expr);
+	release_expression(expr);
+	return err;
+}
+
+void free_foreign(void) {
+	struct EvaContext *ctx = current_context;
+	for (size_t i = 0; i < ctx->foreign.len; i++) {
+		free(ctx->foreign.procs[i].name);
+	}
+	free(ctx->foreign.procs);
+	ctx->foreign.procs = NULL;
+	ctx->foreign.len = ctx->foreign.cap = 0;
+}
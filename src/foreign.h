@@ -0,0 +1,50 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef FOREIGN_H
+#define FOREIGN_H
+
+#include "eval.h"
+#include "expr.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A foreign procedure is a C function registered at run time. It is represented
+// by an E_STDPROCEDURE expression whose 'stdproc' value is N_STANDARD_PROCEDURES
+// or greater, so it is applied, printed, and passed around just like a standard
+// procedure. Foreign procedures are registered in the current context, and their
+// values are only meaningful in that context.
+
+// A ForeignFunction receives 'n' evaluated arguments, which it must not release,
+// and the data pointer given when it was registered. On success, it returns a
+// new expression. Otherwise, it returns an error (usually ERR_FOREIGN).
+typedef struct EvalResult (*ForeignFunction)(
+		struct Expression *args, size_t n, void *data);
+
+// Registers a foreign procedure called 'name' that accepts 'arity' arguments,
+// and returns an expression for it. The name is only used for printing.
+struct Expression new_foreign(
+		const char *name, Arity arity, ForeignFunction fn, void *data);
+
+// Returns true if 'stdproc' refers to a foreign procedure.
+static inline bool is_foreign(enum StandardProcedure stdproc) {
+	return stdproc >= N_STANDARD_PROCEDURES;
+}
+
+// Returns the name or the arity of a foreign procedure.
+const char *foreign_name(enum StandardProcedure stdproc);
+Arity foreign_arity(enum StandardProcedure stdproc);
+
+// Calls a foreign procedure with 'n' arguments. The arguments have already been
+// checked against its arity.
+struct EvalResult apply_foreign(
+		enum StandardProcedure stdproc, struct Expression *args, size_t n);
+
+// Creates an ERR_FOREIGN error with a copy of 'message'.
+struct EvalError *new_foreign_error(const char *message);
+
+// Forgets all the foreign procedures registered in the current context. Called
+// by 'free_context'.
+void free_foreign(void);
+
+#endif
@@ -0,0 +1,412 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "future.h"
+
+#include "context.h"
+#include "env.h"
+#include "error.h"
+#include "heap.h"
+#include "parallel.h"
+#include "profile.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Number of tasks each worker's deque can hold. A worker that spawns a future
+// while its deque is full evaluates it immediately.
+#define DEQUE_CAPACITY 4096
+
+// States of a future. Whichever thread moves a future from FUTURE_PENDING to
+// FUTURE_RUNNING evaluates it.
+enum FutureState {
+	FUTURE_PENDING,
+	FUTURE_RUNNING,
+	FUTURE_DONE
+};
+
+// The evaluation of 'expr' is counted in 'stats' and 'evals', which are added
+// to the counters of the thread that frees the future. There are two
+// references to a pending future: one from its box, and one from the queue
+// entry of its task. A future can be run by a thread touching it while its
+// task is still queued, so workers skip tasks that are no longer pending.
+struct Future {
+	struct EvaContext *ctx;
+	struct Expression expr;
+	struct Environment *env;
+	int state;
+	int ref_count;
+	bool failed;
+	struct Expression value;
+	struct EvalError *err;
+	struct HeapStats stats;
+	size_t evals;
+	struct Future *next; // next task in the shared queue
+};
+
+// A Deque is a worker's queue of tasks, as described by Chase and Lev. The
+// worker pushes and takes tasks at the bottom, and other workers steal them
+// from the top.
+struct Deque {
+	long top;
+	long bottom;
+	struct Future *tasks[DEQUE_CAPACITY];
+};
+
+// The scheduler. The shared queue is protected by 'lock'. The counters are
+// accessed atomically: 'pending' is the number of queued tasks, 'sleeping' is
+// the number of workers waiting for one, and 'waiting' is the number of
+// threads waiting for a future to finish.
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t finished;
+	size_t size;
+	size_t n_deques;
+	struct Deque *deques;
+	struct Future *head;
+	struct Future *tail;
+	long shared;
+	long pending;
+	int sleeping;
+	int waiting;
+} sched = {
+	.once = PTHREAD_ONCE_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.finished = PTHREAD_COND_INITIALIZER
+};
+
+// The deque of the calling thread, or NULL if it is not a worker.
+static _Thread_local struct Deque *own_deque = NULL;
+
+// Position in the deque of the calling thread where the tasks spawned by the
+// task it is running begin.
+static _Thread_local long task_mark = 0;
+
+// Deque that the calling worker tries to steal from next.
+static _Thread_local size_t victim = 0;
+
+// Pushes a task onto the bottom of the deque. Returns false if it is full.
+static bool push(struct Deque *deque, struct Future *future) {
+	long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	if (bottom - top >= DEQUE_CAPACITY) {
+		return false;
+	}
+	__atomic_store_n(
+			&deque->tasks[bottom % DEQUE_CAPACITY], future, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// Takes the task at the bottom of the deque, provided it is at position 'mark'
+// or above. Returns NULL if there is none.
+static struct Future *take(struct Deque *deque, long mark) {
+	long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	if (bottom < mark) {
+		return NULL;
+	}
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+	struct Future *future = NULL;
+	if (top <= bottom) {
+		future = __atomic_load_n(
+				&deque->tasks[bottom % DEQUE_CAPACITY], __ATOMIC_RELAXED);
+		if (top != bottom) {
+			return future;
+		}
+		// This is the last task, so race with the thieves for it.
+		if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			future = NULL;
+		}
+	}
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	return future;
+}
+
+// Steals the task at the top of the deque. Returns NULL if there is none, or if
+// another thread got it first.
+static struct Future *steal(struct Deque *deque) {
+	long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if (top >= bottom) {
+		return NULL;
+	}
+	struct Future *future = __atomic_load_n(
+			&deque->tasks[top % DEQUE_CAPACITY], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+	return future;
+}
+
+// Appends a task to the shared queue.
+static void enqueue_shared(struct Future *future) {
+	pthread_mutex_lock(&sched.lock);
+	future->next = NULL;
+	if (sched.tail) {
+		sched.tail->next = future;
+	} else {
+		sched.head = future;
+	}
+	sched.tail = future;
+	__atomic_add_fetch(&sched.shared, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&sched.lock);
+}
+
+// Removes the first task from the shared queue. Returns NULL if it is empty.
+static struct Future *dequeue_shared(void) {
+	if (__atomic_load_n(&sched.shared, __ATOMIC_RELAXED) == 0) {
+		return NULL;
+	}
+	pthread_mutex_lock(&sched.lock);
+	struct Future *future = sched.head;
+	if (future) {
+		sched.head = future->next;
+		if (!sched.head) {
+			sched.tail = NULL;
+		}
+		__atomic_sub_fetch(&sched.shared, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&sched.lock);
+	return future;
+}
+
+// Finds a queued task for a worker: its own newest task, then the oldest task
+// in the shared queue, then the oldest task of another worker.
+static struct Future *find_task(void) {
+	struct Future *future = take(own_deque, 0);
+	if (!future) {
+		future = dequeue_shared();
+	}
+	for (size_t i = 0; !future && i < sched.n_deques; i++) {
+		victim = (victim + 1) % sched.n_deques;
+		if (&sched.deques[victim] != own_deque) {
+			future = steal(&sched.deques[victim]);
+		}
+	}
+	if (future) {
+		__atomic_sub_fetch(&sched.pending, 1, __ATOMIC_SEQ_CST);
+	}
+	return future;
+}
+
+// Drops a reference to the future, and frees it if it was the last one.
+static void drop_future(struct Future *future) {
+	if (__atomic_sub_fetch(&future->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(future);
+	}
+}
+
+// Returns true if the future has finished.
+static bool is_done(struct Future *future) {
+	return __atomic_load_n(&future->state, __ATOMIC_SEQ_CST) == FUTURE_DONE;
+}
+
+// Claims a pending future for the calling thread to run.
+static bool claim(struct Future *future) {
+	int expected = FUTURE_PENDING;
+	return __atomic_compare_exchange_n(&future->state, &expected,
+			FUTURE_RUNNING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+// Evaluates the expression of the future in its context, and stores the
+// result. The future is not marked as done.
+static void evaluate(struct Future *future) {
+	struct EvaContext *saved_ctx = use_context(future->ctx);
+	struct HeapStats *saved_stats = redirect_heap_stats(&future->stats);
+	size_t *saved_evals = redirect_eval_count(&future->evals);
+	long saved_mark = task_mark;
+	if (own_deque) {
+		task_mark = __atomic_load_n(&own_deque->bottom, __ATOMIC_RELAXED);
+	}
+	struct EvalResult result = eval(future->expr, future->env, false);
+	release_expression(future->expr);
+	release_environment(future->env);
+	task_mark = saved_mark;
+	redirect_eval_count(saved_evals);
+	redirect_heap_stats(saved_stats);
+	use_context(saved_ctx);
+	if (result.err) {
+		future->failed = true;
+		future->err = result.err;
+	} else {
+		future->value = result.expr;
+	}
+}
+
+// Runs a future claimed by the calling thread, and wakes up the threads
+// waiting for it.
+static void run_task(struct Future *future) {
+	evaluate(future);
+	__atomic_store_n(&future->state, FUTURE_DONE, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&parallel_operations, 1, __ATOMIC_RELEASE);
+	if (__atomic_load_n(&sched.waiting, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&sched.lock);
+		pthread_cond_broadcast(&sched.finished);
+		pthread_mutex_unlock(&sched.lock);
+	}
+}
+
+// Runs a task taken from a queue, unless another thread already claimed it.
+static void run_queued(struct Future *future) {
+	if (claim(future)) {
+		run_task(future);
+	}
+	drop_future(future);
+}
+
+// Runs tasks until the process exits, and sleeps when there are none. The
+// argument is the worker number.
+static void *worker_main(void *arg) {
+	own_deque = &sched.deques[(size_t)arg - 1];
+	victim = (size_t)arg - 1;
+	for (;;) {
+		struct Future *future = find_task();
+		if (future) {
+			run_queued(future);
+			continue;
+		}
+		pthread_mutex_lock(&sched.lock);
+		__atomic_add_fetch(&sched.sleeping, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&sched.pending, __ATOMIC_SEQ_CST) <= 0) {
+			pthread_cond_wait(&sched.work, &sched.lock);
+		}
+		__atomic_sub_fetch(&sched.sleeping, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&sched.lock);
+	}
+	return NULL;
+}
+
+// Starts the workers. The calling thread also works while it waits for
+// futures, so there is one less worker than the number of threads.
+static void start_scheduler(void) {
+	sched.n_deques = parallel_threads() - 1;
+	if (sched.n_deques == 0) {
+		return;
+	}
+	sched.deques = xcalloc(sched.n_deques, sizeof *sched.deques);
+	sched.size = start_workers(sched.n_deques, worker_main);
+}
+
+void reset_scheduler(void) {
+	pthread_once_t once = PTHREAD_ONCE_INIT;
+	sched.once = once;
+	pthread_mutex_init(&sched.lock, NULL);
+	pthread_cond_init(&sched.work, NULL);
+	pthread_cond_init(&sched.finished, NULL);
+	// Queued futures are still pending, so touching them evaluates them on the
+	// calling thread.
+	free(sched.deques);
+	sched.deques = NULL;
+	sched.size = 0;
+	sched.n_deques = 0;
+	sched.head = sched.tail = NULL;
+	sched.shared = 0;
+	sched.pending = 0;
+	sched.sleeping = 0;
+	sched.waiting = 0;
+}
+
+// Waits for the future to finish, running it or tasks spawned below the
+// current one in the meantime.
+static void await(struct Future *future) {
+	while (!is_done(future)) {
+		if (claim(future)) {
+			run_task(future);
+			return;
+		}
+		struct Future *task = own_deque ? take(own_deque, task_mark) : NULL;
+		if (task) {
+			__atomic_sub_fetch(&sched.pending, 1, __ATOMIC_SEQ_CST);
+			run_queued(task);
+			continue;
+		}
+		pthread_mutex_lock(&sched.lock);
+		__atomic_add_fetch(&sched.waiting, 1, __ATOMIC_SEQ_CST);
+		while (!is_done(future)) {
+			pthread_cond_wait(&sched.finished, &sched.lock);
+		}
+		__atomic_sub_fetch(&sched.waiting, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&sched.lock);
+	}
+}
+
+struct Future *spawn_future(struct Expression expr, struct Environment *env) {
+	struct Future *future = xcalloc(1, sizeof *future);
+	future->ctx = current_context;
+	future->expr = retain_expression(expr);
+	future->env = retain_environment(env);
+	future->state = FUTURE_RUNNING;
+	future->ref_count = 1;
+	// Like the parallel operations, futures are evaluated on the calling
+	// thread while the profiler or allocation site tracking is on.
+	if (profile_enabled || alloc_sites_enabled) {
+		evaluate(future);
+		future->state = FUTURE_DONE;
+		return future;
+	}
+	pthread_once(&sched.once, start_scheduler);
+	if (sched.size == 0) {
+		evaluate(future);
+		future->state = FUTURE_DONE;
+		return future;
+	}
+
+	__atomic_add_fetch(&parallel_operations, 1, __ATOMIC_ACQ_REL);
+	future->state = FUTURE_PENDING;
+	future->ref_count = 2;
+	if (!own_deque) {
+		enqueue_shared(future);
+	} else if (!push(own_deque, future)) {
+		future->state = FUTURE_RUNNING;
+		future->ref_count = 1;
+		run_task(future);
+		return future;
+	}
+	__atomic_add_fetch(&sched.pending, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sched.sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&sched.lock);
+		pthread_cond_signal(&sched.work);
+		pthread_mutex_unlock(&sched.lock);
+	}
+	return future;
+}
+
+struct EvalResult touch_future(struct Future *future) {
+	await(future);
+	if (future->failed) {
+		struct EvalError *err =
+			__atomic_exchange_n(&future->err, NULL, __ATOMIC_ACQ_REL);
+		return (struct EvalResult){
+			.err = err ? err : new_eval_error(ERR_FUTURE)
+		};
+	}
+	return (struct EvalResult){
+		.expr = retain_expression(future->value),
+		.err = NULL
+	};
+}
+
+void free_future(struct Future *future) {
+	await(future);
+	merge_heap_stats(&future->stats);
+	add_eval_count(future->evals);
+	if (future->failed) {
+		if (future->err) {
+			free_eval_error(future->err);
+		}
+	} else {
+		release_expression(future->value);
+	}
+	drop_future(future);
+}
@@ -0,0 +1,37 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include "eval.h"
+#include "expr.h"
+
+struct Environment;
+
+// A Future is an expression being evaluated by a worker thread. Futures are
+// scheduled on their own pool of workers, one per processor (see
+// 'parallel_threads'), each with a deque of tasks: a worker runs the newest
+// task it spawned first, and steals the oldest tasks of other workers when it
+// runs out. Tasks spawned by other threads go in a shared queue.
+struct Future;
+
+// Starts evaluating 'expr' in 'env', and returns the future of its value. When
+// there are no workers, or when the profiler or allocation site tracking is
+// on, the expression is evaluated immediately instead.
+struct Future *spawn_future(struct Expression expr, struct Environment *env);
+
+// Returns the value of the future, waiting for it if necessary. Rather than
+// block, the calling thread evaluates the expression itself if no worker has
+// started it yet, and runs tasks that its own task spawned while it waits. If
+// the evaluation failed, the first touch returns its error, and later ones
+// return ERR_FUTURE.
+struct EvalResult touch_future(struct Future *future);
+
+// Forgets the workers and queued tasks of the scheduler. Called by
+// 'reset_threads_after_fork'.
+void reset_scheduler(void);
+
+// Frees a future after waiting for it to finish.
+void free_future(struct Future *future);
+
+#endif
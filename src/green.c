@@ -0,0 +1,357 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _DEFAULT_SOURCE
+
+#include "green.h"
+
+#include "context.h"
+#include "env.h"
+#include "error.h"
+#include "heap.h"
+#include "profile.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// Number of calls to 'eval' a green thread makes before it is preempted.
+#define TIME_SLICE 10000
+
+// Stack size of green threads when the stack size limit is unlimited. Stacks
+// are reserved as address space and only use memory as they grow.
+#define DEFAULT_STACK_SIZE (8 << 20)
+
+// Maximum number of events handled per call to 'epoll_wait'.
+#define MAX_EVENTS 64
+
+// Filename to use in the errors of green threads.
+static const char *const thread_filename = "<thread>";
+
+// A GreenThread is a coroutine. The one that started the scheduler runs on the
+// stack of the OS thread, and has a NULL 'stack'. While a thread waits on a
+// channel, 'value' holds the value it is sending or has received.
+struct GreenThread {
+	ucontext_t uc;
+	void *stack;
+	size_t stack_size;
+	struct EvaContext *ctx;
+	struct Expression proc;
+	struct Environment *env;
+	struct Expression value;
+	bool deadlock;
+	struct GreenThread *next;
+};
+
+// A queue of green threads, linked by their 'next' fields.
+struct Queue {
+	struct GreenThread *head;
+	struct GreenThread *tail;
+};
+
+struct Channel {
+	struct Queue senders;
+	struct Queue receivers;
+};
+
+_Thread_local long green_budget = 0;
+
+// The scheduler of the calling OS thread. The current thread is not in any
+// queue. A thread that finished is freed by the next one to run.
+static _Thread_local struct {
+	struct GreenThread *current;
+	struct GreenThread *root;
+	struct GreenThread *dead;
+	struct Queue runnable;
+	size_t io_waiting;
+	int epoll_fd;
+} green = { .epoll_fd = -1 };
+
+// Appends a thread to the queue.
+static void enqueue(struct Queue *queue, struct GreenThread *thread) {
+	thread->next = NULL;
+	if (queue->tail) {
+		queue->tail->next = thread;
+	} else {
+		queue->head = thread;
+	}
+	queue->tail = thread;
+}
+
+// Removes the first thread from the queue. Returns NULL if it is empty.
+static struct GreenThread *dequeue(struct Queue *queue) {
+	struct GreenThread *thread = queue->head;
+	if (thread) {
+		queue->head = thread->next;
+		if (!queue->head) {
+			queue->tail = NULL;
+		}
+	}
+	return thread;
+}
+
+// Removes a thread from anywhere in the queue, if it is there.
+static void remove_from(struct Queue *queue, struct GreenThread *thread) {
+	struct GreenThread *prev = NULL;
+	for (struct GreenThread *t = queue->head; t; prev = t, t = t->next) {
+		if (t == thread) {
+			if (prev) {
+				prev->next = t->next;
+			} else {
+				queue->head = t->next;
+			}
+			if (queue->tail == t) {
+				queue->tail = prev;
+			}
+			return;
+		}
+	}
+}
+
+// Makes a thread runnable, and starts the time slice of the current thread if
+// it was the only one.
+static void make_runnable(struct GreenThread *thread) {
+	enqueue(&green.runnable, thread);
+	if (green_budget == 0) {
+		green_budget = TIME_SLICE;
+	}
+}
+
+// Returns the current green thread, turning the calling OS thread into one if
+// necessary.
+static struct GreenThread *current_thread(void) {
+	if (!green.current) {
+		struct GreenThread *root = xcalloc(1, sizeof *root);
+		green.root = root;
+		green.current = root;
+	}
+	return green.current;
+}
+
+// Moves the threads whose file descriptors are ready to the run queue. Waits
+// for at most 'timeout' milliseconds, or indefinitely if it is -1.
+static void poll_io(int timeout) {
+	struct epoll_event events[MAX_EVENTS];
+	int n;
+	do {
+		n = epoll_wait(green.epoll_fd, events, MAX_EVENTS, timeout);
+	} while (n == -1 && errno == EINTR);
+	for (int i = 0; i < n; i++) {
+		make_runnable(events[i].data.ptr);
+	}
+}
+
+// Frees the stack and memory of a thread that finished.
+static void free_thread(struct GreenThread *thread) {
+	munmap(thread->stack, thread->stack_size);
+	free(thread);
+}
+
+// Switches from the current thread to the next runnable one. The current
+// thread must already be queued or waiting for something, unless it is
+// 'dying', in which case it is freed once the switch is done. If no thread can
+// run and none is waiting for I/O, every thread is blocked on a channel, so
+// the root thread is woken up with its 'deadlock' flag set.
+static void reschedule(bool dying) {
+	struct GreenThread *self = green.current;
+	if (green.io_waiting > 0) {
+		poll_io(0);
+	}
+	struct GreenThread *next;
+	while (!(next = dequeue(&green.runnable))) {
+		if (green.io_waiting > 0) {
+			poll_io(-1);
+			continue;
+		}
+		next = green.root;
+		next->deadlock = true;
+		break;
+	}
+	green_budget = green.runnable.head ? TIME_SLICE : 0;
+	if (next == self) {
+		return;
+	}
+	self->ctx = current_context;
+	green.current = next;
+	if (dying) {
+		green.dead = self;
+		setcontext(&next->uc);
+	}
+	swapcontext(&self->uc, &next->uc);
+	if (green.dead) {
+		free_thread(green.dead);
+		green.dead = NULL;
+	}
+	use_context(self->ctx);
+}
+
+// Entry point of green threads, which find out which one they are from the
+// scheduler.
+static void thread_main(void) {
+	struct GreenThread *self = green.current;
+	if (green.dead) {
+		free_thread(green.dead);
+		green.dead = NULL;
+	}
+	use_context(self->ctx);
+	struct EvalResult result = apply_procedure(self->proc, NULL, 0, self->env);
+	if (result.err) {
+		print_eval_error(thread_filename, result.err);
+		free_eval_error(result.err);
+	} else {
+		release_expression(result.expr);
+	}
+	release_expression(self->proc);
+	release_environment(self->env);
+	reschedule(true);
+}
+
+// Returns the stack size for new threads, which is the same as the main
+// thread's, since evaluation is recursive.
+static size_t stack_size(void) {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+			&& limit.rlim_cur > (rlim_t)DEFAULT_STACK_SIZE) {
+		return (size_t)limit.rlim_cur;
+	}
+	return DEFAULT_STACK_SIZE;
+}
+
+struct EvalResult spawn_green_thread(
+		struct Expression proc, struct Environment *env) {
+	current_thread();
+	struct GreenThread *thread = xcalloc(1, sizeof *thread);
+	// Stacks are mapped next to each other, so the lowest page of each one is
+	// a guard page, which makes an overflow fault instead of running into the
+	// stack below it.
+	size_t guard = (size_t)getpagesize();
+	thread->stack_size = stack_size() + guard;
+	thread->stack = mmap(NULL, thread->stack_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (thread->stack == MAP_FAILED
+			|| mprotect(thread->stack, guard, PROT_NONE) == -1) {
+		perror("FATAL");
+		exit(2);
+	}
+	thread->ctx = current_context;
+	thread->proc = retain_expression(proc);
+	thread->env = retain_environment(env);
+	getcontext(&thread->uc);
+	thread->uc.uc_stack.ss_sp = (char *)thread->stack + guard;
+	thread->uc.uc_stack.ss_size = thread->stack_size - guard;
+	thread->uc.uc_link = NULL;
+	makecontext(&thread->uc, thread_main, 0);
+	make_runnable(thread);
+	return (struct EvalResult){ .expr = new_void(), .err = NULL };
+}
+
+void yield_green_thread(void) {
+	if (!green.runnable.head) {
+		return;
+	}
+	make_runnable(green.current);
+	reschedule(false);
+}
+
+void preempt_green_thread(void) {
+	// Like the parallel operations, threads are not preempted while the
+	// profiler or allocation site tracking is on, since their state is not
+	// kept per thread.
+	if (profile_enabled || alloc_sites_enabled) {
+		return;
+	}
+	yield_green_thread();
+}
+
+struct Channel *make_channel(void) {
+	return xcalloc(1, sizeof(struct Channel));
+}
+
+void free_channel(struct Channel *channel) {
+	assert(!channel->senders.head && !channel->receivers.head);
+	free(channel);
+}
+
+// Blocks the current thread in 'queue'. Returns false if it was woken up
+// because of a deadlock, after taking it out of the queue.
+static bool block(struct Queue *queue) {
+	struct GreenThread *self = current_thread();
+	enqueue(queue, self);
+	reschedule(false);
+	if (self->deadlock) {
+		self->deadlock = false;
+		remove_from(queue, self);
+		return false;
+	}
+	return true;
+}
+
+struct EvalResult channel_send(
+		struct Channel *channel, struct Expression value) {
+	struct EvalResult result = { .expr = new_void(), .err = NULL };
+	struct GreenThread *receiver = dequeue(&channel->receivers);
+	if (receiver) {
+		receiver->value = retain_expression(value);
+		make_runnable(receiver);
+		return result;
+	}
+	struct GreenThread *self = current_thread();
+	self->value = retain_expression(value);
+	if (!block(&channel->senders)) {
+		release_expression(self->value);
+		result.err = new_eval_error(ERR_DEADLOCK);
+	}
+	return result;
+}
+
+struct EvalResult channel_recv(struct Channel *channel) {
+	struct EvalResult result = { .err = NULL };
+	struct GreenThread *sender = dequeue(&channel->senders);
+	if (sender) {
+		result.expr = sender->value;
+		make_runnable(sender);
+		return result;
+	}
+	if (block(&channel->receivers)) {
+		result.expr = green.current->value;
+	} else {
+		result.err = new_eval_error(ERR_DEADLOCK);
+	}
+	return result;
+}
+
+void wait_readable(int fd) {
+	if (!green.runnable.head && green.io_waiting == 0) {
+		return;
+	}
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	if (poll(&pfd, 1, 0) != 0) {
+		return;
+	}
+	if (green.epoll_fd == -1) {
+		green.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (green.epoll_fd == -1) {
+			return;
+		}
+	}
+	struct GreenThread *self = current_thread();
+	struct epoll_event event = {
+		.events = EPOLLIN | EPOLLONESHOT,
+		.data.ptr = self
+	};
+	if (epoll_ctl(green.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		return;
+	}
+	green.io_waiting++;
+	reschedule(false);
+	green.io_waiting--;
+	epoll_ctl(green.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
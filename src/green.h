@@ -0,0 +1,60 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef GREEN_H
+#define GREEN_H
+
+#include "eval.h"
+#include "expr.h"
+
+struct Environment;
+
+// Green threads are coroutines that take turns running on one OS thread, each
+// on a stack of its own. The OS thread that spawns the first one becomes a
+// green thread too, and the others only run when it yields, blocks, or is
+// preempted. A thread is preempted after a fixed number of calls to 'eval'.
+// Reading from a port that has no input ready blocks only the calling green
+// thread: the scheduler waits for its file descriptor with epoll when no other
+// thread can run.
+
+// A Channel passes values between green threads. Sending blocks until another
+// thread receives the value, and receiving blocks until another thread sends
+// one.
+struct Channel;
+
+// Number of calls to 'eval' left before the current green thread is
+// preempted, or 0 if there is no other thread to switch to.
+extern _Thread_local long green_budget;
+
+// Starts a green thread that calls 'proc' with no arguments. If it fails, the
+// error is printed and the thread exits.
+struct EvalResult spawn_green_thread(
+		struct Expression proc, struct Environment *env);
+
+// Lets the other runnable green threads run before the calling one resumes.
+void yield_green_thread(void);
+
+// Switches to another green thread because the budget of the calling one ran
+// out. Called by 'eval'.
+void preempt_green_thread(void);
+
+// Creates a new channel.
+struct Channel *make_channel(void);
+
+// Frees a channel. No threads can be waiting on it.
+void free_channel(struct Channel *channel);
+
+// Sends 'value' on the channel, blocking until another thread receives it.
+// Returns void, or ERR_DEADLOCK if every thread is blocked on a channel.
+struct EvalResult channel_send(
+		struct Channel *channel, struct Expression value);
+
+// Receives a value from the channel, blocking until another thread sends one.
+// Returns ERR_DEADLOCK if every thread is blocked on a channel.
+struct EvalResult channel_recv(struct Channel *channel);
+
+// Blocks the calling green thread until 'fd' is ready for reading. Returns
+// immediately if it already is, if there are no other green threads, or if
+// the file descriptor cannot be polled (for example, if it is a regular file).
+void wait_readable(int fd);
+
+#endif
@@ -0,0 +1,270 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "heap.h"
+
+#include "context.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Initial capacity of the allocation site table.
+#define DEFAULT_SITES_CAP 256
+
+// Number of allocation sites listed in the report.
+#define REPORT_ROWS 20
+
+// Maximum number of characters printed for the code of an allocation site.
+#define MAX_FORM_WIDTH 60
+
+bool alloc_sites_enabled = false;
+
+// An application that allocated boxes. The box of the application's code is
+// retained, so that it can be printed in the report.
+struct Site {
+	struct Box *box; // NULL for an empty slot
+	size_t count;
+	size_t bytes;
+};
+
+// Statistics that the calling thread counts allocations in instead of its
+// context, or NULL (see 'redirect_heap_stats').
+static _Thread_local struct HeapStats *thread_stats = NULL;
+
+// Returns the statistics that allocations by the calling thread count towards.
+static struct HeapStats *current_stats(void) {
+	return thread_stats ? thread_stats : &current_context->heap.stats;
+}
+
+// The allocation sites of a context are stored in the open-addressing hash
+// table 'sites', keyed by box address. Allocations made outside of any
+// application, such as by the parser, are counted as unattributed.
+
+struct HeapStats heap_stats(void) {
+	struct HeapStats result = current_context->heap.stats;
+	result.seconds = (double)clock() / CLOCKS_PER_SEC;
+	return result;
+}
+
+// Returns the number of bytes used by the box of 'expr'.
+static size_t box_bytes(struct Expression expr) {
+	size_t bytes = sizeof *expr.box;
+	switch (expr.type) {
+	case E_STRING:
+		bytes += expr.box->len;
+		break;
+	case E_MACRO:
+	case E_PROCEDURE:;
+		Arity arity = expr.box->arity;
+		size_t n_params = arity < 0 ? (size_t)ATLEAST(arity) + 1 : (size_t)arity;
+		bytes += n_params * sizeof *expr.box->params;
+		break;
+	default:
+		break;
+	}
+	return bytes;
+}
+
+// Returns the slot for 'box' in 'table', which must have room for it.
+static struct Site *find_slot(struct Site *table, size_t cap, struct Box *box) {
+	size_t mask = cap - 1;
+	size_t i = ((uintptr_t)box >> 4) & mask;
+	while (table[i].box && table[i].box != box) {
+		i = (i + 1) & mask;
+	}
+	return table + i;
+}
+
+// Attributes an allocation of 'bytes' to the current allocation site.
+static void record_site(size_t bytes) {
+	struct EvaContext *ctx = current_context;
+	struct Box *alloc_site = ctx->heap.alloc_site;
+	if (!alloc_site) {
+		ctx->heap.unattributed_count++;
+		ctx->heap.unattributed_bytes += bytes;
+		return;
+	}
+	struct Site *sites = ctx->heap.sites;
+	size_t sites_cap = ctx->heap.sites_cap;
+	if (2 * (ctx->heap.sites_len + 1) > sites_cap) {
+		size_t cap = sites_cap == 0 ? DEFAULT_SITES_CAP : sites_cap * 2;
+		struct Site *table = xcalloc(cap, sizeof *table);
+		for (size_t i = 0; i < sites_cap; i++) {
+			if (sites[i].box) {
+				*find_slot(table, cap, sites[i].box) = sites[i];
+			}
+		}
+		free(sites);
+		sites = ctx->heap.sites = table;
+		sites_cap = ctx->heap.sites_cap = cap;
+	}
+	struct Site *site = find_slot(sites, sites_cap, alloc_site);
+	if (!site->box) {
+		site->box = alloc_site;
+		alloc_site->ref_count++;
+		ctx->heap.sites_len++;
+	}
+	site->count++;
+	site->bytes += bytes;
+}
+
+void count_allocation(struct Expression expr) {
+	struct HeapStats *stats = current_stats();
+	switch (expr.type) {
+	case E_PAIR:
+		stats->pairs++;
+		break;
+	case E_STRING:
+		stats->strings++;
+		break;
+	case E_MACRO:
+	case E_PROCEDURE:
+		stats->procedures++;
+		break;
+	case E_PORT:
+		stats->ports++;
+		break;
+	default:
+		return;
+	}
+	size_t bytes = box_bytes(expr);
+	stats->bytes += bytes;
+	stats->allocations++;
+	if (alloc_sites_enabled) {
+		record_site(bytes);
+	}
+}
+
+void count_free(struct Expression expr) {
+	struct HeapStats *stats = current_stats();
+	switch (expr.type) {
+	case E_PAIR:
+		stats->pairs--;
+		break;
+	case E_STRING:
+		stats->strings--;
+		break;
+	case E_MACRO:
+	case E_PROCEDURE:
+		stats->procedures--;
+		break;
+	case E_PORT:
+		stats->ports--;
+		break;
+	default:
+		return;
+	}
+	stats->bytes -= box_bytes(expr);
+	stats->frees++;
+}
+
+void count_environment(size_t depth) {
+	struct HeapStats *stats = current_stats();
+	stats->environments++;
+	stats->environments_created++;
+	stats->depth_total += depth;
+}
+
+void count_environment_free(size_t depth) {
+	struct HeapStats *stats = current_stats();
+	stats->environments--;
+	stats->depth_total -= depth;
+}
+
+struct HeapStats *redirect_heap_stats(struct HeapStats *stats) {
+	struct HeapStats *previous = thread_stats;
+	thread_stats = stats;
+	return previous;
+}
+
+void merge_heap_stats(const struct HeapStats *stats) {
+	struct HeapStats *total = current_stats();
+	total->pairs += stats->pairs;
+	total->strings += stats->strings;
+	total->procedures += stats->procedures;
+	total->ports += stats->ports;
+	total->bytes += stats->bytes;
+	total->allocations += stats->allocations;
+	total->frees += stats->frees;
+	total->environments += stats->environments;
+	total->environments_created += stats->environments_created;
+	total->depth_total += stats->depth_total;
+}
+
+void enable_alloc_sites(void) {
+	alloc_sites_enabled = true;
+}
+
+static int compare_bytes(const void *lhs, const void *rhs) {
+	const struct Site *a = lhs, *b = rhs;
+	return (a->bytes < b->bytes) - (a->bytes > b->bytes);
+}
+
+// Prints the code of an allocation site, truncated to MAX_FORM_WIDTH.
+static void print_form(struct Box *box) {
+	char *text = NULL;
+	size_t len = 0;
+	FILE *stream = open_memstream(&text, &len);
+	if (!stream) {
+		return;
+	}
+	print_expression((struct Expression){ .type = E_PAIR, .box = box }, stream);
+	fclose(stream);
+	for (size_t i = 0; i < len; i++) {
+		if (text[i] == '\n') {
+			text[i] = ' ';
+		}
+	}
+	if (len > MAX_FORM_WIDTH) {
+		fprintf(stderr, "%.*s...", MAX_FORM_WIDTH - 3, text);
+	} else {
+		fputs(text, stderr);
+	}
+	free(text);
+}
+
+void print_alloc_sites(void) {
+	// Pack the sites at the start of the table and sort them.
+	struct EvaContext *ctx = current_context;
+	struct Site *sites = ctx->heap.sites;
+	size_t n = 0;
+	for (size_t i = 0; i < ctx->heap.sites_cap; i++) {
+		if (sites[i].box) {
+			sites[n++] = sites[i];
+		}
+	}
+	memset(sites + n, 0, (ctx->heap.sites_cap - n) * sizeof *sites);
+	qsort(sites, n, sizeof *sites, compare_bytes);
+
+	fprintf(stderr, "alloc: %zu sites, %zu allocations (%zu bytes) outside"
+			" applications\n%10s %12s  %s\n",
+			n, ctx->heap.unattributed_count, ctx->heap.unattributed_bytes,
+			"boxes", "bytes", "site");
+	for (size_t i = 0; i < MIN(n, (size_t)REPORT_ROWS); i++) {
+		fprintf(stderr, "%10zu %12zu  ", sites[i].count, sites[i].bytes);
+		print_form(sites[i].box);
+		putc('\n', stderr);
+	}
+
+	alloc_sites_enabled = false;
+	free_alloc_sites();
+}
+
+void free_alloc_sites(void) {
+	struct EvaContext *ctx = current_context;
+	struct Site *sites = ctx->heap.sites;
+	for (size_t i = 0; i < ctx->heap.sites_cap; i++) {
+		if (sites[i].box) {
+			release_expression(
+					(struct Expression){ .type = E_PAIR, .box = sites[i].box });
+		}
+	}
+	free(sites);
+	ctx->heap.sites = NULL;
+	ctx->heap.sites_len = ctx->heap.sites_cap = 0;
+}
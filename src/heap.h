@@ -0,0 +1,71 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "expr.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// HeapStats describes the boxes and environments on the heap of a context. The
+// counters are always maintained, so they are cheap to read at any time. Byte
+// counts include the strings and parameter arrays owned by boxes, but not port
+// buffers.
+struct HeapStats {
+	size_t pairs;                // live pairs
+	size_t strings;              // live strings
+	size_t procedures;           // live procedures and macros
+	size_t ports;                // live ports
+	size_t bytes;                // bytes used by live boxes
+	size_t allocations;          // boxes allocated since startup
+	size_t frees;                // boxes freed since startup
+	size_t environments;         // live environments
+	size_t environments_created; // environments created since startup
+	size_t depth_total;          // sum of the depths of live environments
+	double seconds;              // CPU time used since startup
+};
+
+// Returns the current heap statistics.
+struct HeapStats heap_stats(void);
+
+// Counts the allocation or deallocation of the box of 'expr'. Called by the
+// expression constructors and destructor, and by anything else that creates
+// boxes.
+void count_allocation(struct Expression expr);
+void count_free(struct Expression expr);
+
+// Counts the creation or destruction of an environment at the given depth (1
+// for a base environment, 2 for its children, and so on).
+void count_environment(size_t depth);
+void count_environment_free(size_t depth);
+
+// Makes the calling thread count allocations in 'stats' instead of in the
+// current context, or in the context again if 'stats' is NULL, and returns the
+// previous statistics. Worker threads that share a context use this so that
+// they do not race on its counters, and the counts are added to the context
+// with 'merge_heap_stats' afterwards. A box can be freed by a different thread
+// than the one that allocated it, so the live counts in 'stats' may wrap around
+// below zero, but the merged totals are still correct.
+struct HeapStats *redirect_heap_stats(struct HeapStats *stats);
+
+// Adds the counters in 'stats' to the ones the calling thread counts in.
+void merge_heap_stats(const struct HeapStats *stats);
+
+// Allocation sites are the applications that allocate boxes. When tracking is
+// enabled (it is disabled by default), the evaluator stores the application it
+// is evaluating in the context's 'heap.alloc_site', and every allocation is
+// attributed to it.
+extern bool alloc_sites_enabled;
+
+// Enables tracking of allocation sites.
+void enable_alloc_sites(void);
+
+// Prints the allocation sites that allocated the most bytes to standard error,
+// and then disables tracking and frees the sites.
+void print_alloc_sites(void);
+
+// Frees the allocation sites recorded so far. Called by 'free_context'.
+void free_alloc_sites(void);
+
+#endif
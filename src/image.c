@@ -0,0 +1,773 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#include "image.h"
+
+#include "env.h"
+#include "expr.h"
+#include "foreign.h"
+#include "heap.h"
+#include "intern.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Constants for the image format.
+#define IMAGE_MAGIC "EVAIMAGE"
+#define IMAGE_VERSION 4
+#define NO_INDEX UINT32_MAX
+#define DEFAULT_BUFFER_CAP 4096
+#define DEFAULT_MAP_CAP 256
+
+// Error messages.
+static const char *const err_port = "Cannot save a port in an image";
+static const char *const err_future = "Cannot save a future in an image";
+static const char *const err_channel = "Cannot save a channel in an image";
+static const char *const err_actor = "Cannot save an actor in an image";
+static const char *const err_foreign =
+	"Cannot save a foreign procedure in an image";
+static const char *const err_format = "Not a valid image";
+static const char *const err_build = "Image was saved by a different build";
+static const char *const err_root_env = "Image contains an environment";
+static const char *const err_root_expr =
+	"Image does not contain an environment";
+
+// An image file consists of the following parts, in order. All integers are
+// stored in native byte order, since images are not meant to be portable.
+//
+// 1. Header: magic string, version, the numbers of expression types, standard
+//    macros, and standard procedures, a hash of their names, the tag, the
+//    numbers of interned strings, environments, and boxes, and whether the
+//    root is an environment.
+// 2. Interned strings used by the image, each a u32 length followed by its
+//    characters. Symbols refer to them by index.
+// 3. One byte per box giving its kind, so that references can be checked.
+// 4. Environment records: the parent index, the number of bindings, and the
+//    bindings as pairs of symbol and expression. Parents come first.
+// 5. Box records, according to their kinds.
+// 6. The root: an environment index, or an expression.
+//
+// An expression is stored as a type byte followed by its value, if it has one.
+// Boxed expressions store the index of the box.
+
+// Kinds of box records. Macros and procedures share the same box layout, and
+// the same box can be referenced as both.
+enum BoxKind {
+	BOX_PAIR,
+	BOX_STRING,
+	BOX_CLOSURE
+};
+
+// The root of an image is either an environment or an expression.
+struct Root {
+	bool is_env;
+	struct Environment *env;
+	struct Expression expr;
+};
+
+// A growable buffer of bytes.
+struct Buffer {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+// A hash map from pointers to indices, using open addressing.
+struct PtrMap {
+	const void **keys;
+	uint32_t *vals;
+	size_t len;
+	size_t cap;
+};
+
+// State used while saving an image. Boxes and environments are assigned
+// indices in the order they are discovered, and records are written in the
+// same order. Only the interned strings that are used get saved, so symbols
+// are also renumbered in the order they are discovered.
+struct Saver {
+	struct PtrMap env_map;
+	struct PtrMap box_map;
+	struct Environment **envs;
+	size_t n_envs;
+	size_t envs_cap;
+	struct Box **boxes;
+	char *kinds;
+	size_t n_boxes;
+	size_t boxes_cap;
+	uint32_t *symbol_index;
+	InternId *symbols;
+	size_t n_symbols;
+	struct Buffer env_buf;
+	struct Buffer box_buf;
+	struct Buffer root_buf;
+	const char *err;
+};
+
+static void put_bytes(struct Buffer *buf, const void *bytes, size_t n) {
+	if (buf->len + n > buf->cap) {
+		buf->cap = MAX(buf->cap == 0 ? DEFAULT_BUFFER_CAP : buf->cap * 2,
+				buf->len + n);
+		buf->data = xrealloc(buf->data, buf->cap);
+	}
+	memcpy(buf->data + buf->len, bytes, n);
+	buf->len += n;
+}
+
+static void put_u8(struct Buffer *buf, uint8_t x) {
+	put_bytes(buf, &x, sizeof x);
+}
+
+static void put_u32(struct Buffer *buf, uint32_t x) {
+	put_bytes(buf, &x, sizeof x);
+}
+
+static void put_u64(struct Buffer *buf, uint64_t x) {
+	put_bytes(buf, &x, sizeof x);
+}
+
+// Returns the index for 'key' in the map, or NO_INDEX if there is none.
+static uint32_t map_get(const struct PtrMap *map, const void *key) {
+	if (map->cap == 0) {
+		return NO_INDEX;
+	}
+	size_t mask = map->cap - 1;
+	size_t i = ((uintptr_t)key >> 4) & mask;
+	for (; map->keys[i]; i = (i + 1) & mask) {
+		if (map->keys[i] == key) {
+			return map->vals[i];
+		}
+	}
+	return NO_INDEX;
+}
+
+// Adds a key that is not in the map yet.
+static void map_put(struct PtrMap *map, const void *key, uint32_t val) {
+	if (2 * (map->len + 1) > map->cap) {
+		struct PtrMap old = *map;
+		map->cap = old.cap == 0 ? DEFAULT_MAP_CAP : old.cap * 2;
+		map->len = 0;
+		map->keys = xcalloc(map->cap, sizeof *map->keys);
+		map->vals = xmalloc(map->cap * sizeof *map->vals);
+		for (size_t i = 0; i < old.cap; i++) {
+			if (old.keys[i]) {
+				map_put(map, old.keys[i], old.vals[i]);
+			}
+		}
+		free(old.keys);
+		free(old.vals);
+	}
+	size_t mask = map->cap - 1;
+	size_t i = ((uintptr_t)key >> 4) & mask;
+	while (map->keys[i]) {
+		i = (i + 1) & mask;
+	}
+	map->keys[i] = key;
+	map->vals[i] = val;
+	map->len++;
+}
+
+// Returns the index of an environment, assigning one if necessary. Parents are
+// always assigned lower indices than their children.
+static uint32_t env_index(struct Saver *s, struct Environment *env) {
+	if (!env) {
+		return NO_INDEX;
+	}
+	uint32_t index = map_get(&s->env_map, env);
+	if (index != NO_INDEX) {
+		return index;
+	}
+	env_index(s, parent_environment(env));
+	if (s->n_envs == s->envs_cap) {
+		s->envs_cap = s->envs_cap == 0 ? DEFAULT_MAP_CAP : s->envs_cap * 2;
+		s->envs = xrealloc(s->envs, s->envs_cap * sizeof *s->envs);
+	}
+	index = (uint32_t)s->n_envs;
+	s->envs[s->n_envs++] = env;
+	map_put(&s->env_map, env, index);
+	return index;
+}
+
+// Returns the index of a box, assigning one if necessary.
+static uint32_t box_index(
+		struct Saver *s, struct Box *box, enum BoxKind kind) {
+	uint32_t index = map_get(&s->box_map, box);
+	if (index != NO_INDEX) {
+		return index;
+	}
+	if (s->n_boxes == s->boxes_cap) {
+		s->boxes_cap = s->boxes_cap == 0 ? DEFAULT_MAP_CAP : s->boxes_cap * 2;
+		s->boxes = xrealloc(s->boxes, s->boxes_cap * sizeof *s->boxes);
+		s->kinds = xrealloc(s->kinds, s->boxes_cap);
+	}
+	index = (uint32_t)s->n_boxes;
+	s->boxes[s->n_boxes] = box;
+	s->kinds[s->n_boxes] = (char)kind;
+	s->n_boxes++;
+	map_put(&s->box_map, box, index);
+	return index;
+}
+
+// Writes the index of a symbol, assigning one if necessary.
+static void put_symbol(struct Saver *s, struct Buffer *buf, InternId id) {
+	if (!s->symbol_index) {
+		size_t count = intern_stats().count;
+		s->symbol_index = xmalloc(count * sizeof *s->symbol_index);
+		memset(s->symbol_index, 0xff, count * sizeof *s->symbol_index);
+		s->symbols = xmalloc(count * sizeof *s->symbols);
+	}
+	if (s->symbol_index[id] == NO_INDEX) {
+		s->symbol_index[id] = (uint32_t)s->n_symbols;
+		s->symbols[s->n_symbols++] = id;
+	}
+	put_u32(buf, s->symbol_index[id]);
+}
+
+static void write_expr(
+		struct Saver *s, struct Buffer *buf, struct Expression expr) {
+	put_u8(buf, (uint8_t)expr.type);
+	switch (expr.type) {
+	case E_VOID:
+	case E_EOF:
+	case E_NULL:
+		break;
+	case E_SYMBOL:
+		put_symbol(s, buf, expr.symbol_id);
+		break;
+	case E_NUMBER:
+		put_u64(buf, (uint64_t)expr.number);
+		break;
+	case E_BOOLEAN:
+		put_u8(buf, expr.boolean);
+		break;
+	case E_CHARACTER:
+		put_u8(buf, (uint8_t)expr.character);
+		break;
+	case E_STDMACRO:
+		put_u32(buf, expr.stdmacro);
+		break;
+	case E_STDPROCMACRO:
+	case E_STDPROCEDURE:
+		if (is_foreign(expr.stdproc)) {
+			s->err = err_foreign;
+		}
+		put_u32(buf, expr.stdproc);
+		break;
+	case E_PAIR:
+		put_u32(buf, box_index(s, expr.box, BOX_PAIR));
+		break;
+	case E_STRING:
+		put_u32(buf, box_index(s, expr.box, BOX_STRING));
+		break;
+	case E_MACRO:
+	case E_PROCEDURE:
+		put_u32(buf, box_index(s, expr.box, BOX_CLOSURE));
+		break;
+	case E_PORT:
+		s->err = err_port;
+		put_u32(buf, NO_INDEX);
+		break;
+	case E_FUTURE:
+		s->err = err_future;
+		put_u32(buf, NO_INDEX);
+		break;
+	case E_CHANNEL:
+		s->err = err_channel;
+		put_u32(buf, NO_INDEX);
+		break;
+	case E_ACTOR:
+		s->err = err_actor;
+		put_u32(buf, NO_INDEX);
+		break;
+	}
+}
+
+// Returns the number of parameters of a procedure with the given arity.
+static size_t params_length(Arity arity) {
+	return arity < 0 ? (size_t)ATLEAST(arity) + 1 : (size_t)arity;
+}
+
+static void write_binding(InternId key, struct Expression expr, void *data) {
+	struct Saver *s = data;
+	put_symbol(s, &s->env_buf, key);
+	write_expr(s, &s->env_buf, expr);
+}
+
+static void count_binding(InternId key, struct Expression expr, void *data) {
+	(void)key;
+	(void)expr;
+	(*(uint32_t *)data)++;
+}
+
+static void write_env(struct Saver *s, struct Environment *env) {
+	uint32_t count = 0;
+	for_each_binding(env, count_binding, &count);
+	put_u32(&s->env_buf, env_index(s, parent_environment(env)));
+	put_u32(&s->env_buf, count);
+	for_each_binding(env, write_binding, s);
+}
+
+static void write_box(struct Saver *s, struct Box *box, enum BoxKind kind) {
+	struct Buffer *buf = &s->box_buf;
+	switch (kind) {
+	case BOX_PAIR:
+		write_expr(s, buf, box->car);
+		write_expr(s, buf, box->cdr);
+		break;
+	case BOX_STRING:
+		put_u64(buf, box->len);
+		put_bytes(buf, box->str, box->len);
+		break;
+	case BOX_CLOSURE:;
+		size_t n_params = params_length(box->arity);
+		put_u32(buf, (uint32_t)box->arity);
+		write_expr(s, buf, box->name == ANONYMOUS
+				? new_void()
+				: new_symbol(box->name));
+		for (size_t i = 0; i < n_params; i++) {
+			write_expr(s, buf, box->params[i]);
+		}
+		write_expr(s, buf, box->body);
+		put_u32(buf, env_index(s, box->env));
+		break;
+	}
+}
+
+// Writes the whole file, and renames it into place so that readers never see a
+// partially written image.
+static const char *write_file(
+		const char *filename, const struct Buffer *parts, size_t n_parts) {
+	size_t len = strlen(filename);
+	char *tmp = xmalloc(len + 5);
+	memcpy(tmp, filename, len);
+	memcpy(tmp + len, ".tmp", 5);
+	FILE *file = fopen(tmp, "wb");
+	bool success = file != NULL;
+	for (size_t i = 0; success && i < n_parts; i++) {
+		success = fwrite(parts[i].data, 1, parts[i].len, file) == parts[i].len;
+	}
+	if (file && fclose(file) != 0) {
+		success = false;
+	}
+	if (success) {
+		success = rename(tmp, filename) == 0;
+	}
+	const char *err = success ? NULL : strerror(errno);
+	if (!success) {
+		remove(tmp);
+	}
+	free(tmp);
+	return err;
+}
+
+static const char *save_root(
+		const char *filename, struct Root root, uint64_t tag) {
+	struct Saver s = { .err = NULL };
+	if (root.is_env) {
+		put_u32(&s.root_buf, env_index(&s, root.env));
+	} else {
+		write_expr(&s, &s.root_buf, root.expr);
+	}
+	// Writing records discovers more environments and boxes, so keep going
+	// until all of them have been written.
+	size_t env_i = 0;
+	size_t box_i = 0;
+	while (env_i < s.n_envs || box_i < s.n_boxes) {
+		while (env_i < s.n_envs) {
+			write_env(&s, s.envs[env_i++]);
+		}
+		while (box_i < s.n_boxes) {
+			write_box(&s, s.boxes[box_i], (enum BoxKind)s.kinds[box_i]);
+			box_i++;
+		}
+	}
+
+	struct Buffer head = { .data = NULL };
+	put_bytes(&head, IMAGE_MAGIC, strlen(IMAGE_MAGIC));
+	put_u32(&head, IMAGE_VERSION);
+	put_u32(&head, N_EXPRESSION_TYPES);
+	put_u32(&head, N_STANDARD_MACROS);
+	put_u32(&head, N_STANDARD_PROCEDURES);
+	put_u64(&head, standard_names_hash());
+	put_u64(&head, tag);
+	put_u32(&head, (uint32_t)s.n_symbols);
+	put_u32(&head, (uint32_t)s.n_envs);
+	put_u32(&head, (uint32_t)s.n_boxes);
+	put_u32(&head, root.is_env);
+	for (size_t i = 0; i < s.n_symbols; i++) {
+		size_t len = find_string_length(s.symbols[i]);
+		put_u32(&head, (uint32_t)len);
+		put_bytes(&head, find_string(s.symbols[i]), len);
+	}
+	put_bytes(&head, s.kinds, s.n_boxes);
+
+	const char *err = s.err;
+	if (!err) {
+		struct Buffer parts[] = { head, s.env_buf, s.box_buf, s.root_buf };
+		err = write_file(filename, parts, sizeof parts / sizeof *parts);
+	}
+	free(head.data);
+	free(s.env_buf.data);
+	free(s.box_buf.data);
+	free(s.root_buf.data);
+	free(s.env_map.keys);
+	free(s.env_map.vals);
+	free(s.box_map.keys);
+	free(s.box_map.vals);
+	free(s.envs);
+	free(s.boxes);
+	free(s.kinds);
+	free(s.symbol_index);
+	free(s.symbols);
+	return err;
+}
+
+const char *save_image(
+		const char *filename, struct Environment *env, uint64_t tag) {
+	struct Root root = { .is_env = true, .env = env };
+	return save_root(filename, root, tag);
+}
+
+const char *save_expression_image(
+		const char *filename, struct Expression expr, uint64_t tag) {
+	return save_root(filename, (struct Root){ .is_env = false, .expr = expr },
+			tag);
+}
+
+// State used while loading an image. Reading past the end of the data, or
+// finding an invalid value, sets 'ok' to false.
+struct Loader {
+	const char *ptr;
+	const char *end;
+	bool ok;
+	InternId *symbols;
+	uint32_t n_symbols;
+	struct Environment **envs;
+	uint32_t n_envs;
+	struct Box **boxes;
+	const char *kinds;
+	uint32_t n_boxes;
+};
+
+static const char *get_bytes(struct Loader *l, size_t n) {
+	if ((size_t)(l->end - l->ptr) < n) {
+		l->ok = false;
+		l->ptr = l->end;
+		return NULL;
+	}
+	const char *bytes = l->ptr;
+	l->ptr += n;
+	return bytes;
+}
+
+static uint8_t get_u8(struct Loader *l) {
+	uint8_t x = 0;
+	const char *bytes = get_bytes(l, sizeof x);
+	if (bytes) {
+		memcpy(&x, bytes, sizeof x);
+	}
+	return x;
+}
+
+static uint32_t get_u32(struct Loader *l) {
+	uint32_t x = 0;
+	const char *bytes = get_bytes(l, sizeof x);
+	if (bytes) {
+		memcpy(&x, bytes, sizeof x);
+	}
+	return x;
+}
+
+static uint64_t get_u64(struct Loader *l) {
+	uint64_t x = 0;
+	const char *bytes = get_bytes(l, sizeof x);
+	if (bytes) {
+		memcpy(&x, bytes, sizeof x);
+	}
+	return x;
+}
+
+// Reads a box index, checking that the box has the expected kind.
+static struct Box *get_box(struct Loader *l, enum BoxKind kind) {
+	uint32_t index = get_u32(l);
+	if (index >= l->n_boxes || l->kinds[index] != (char)kind) {
+		l->ok = false;
+		return NULL;
+	}
+	return l->boxes[index];
+}
+
+// Reads an expression. The reference count of its box, if it has one, is
+// incremented on behalf of the new reference.
+static struct Expression get_expr(struct Loader *l) {
+	struct Expression expr = new_void();
+	uint32_t value;
+	expr.type = (enum ExpressionType)get_u8(l);
+	switch (expr.type) {
+	case E_VOID:
+	case E_EOF:
+	case E_NULL:
+		break;
+	case E_SYMBOL:
+		value = get_u32(l);
+		if (value >= l->n_symbols) {
+			l->ok = false;
+			break;
+		}
+		expr.symbol_id = l->symbols[value];
+		break;
+	case E_NUMBER:
+		expr.number = (Number)get_u64(l);
+		break;
+	case E_BOOLEAN:
+		expr.boolean = get_u8(l) != 0;
+		break;
+	case E_CHARACTER:
+		expr.character = (char)get_u8(l);
+		break;
+	case E_STDMACRO:
+		value = get_u32(l);
+		l->ok &= value < N_STANDARD_MACROS;
+		expr.stdmacro = (enum StandardMacro)value;
+		break;
+	case E_STDPROCMACRO:
+	case E_STDPROCEDURE:
+		value = get_u32(l);
+		l->ok &= value < N_STANDARD_PROCEDURES;
+		expr.stdproc = (enum StandardProcedure)value;
+		break;
+	case E_PAIR:
+		expr.box = get_box(l, BOX_PAIR);
+		break;
+	case E_STRING:
+		expr.box = get_box(l, BOX_STRING);
+		break;
+	case E_MACRO:
+	case E_PROCEDURE:
+		expr.box = get_box(l, BOX_CLOSURE);
+		break;
+	default:
+		l->ok = false;
+		break;
+	}
+	if (!l->ok) {
+		return new_void();
+	}
+	if (expr.type >= E_PAIR) {
+		expr.box->ref_count++;
+	}
+	return expr;
+}
+
+// Reads an environment index, which must be less than 'limit'.
+static struct Environment *get_env(struct Loader *l, uint32_t limit) {
+	uint32_t index = get_u32(l);
+	if (index == NO_INDEX) {
+		return NULL;
+	}
+	if (index >= limit) {
+		l->ok = false;
+		return NULL;
+	}
+	return l->envs[index];
+}
+
+// Returns an expression referring to 'box', which has the given kind.
+static struct Expression box_expression(struct Box *box, enum BoxKind kind) {
+	static const enum ExpressionType types[] = {
+		[BOX_PAIR]    = E_PAIR,
+		[BOX_STRING]  = E_STRING,
+		[BOX_CLOSURE] = E_PROCEDURE
+	};
+	return (struct Expression){ .type = types[kind], .box = box };
+}
+
+static void read_box(struct Loader *l, struct Box *box, enum BoxKind kind) {
+	switch (kind) {
+	case BOX_PAIR:
+		box->car = get_expr(l);
+		box->cdr = get_expr(l);
+		break;
+	case BOX_STRING:;
+		uint64_t len = get_u64(l);
+		const char *str = get_bytes(l, len);
+		box->len = str ? len : 0;
+		box->str = box->len == 0 ? NULL : xmalloc(box->len);
+		if (box->len > 0) {
+			memcpy(box->str, str, box->len);
+		}
+		break;
+	case BOX_CLOSURE:
+		box->arity = (Arity)get_u32(l);
+		struct Expression name = get_expr(l);
+		box->name = name.type == E_SYMBOL ? name.symbol_id : ANONYMOUS;
+		size_t n_params = params_length(box->arity);
+		if (n_params > (size_t)(l->end - l->ptr)) {
+			l->ok = false;
+			n_params = 0;
+		}
+		box->params = n_params == 0
+			? NULL
+			: xmalloc(n_params * sizeof *box->params);
+		for (size_t i = 0; i < n_params; i++) {
+			box->params[i] = get_expr(l);
+		}
+		box->body = get_expr(l);
+		box->env = retain_environment(get_env(l, l->n_envs));
+		l->ok &= box->env != NULL;
+		break;
+	}
+}
+
+// Decodes the image data. If it is invalid, gives up and leaks whatever it has
+// allocated so far, since partially initialized boxes cannot be released.
+static const char *read_image(
+		struct Loader *l, struct Root *out, uint64_t *tag) {
+	const char *magic = get_bytes(l, strlen(IMAGE_MAGIC));
+	if (!magic || memcmp(magic, IMAGE_MAGIC, strlen(IMAGE_MAGIC)) != 0
+			|| get_u32(l) != IMAGE_VERSION) {
+		return err_format;
+	}
+	if (get_u32(l) != N_EXPRESSION_TYPES
+			|| get_u32(l) != N_STANDARD_MACROS
+			|| get_u32(l) != N_STANDARD_PROCEDURES
+			|| get_u64(l) != standard_names_hash()) {
+		return err_build;
+	}
+	*tag = get_u64(l);
+	l->n_symbols = get_u32(l);
+	l->n_envs = get_u32(l);
+	l->n_boxes = get_u32(l);
+	uint32_t is_env = get_u32(l);
+	if (!l->ok || is_env > 1
+			|| l->n_symbols > (size_t)(l->end - l->ptr)
+			|| l->n_boxes > (size_t)(l->end - l->ptr)
+			|| l->n_envs > (size_t)(l->end - l->ptr)) {
+		return err_format;
+	}
+
+	// Intern the strings, and remember their new identifiers.
+	l->symbols = xmalloc(l->n_symbols * sizeof *l->symbols);
+	for (uint32_t i = 0; i < l->n_symbols; i++) {
+		uint32_t len = get_u32(l);
+		const char *str = get_bytes(l, len);
+		if (!str) {
+			return err_format;
+		}
+		l->symbols[i] = intern_string_n(str, len);
+	}
+
+	// Allocate all the boxes up front, since records refer to them by index.
+	l->kinds = get_bytes(l, l->n_boxes);
+	if (!l->kinds) {
+		return err_format;
+	}
+	l->boxes = xmalloc(l->n_boxes * sizeof *l->boxes);
+	for (uint32_t i = 0; i < l->n_boxes; i++) {
+		if ((unsigned char)l->kinds[i] > BOX_CLOSURE) {
+			return err_format;
+		}
+		l->boxes[i] = xmalloc(sizeof *l->boxes[i]);
+		l->boxes[i]->ref_count = 0;
+	}
+
+	// Create the environments. Their parents always come before them.
+	l->envs = xmalloc(l->n_envs * sizeof *l->envs);
+	for (uint32_t i = 0; i < l->n_envs; i++) {
+		struct Environment *parent = get_env(l, i);
+		uint32_t count = get_u32(l);
+		if (!l->ok) {
+			return err_format;
+		}
+		l->envs[i] = parent
+			? new_environment(parent, count)
+			: new_base_environment();
+		for (uint32_t j = 0; j < count && l->ok; j++) {
+			InternId key = get_u32(l);
+			struct Expression expr = get_expr(l);
+			if (key >= l->n_symbols) {
+				return err_format;
+			}
+			bind_variable(l->envs[i], l->symbols[key], expr);
+			// The binding retained the expression, so undo the reference
+			// counted by 'get_expr'.
+			if (expr.type >= E_PAIR) {
+				expr.box->ref_count--;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < l->n_boxes && l->ok; i++) {
+		read_box(l, l->boxes[i], (enum BoxKind)l->kinds[i]);
+		count_allocation(box_expression(
+				l->boxes[i], (enum BoxKind)l->kinds[i]));
+	}
+	// Reading the root gives the caller its own reference.
+	out->is_env = is_env;
+	if (is_env) {
+		out->env = retain_environment(get_env(l, l->n_envs));
+		l->ok &= out->env != NULL;
+	} else {
+		out->expr = get_expr(l);
+	}
+	if (!l->ok || l->ptr != l->end) {
+		return err_format;
+	}
+
+	// Each environment was created with a reference count of 1 on behalf of
+	// the loader, which no longer needs it.
+	for (uint32_t i = 0; i < l->n_envs; i++) {
+		release_environment(l->envs[i]);
+	}
+	return NULL;
+}
+
+// Loads an image with a root of the expected kind.
+static const char *load_root(
+		const char *filename, bool is_env, struct Root *out, uint64_t *tag) {
+	struct FileContents contents;
+	if (!map_file(filename, &contents)) {
+		return strerror(errno);
+	}
+	struct Loader l = {
+		.ptr = contents.data,
+		.end = contents.data + contents.length,
+		.ok = true
+	};
+	const char *err = read_image(&l, out, tag);
+	if (!err && out->is_env != is_env) {
+		err = is_env ? err_root_expr : err_root_env;
+		if (is_env) {
+			release_expression(out->expr);
+		} else {
+			release_environment(out->env);
+		}
+	}
+	free(l.symbols);
+	free(l.envs);
+	free(l.boxes);
+	unmap_file(contents);
+	return err;
+}
+
+const char *load_image(
+		const char *filename, struct Environment **out, uint64_t *tag) {
+	struct Root root;
+	const char *err = load_root(filename, true, &root, tag);
+	if (!err) {
+		*out = root.env;
+	}
+	return err;
+}
+
+const char *load_expression_image(
+		const char *filename, struct Expression *out, uint64_t *tag) {
+	struct Root root;
+	const char *err = load_root(filename, false, &root, tag);
+	if (!err) {
+		*out = root.expr;
+	}
+	return err;
+}
@@ -0,0 +1,40 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "expr.h"
+
+#include <stdint.h>
+
+struct Environment;
+
+// An image is a snapshot of an environment, and everything reachable from it,
+// in a binary file. This includes parent environments, the boxes of all bound
+// expressions, the environments captured by procedures, and the names of the
+// symbols they use. Pointers are stored as indices into tables of boxes and
+// environments, so an image can be loaded at any address. Images are specific
+// to the build of Eva that saved them.
+//
+// Every image has a 64-bit tag chosen by the program that saved it. Eva uses a
+// hash of the prelude source, so that stale prelude images are not used.
+
+// Saves an image of 'env' to the file 'filename', with the given tag. Returns
+// NULL on success. Otherwise, returns an error message. Ports cannot be saved.
+const char *save_image(
+		const char *filename, struct Environment *env, uint64_t tag);
+
+// Loads an image from the file 'filename'. On success, stores the environment
+// in 'out' with a reference count of 1, stores the tag in 'tag', and returns
+// NULL. Otherwise, returns an error message.
+const char *load_image(
+		const char *filename, struct Environment **out, uint64_t *tag);
+
+// Like 'save_image' and 'load_image', but for an image of a single expression
+// instead of an environment. The loaded expression is owned by the caller.
+const char *save_expression_image(
+		const char *filename, struct Expression expr, uint64_t tag);
+const char *load_expression_image(
+		const char *filename, struct Expression *out, uint64_t *tag);
+
+#endif
@@ -1,85 +1,263 @@
 // Copyright 2016 Mitchell Kember. Subject to the MIT License.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "intern.h"
 
+#include "context.h"
+#include "parallel.h"
 #include "util.h"
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Constants for the intern table.
-#define TABLE_SIZE_BITS 10
-#define TABLE_SIZE (1 << TABLE_SIZE_BITS)
-#define DEFAULT_BUCKET_CAP 16
-#define HASH_SEED 5381
-
-// A bucket is a dynamic array of strings. It begins with a default capacity,
-// and it doubles its capacity every time the length would exceed it.
-struct Bucket {
+#define DEFAULT_TABLE_CAP 1024
+#define DEFAULT_STRINGS_CAP 1024
+#define ARENA_SIZE (1 << 16)
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+// Marks a slot in the table that has never been used.
+#define EMPTY_SLOT UINT32_MAX
+
+// A slot in the intern table refers to an interned string by its identifier.
+// It also stores the full hash and the length of the string, so that most
+// mismatches can be rejected without looking at the string itself.
+struct Slot {
+	uint32_t hash;
+	uint32_t length;
+	InternId id;
+};
+
+// The intern table of each context is an open-addressing hash table with
+// linear probing, stored in the 'slots' array. Its capacity is a power of two,
+// and it doubles whenever it becomes half full. Since slots store the hashes,
+// growing the table does not require hashing the strings again. Intern
+// identifiers are indices into a separate 'strings' array, which only grows at
+// the end, so looking up a string is a single memory access no matter how many
+// strings have been interned.
+
+// While parallel operations are running, worker threads share the intern table
+// of their context. Lookups then take this lock for reading, and insertions
+// take it for writing. It is shared by all contexts, since only one of them can
+// be running a parallel operation at a time.
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// An arena is a large block of memory that interned strings are appended to.
+// Each entry consists of the string's length (a uint32_t), the characters, and
+// a null terminator, padded so that the next length is aligned. Strings are
+// never freed individually, so arenas are only freed along with the whole table.
+// A string that is too long to share an arena gets one of its own.
+struct Arena {
+	struct Arena *next;
+	size_t used;
 	size_t cap;
-	size_t len;
-	const char **strings;
+	char data[];
 };
 
-// The intern table for the program is a static array of buckets. The number of
-// buckets is fixed so that the index into the bucket can be encoded into the
-// intern identifier. This means looking up a string is a single memory access.
-// The downside to this is that interning new strings slows down over time,
-// because we have to compare with more strings when checking if the string has
-// already been interned.
-static struct Bucket table[TABLE_SIZE];
+// The context's 'arena' is the one currently being filled, which is the head of
+// the list of arenas.
+
+// Allocates a new arena with room for 'cap' bytes.
+static struct Arena *new_arena(size_t cap) {
+	struct EvaContext *ctx = current_context;
+	struct Arena *new = xmalloc(sizeof *new + cap);
+	new->next = NULL;
+	new->used = 0;
+	new->cap = cap;
+	ctx->intern.arena_count++;
+	ctx->intern.arena_bytes += cap;
+	return new;
+}
+
+// Allocates 'size' bytes from the current arena, starting a new arena if it
+// does not have enough room.
+static char *arena_alloc(size_t size) {
+	struct EvaContext *ctx = current_context;
+	struct Arena *arena = ctx->intern.arena;
+	ctx->intern.arena_used += size;
+	if (size > ARENA_SIZE / 4) {
+		// Give a long string its own arena, and keep filling the current one.
+		struct Arena *big = new_arena(size);
+		big->used = size;
+		if (arena) {
+			big->next = arena->next;
+			arena->next = big;
+		} else {
+			ctx->intern.arena = big;
+		}
+		return big->data;
+	}
+	if (!arena || arena->cap - arena->used < size) {
+		struct Arena *new = new_arena(ARENA_SIZE);
+		new->next = arena;
+		arena = ctx->intern.arena = new;
+	}
+	char *ptr = arena->data + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
+// Copies a string of 'n' characters into an arena, and returns a pointer to the
+// null-terminated copy. The length is stored just before the characters.
+static const char *arena_copy(const char *str, size_t n) {
+	const size_t align = sizeof(uint32_t);
+	size_t size = (sizeof(uint32_t) + n + 1 + align - 1) & ~(align - 1);
+	char *entry = arena_alloc(size);
+	*(uint32_t *)entry = (uint32_t)n;
+	char *copy = entry + sizeof(uint32_t);
+	memcpy(copy, str, n);
+	copy[n] = '\0';
+	current_context->intern.string_bytes += n;
+	return copy;
+}
+
+// Returns the 32-bit FNV-1a hash of a string of 'n' characters.
+static uint32_t hash_string(const char *str, size_t n) {
+	uint32_t h = FNV_OFFSET_BASIS;
+	for (size_t i = 0; i < n; i++) {
+		h ^= (unsigned char)str[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+// Allocates a table with 'cap' slots, and inserts all the old slots into it.
+static void resize_table(size_t cap) {
+	struct EvaContext *ctx = current_context;
+	struct Slot *slots = ctx->intern.slots;
+	struct Slot *new_slots = xmalloc(cap * sizeof *new_slots);
+	memset(new_slots, 0xff, cap * sizeof *new_slots);
+	size_t mask = cap - 1;
+	for (size_t i = 0; i < ctx->intern.slots_cap; i++) {
+		if (slots[i].id == EMPTY_SLOT) {
+			continue;
+		}
+		size_t j = slots[i].hash & mask;
+		while (new_slots[j].id != EMPTY_SLOT) {
+			j = (j + 1) & mask;
+		}
+		new_slots[j] = slots[i];
+	}
+	free(slots);
+	ctx->intern.slots = new_slots;
+	ctx->intern.slots_cap = cap;
+}
 
 InternId intern_string(const char *str) {
 	return intern_string_n(str, strlen(str));
 }
 
-InternId intern_string_n(const char *str, size_t n) {
-	// Calculate the hash value of the string.
-	InternId h = HASH_SEED;
-	for (size_t i = 0; i < n; i++) {
-		h ^= (h << 5) + (h >> 2) + (InternId)str[i];
+// Returns the slot in the table that holds the string of 'n' characters with
+// hash 'h', or the empty slot where it belongs if it has not been interned.
+static struct Slot *find_slot(const char *str, size_t n, uint32_t h) {
+	struct EvaContext *ctx = current_context;
+	struct Slot *slots = ctx->intern.slots;
+	const char **strings = ctx->intern.strings;
+	size_t mask = ctx->intern.slots_cap - 1;
+	size_t i = h & mask;
+	for (; slots[i].id != EMPTY_SLOT; i = (i + 1) & mask) {
+		if (slots[i].hash == h && slots[i].length == n
+				&& memcmp(strings[slots[i].id], str, n) == 0) {
+			break;
+		}
 	}
-	h %= TABLE_SIZE;
-
-	// Look up the bucket. Initialize it if it is empty.
-	struct Bucket *bucket = table + h;
-	if (!bucket->strings) {
-		bucket->cap = DEFAULT_BUCKET_CAP;
-		bucket->len = 0;
-		bucket->strings = xmalloc(DEFAULT_BUCKET_CAP * sizeof *bucket->strings);
+	return slots + i;
+}
+
+// Interns a string of 'n' characters with hash 'h'.
+static InternId insert_string(const char *str, size_t n, uint32_t h) {
+	struct EvaContext *ctx = current_context;
+
+	// Keep the table at most half full, so that probe sequences stay short.
+	size_t cap = ctx->intern.slots_cap;
+	if (2 * (ctx->intern.strings_len + 1) > cap) {
+		resize_table(cap == 0 ? DEFAULT_TABLE_CAP : cap * 2);
 	}
 
 	// Check if the same string has already been interned.
-	for (size_t i = 0; i < bucket->len; i++) {
-		if (strncmp(str, bucket->strings[i], n) == 0) {
-			return (InternId)(i << TABLE_SIZE_BITS) | h;
-		}
+	struct Slot *slot = find_slot(str, n, h);
+	if (slot->id != EMPTY_SLOT) {
+		return slot->id;
+	}
+
+	// Double the capacity of the strings array if necessary.
+	if (ctx->intern.strings_len == ctx->intern.strings_cap) {
+		size_t strings_cap = ctx->intern.strings_cap;
+		strings_cap = strings_cap == 0 ? DEFAULT_STRINGS_CAP : strings_cap * 2;
+		ctx->intern.strings = xrealloc(
+				ctx->intern.strings, strings_cap * sizeof *ctx->intern.strings);
+		ctx->intern.strings_cap = strings_cap;
 	}
-	
-	// Double the array's capacity if necessary.
-	if (bucket->len >= bucket->cap) {
-		bucket->cap *= 2;
-		bucket->strings = xrealloc(bucket->strings,
-				bucket->cap * sizeof *bucket->strings);
+
+	// Copy the string into an arena, and add it to the array and the table.
+	InternId id = (InternId)ctx->intern.strings_len++;
+	ctx->intern.strings[id] = arena_copy(str, n);
+	*slot = (struct Slot){ .hash = h, .length = (uint32_t)n, .id = id };
+	return id;
+}
+
+InternId intern_string_n(const char *str, size_t n) {
+	uint32_t h = hash_string(str, n);
+	if (!parallel_active()) {
+		return insert_string(str, n, h);
 	}
 
-	// Copy the string and add a null terminator.
-	char *new_str = xmalloc(n + 1);
-	strncpy(new_str, str, n);
-	new_str[n] = '\0';
-	// Add the string to the bucket.
-	size_t pos = bucket->len;
-	bucket->strings[pos] = new_str;
-	// Update the count.
-	bucket->len++;
-
-	// Create an intern ID by combining the position bits and hash bits.
-	return (InternId)(pos << TABLE_SIZE_BITS) | h;
+	// Most strings have already been interned, so look for the string with the
+	// lock shared before taking it exclusively to insert it.
+	InternId id = EMPTY_SLOT;
+	pthread_rwlock_rdlock(&table_lock);
+	if (current_context->intern.slots_cap > 0) {
+		id = find_slot(str, n, h)->id;
+	}
+	pthread_rwlock_unlock(&table_lock);
+	if (id == EMPTY_SLOT) {
+		pthread_rwlock_wrlock(&table_lock);
+		id = insert_string(str, n, h);
+		pthread_rwlock_unlock(&table_lock);
+	}
+	return id;
 }
 
 const char *find_string(InternId id) {
-	// Decode the hash value and the position.
-	size_t h = id & (TABLE_SIZE - 1);
-	size_t pos = id >> TABLE_SIZE_BITS;
-	// Look up the interned string.
-	return table[h].strings[pos];
+	if (!parallel_active()) {
+		return current_context->intern.strings[id];
+	}
+	// The strings never move, but the array of pointers to them can.
+	pthread_rwlock_rdlock(&table_lock);
+	const char *str = current_context->intern.strings[id];
+	pthread_rwlock_unlock(&table_lock);
+	return str;
+}
+
+size_t find_string_length(InternId id) {
+	return ((const uint32_t *)find_string(id))[-1];
+}
+
+struct InternStats intern_stats(void) {
+	struct EvaContext *ctx = current_context;
+	return (struct InternStats){
+		.count = ctx->intern.strings_len,
+		.string_bytes = ctx->intern.string_bytes,
+		.arena_count = ctx->intern.arena_count,
+		.arena_bytes = ctx->intern.arena_bytes,
+		.arena_used = ctx->intern.arena_used,
+		.table_bytes = ctx->intern.slots_cap * sizeof *ctx->intern.slots
+			+ ctx->intern.strings_cap * sizeof *ctx->intern.strings
+	};
+}
+
+void free_intern_table(void) {
+	struct EvaContext *ctx = current_context;
+	struct Arena *arena = ctx->intern.arena;
+	while (arena) {
+		struct Arena *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+	free(ctx->intern.slots);
+	free(ctx->intern.strings);
+	memset(&ctx->intern, 0, sizeof ctx->intern);
 }
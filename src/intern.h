@@ -6,7 +6,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
-// An InternId is a unique identifier for an interned string.
+// An InternId is a unique identifier for an interned string. Identifiers are
+// assigned consecutively, starting from zero.
 typedef uint32_t InternId;
 
 // Interns the string and returns its unique identifier.
@@ -20,4 +21,25 @@ InternId intern_string_n(const char *str, size_t n);
 // from 'intern_string' or 'intern_string_n' (this is not checked).
 const char *find_string(InternId id);
 
+// Returns the length of the string identified by 'id'. This is stored with the
+// string, so it takes constant time.
+size_t find_string_length(InternId id);
+
+// InternStats describes the memory used by interned strings.
+struct InternStats {
+	size_t count;        // number of interned strings
+	size_t string_bytes; // total length of the strings
+	size_t arena_count;  // number of arenas
+	size_t arena_bytes;  // total capacity of the arenas
+	size_t arena_used;   // arena bytes used, including lengths and padding
+	size_t table_bytes;  // memory used by the hash table and identifier array
+};
+
+// Returns statistics about the intern table.
+struct InternStats intern_stats(void);
+
+// Frees all the interned strings. Identifiers returned before this must not be
+// used again. Called by 'free_context'.
+void free_intern_table(void);
+
 #endif
@@ -0,0 +1,280 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "jobs.h"
+
+#include "env.h"
+#include "error.h"
+#include "parallel.h"
+#include "repl.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Error message used when a worker exits without finishing its file.
+static const char *const err_worker_died = "Worker process terminated";
+
+// A worker reports each file it runs with a Header, followed by 'length' bytes
+// of output.
+struct Header {
+	uint32_t index;
+	uint32_t success;
+	uint64_t length;
+};
+
+// A worker process. The parent sends it indices of files to run on 'cmd_fd',
+// and reads the results from 'result_fd'. 'task' is the index of the file it
+// is running, or -1 if it is idle.
+struct Worker {
+	pid_t pid;
+	int cmd_fd;
+	int result_fd;
+	long task;
+};
+
+// The result of a file, which is kept until the results of all the files
+// before it have been written. If the worker running it died, 'died' is true
+// and there is no output.
+struct Result {
+	bool done;
+	bool success;
+	bool died;
+	char *output;
+	size_t length;
+};
+
+// Runs one file with its output going to a temporary file, and sends the
+// header and the output to 'result_fd'.
+static void run_task(
+		char **files, uint32_t index, struct Environment *env, int result_fd) {
+	FILE *out = tmpfile();
+	if (!out) {
+		perror("FATAL");
+		_exit(2);
+	}
+	dup2(fileno(out), STDOUT_FILENO);
+	dup2(fileno(out), STDERR_FILENO);
+	struct Environment *script_env = new_environment(env, 0);
+	bool success = execute_file(files[index], script_env);
+	release_environment(script_env);
+	fflush(stdout);
+	fflush(stderr);
+
+	off_t length = lseek(fileno(out), 0, SEEK_END);
+	struct Header header = {
+		.index = index,
+		.success = success,
+		.length = length > 0 ? (uint64_t)length : 0
+	};
+	write_exactly(result_fd, &header, sizeof header);
+	char buf[8192];
+	for (off_t offset = 0; offset < length;) {
+		ssize_t n = pread(fileno(out), buf, sizeof buf, offset);
+		if (n <= 0) {
+			break;
+		}
+		write_exactly(result_fd, buf, (size_t)n);
+		offset += n;
+	}
+	fclose(out);
+}
+
+// Main loop of a worker process. Runs files until 'cmd_fd' is closed.
+static void worker_main(
+		char **files, struct Environment *env, int cmd_fd, int result_fd) {
+	int null_fd = open("/dev/null", O_RDONLY);
+	if (null_fd != -1) {
+		dup2(null_fd, STDIN_FILENO);
+		close(null_fd);
+	}
+	uint32_t index;
+	while (read_exactly(cmd_fd, &index, sizeof index)) {
+		run_task(files, index, env, result_fd);
+	}
+	_exit(0);
+}
+
+// Forks a worker process. Returns false on failure.
+static bool start_worker(struct Worker *worker, struct Worker *workers,
+		size_t n_workers, char **files, struct Environment *env) {
+	int cmd[2], result[2];
+	if (pipe(cmd) == -1) {
+		return false;
+	}
+	if (pipe(result) == -1) {
+		close(cmd[0]);
+		close(cmd[1]);
+		return false;
+	}
+	// Flush buffered output so that the worker does not write it again.
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == -1) {
+		close(cmd[0]);
+		close(cmd[1]);
+		close(result[0]);
+		close(result[1]);
+		return false;
+	}
+	if (pid == 0) {
+		reset_threads_after_fork();
+		// Close the ends that belong to the parent, including those of the
+		// other workers, so that they see EOF when the parent closes them.
+		for (size_t i = 0; i < n_workers; i++) {
+			if (&workers[i] != worker && workers[i].pid > 0) {
+				close(workers[i].cmd_fd);
+				close(workers[i].result_fd);
+			}
+		}
+		close(cmd[1]);
+		close(result[0]);
+		worker_main(files, env, cmd[0], result[1]);
+	}
+	close(cmd[0]);
+	close(result[1]);
+	worker->pid = pid;
+	worker->cmd_fd = cmd[1];
+	worker->result_fd = result[0];
+	worker->task = -1;
+	return true;
+}
+
+// Closes the pipes of a worker and waits for it to exit.
+static void stop_worker(struct Worker *worker) {
+	close(worker->cmd_fd);
+	close(worker->result_fd);
+	waitpid(worker->pid, NULL, 0);
+	worker->pid = 0;
+	worker->task = -1;
+}
+
+// Sends the next file to an idle worker, or stops it if there are none left.
+static void assign_task(struct Worker *worker, size_t *next, size_t n) {
+	if (*next == n) {
+		stop_worker(worker);
+		return;
+	}
+	uint32_t index = (uint32_t)*next;
+	(*next)++;
+	worker->task = (long)index;
+	// If this fails, the worker died, and the parent finds out when it polls
+	// the result pipe.
+	write_exactly(worker->cmd_fd, &index, sizeof index);
+}
+
+// Reads a result from a worker. Returns false if the worker died instead.
+static bool read_result(struct Worker *worker, struct Result *results) {
+	struct Header header;
+	if (!read_exactly(worker->result_fd, &header, sizeof header)) {
+		return false;
+	}
+	struct Result *result = &results[header.index];
+	result->output = xmalloc(header.length);
+	if (!read_exactly(worker->result_fd, result->output, header.length)) {
+		free(result->output);
+		result->output = NULL;
+		return false;
+	}
+	result->length = header.length;
+	result->success = header.success;
+	result->done = true;
+	worker->task = -1;
+	return true;
+}
+
+bool run_jobs(char **files, size_t n, size_t jobs, struct Environment *env) {
+	if (n == 0) {
+		return true;
+	}
+	if (jobs > n) {
+		jobs = n;
+	}
+	// Writing to a worker that died must not kill the parent.
+	struct sigaction ignore = { .sa_handler = SIG_IGN }, old_action;
+	sigemptyset(&ignore.sa_mask);
+	sigaction(SIGPIPE, &ignore, &old_action);
+
+	struct Worker *workers = xcalloc(jobs, sizeof *workers);
+	struct Result *results = xcalloc(n, sizeof *results);
+	struct pollfd *fds = xmalloc(jobs * sizeof *fds);
+	size_t next = 0;
+	size_t written = 0;
+	bool success = true;
+	for (size_t i = 0; i < jobs; i++) {
+		if (!start_worker(&workers[i], workers, jobs, files, env)) {
+			perror("FATAL");
+			exit(2);
+		}
+		assign_task(&workers[i], &next, n);
+	}
+
+	while (written < n) {
+		for (size_t i = 0; i < jobs; i++) {
+			fds[i].fd = workers[i].pid > 0 ? workers[i].result_fd : -1;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if (poll(fds, jobs, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("FATAL");
+			exit(2);
+		}
+		for (size_t i = 0; i < jobs; i++) {
+			struct Worker *worker = &workers[i];
+			if (worker->pid <= 0 || fds[i].revents == 0) {
+				continue;
+			}
+			if (!read_result(worker, results)) {
+				// The worker died. Fail its file, and replace it.
+				long task = worker->task;
+				stop_worker(worker);
+				if (task >= 0) {
+					results[task].done = true;
+					results[task].died = true;
+				}
+				if (next == n) {
+					continue;
+				}
+				if (!start_worker(worker, workers, jobs, files, env)) {
+					perror("FATAL");
+					exit(2);
+				}
+			}
+			assign_task(worker, &next, n);
+		}
+		// Write the results that are next in order.
+		for (; written < n && results[written].done; written++) {
+			struct Result *result = &results[written];
+			if (result->died) {
+				fflush(stdout);
+				print_error(files[written], err_worker_died);
+				success = false;
+				continue;
+			}
+			fwrite(result->output, 1, result->length, stdout);
+			free(result->output);
+			success = success && result->success;
+		}
+	}
+
+	fflush(stdout);
+	free(fds);
+	free(results);
+	free(workers);
+	sigaction(SIGPIPE, &old_action, NULL);
+	return success;
+}
@@ -0,0 +1,20 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Environment;
+
+// Runs the 'n' files in 'files' on 'jobs' worker processes, which are forked
+// from the calling process and share its memory copy-on-write, so they start
+// with 'env' already set up. Each file is executed in a new child environment
+// of 'env', with standard input redirected from /dev/null. The output of each
+// file (standard output and standard error together) is written to standard
+// output in the order of the files, regardless of the order they finish in.
+// Returns true if all of them succeeded.
+bool run_jobs(char **files, size_t n, size_t jobs, struct Environment *env);
+
+#endif
@@ -0,0 +1,267 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "load.h"
+
+#include "context.h"
+#include "error.h"
+#include "eval.h"
+#include "expr.h"
+#include "image.h"
+#include "parse.h"
+#include "repl.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Extension appended to a filename to get the name of its disk cache file.
+#define DISK_CACHE_EXT ".evc"
+
+// Initial capacity of the cache array.
+#define DEFAULT_CACHE_CAP 16
+
+// An entry in the cache holds the top-level forms of a file as a list, together
+// with the modification time and size the file had when it was parsed.
+struct CacheEntry {
+	char *filename;
+	struct timespec mtime;
+	off_t size;
+	struct Expression forms;
+};
+
+// The cache of each context is a dynamic array of entries. Programs load few
+// distinct files, so it is searched linearly. Worker threads of parallel
+// operations and futures share the context of their caller, so the cache and
+// the statistics are only accessed with 'cache_lock' held. Executing the forms
+// happens outside the lock, since it can load other files.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool disk_cache = false;
+
+void set_disk_cache(bool enabled) {
+	disk_cache = enabled;
+}
+
+struct LoadStats load_stats(void) {
+	pthread_mutex_lock(&cache_lock);
+	struct LoadStats stats = current_context->load.stats;
+	pthread_mutex_unlock(&cache_lock);
+	return stats;
+}
+
+void free_load_cache(void) {
+	struct EvaContext *ctx = current_context;
+	for (size_t i = 0; i < ctx->load.cache_len; i++) {
+		free(ctx->load.cache[i].filename);
+		release_expression(ctx->load.cache[i].forms);
+	}
+	free(ctx->load.cache);
+	ctx->load.cache = NULL;
+	ctx->load.cache_len = ctx->load.cache_cap = 0;
+}
+
+// Returns a tag identifying the version of a file, for use in disk cache images.
+static uint64_t file_tag(const struct stat *st) {
+	uint64_t values[] = {
+		(uint64_t)st->st_mtim.tv_sec,
+		(uint64_t)st->st_mtim.tv_nsec,
+		(uint64_t)st->st_size
+	};
+	uint64_t h = 14695981039346656037u;
+	for (size_t i = 0; i < sizeof values / sizeof *values; i++) {
+		for (size_t j = 0; j < sizeof *values; j++) {
+			h ^= (values[i] >> (8 * j)) & 0xff;
+			h *= 1099511628211u;
+		}
+	}
+	return h;
+}
+
+// Returns the cache entry for 'filename', or NULL if there is none.
+static struct CacheEntry *find_entry(const char *filename) {
+	struct CacheEntry *cache = current_context->load.cache;
+	for (size_t i = 0; i < current_context->load.cache_len; i++) {
+		if (strcmp(cache[i].filename, filename) == 0) {
+			return cache + i;
+		}
+	}
+	return NULL;
+}
+
+// Stores the forms in the cache entry for 'filename', replacing the old forms if
+// there is already an entry. Takes ownership of 'forms'.
+static void store_entry(
+		const char *filename, const struct stat *st, struct Expression forms) {
+	struct CacheEntry *entry = find_entry(filename);
+	if (entry) {
+		release_expression(entry->forms);
+	} else {
+		struct EvaContext *ctx = current_context;
+		if (ctx->load.cache_len == ctx->load.cache_cap) {
+			size_t cap = ctx->load.cache_cap;
+			cap = cap == 0 ? DEFAULT_CACHE_CAP : cap * 2;
+			ctx->load.cache = xrealloc(ctx->load.cache, cap * sizeof *entry);
+			ctx->load.cache_cap = cap;
+		}
+		entry = ctx->load.cache + ctx->load.cache_len++;
+		size_t len = strlen(filename);
+		entry->filename = xmalloc(len + 1);
+		memcpy(entry->filename, filename, len + 1);
+	}
+	entry->mtime = st->st_mtim;
+	entry->size = st->st_size;
+	entry->forms = forms;
+}
+
+// Parses all the top-level forms in 'text' into a list. On success, stores the
+// list in 'out' and returns true. Returns false if there is a parse error.
+static bool parse_forms(
+		const char *text, size_t length, struct Expression *out) {
+	struct Expression forms = new_null();
+	struct Box *last = NULL;
+	size_t offset = skip_shebang(text, length);
+	while (offset < length) {
+		struct ParseResult result = parse_n(text + offset, length - offset);
+		if (result.err_type != PARSE_SUCCESS) {
+			release_expression(forms);
+			return false;
+		}
+		struct Expression pair = new_pair(result.expr, new_null());
+		if (last) {
+			last->cdr = pair;
+		} else {
+			forms = pair;
+		}
+		last = pair.box;
+		offset += result.chars_read;
+	}
+	*out = forms;
+	return true;
+}
+
+// Returns a copy of parsed code that shares no pairs or strings with 'code', so
+// that mutating literals or rewriting the copy leaves the original intact.
+static struct Expression copy_code(struct Expression code) {
+	switch (code.type) {
+	case E_STRING:;
+		char *str = NULL;
+		if (code.box->len > 0) {
+			str = xmalloc(code.box->len);
+			memcpy(str, code.box->str, code.box->len);
+		}
+		return new_string(str, code.box->len);
+	case E_PAIR:;
+		struct Expression copy = new_null();
+		struct Box *last = NULL;
+		for (; code.type == E_PAIR; code = code.box->cdr) {
+			struct Expression pair =
+				new_pair(copy_code(code.box->car), new_null());
+			if (last) {
+				last->cdr = pair;
+			} else {
+				copy = pair;
+			}
+			last = pair.box;
+		}
+		last->cdr = copy_code(code);
+		return copy;
+	default:
+		return retain_expression(code);
+	}
+}
+
+// Evaluates a list of forms in 'env'. Upon encountering an error, prints an
+// error message and returns false. Otherwise, returns true.
+static bool execute_forms(
+		const char *filename, struct Expression forms, struct Environment *env) {
+	for (; forms.type == E_PAIR; forms = forms.box->cdr) {
+		struct EvalResult result = eval(forms.box->car, env, true);
+		if (result.err) {
+			print_eval_error(filename, result.err);
+			free_eval_error(result.err);
+			return false;
+		}
+		release_expression(result.expr);
+	}
+	return true;
+}
+
+bool load_file(const char *filename, struct Environment *env) {
+	struct stat st;
+	if (stat(filename, &st) == -1) {
+		return false;
+	}
+	struct LoadStats *stats = &current_context->load.stats;
+	pthread_mutex_lock(&cache_lock);
+	stats->loads++;
+
+	struct Expression forms;
+	struct CacheEntry *entry = find_entry(filename);
+	if (entry && entry->size == st.st_size
+			&& entry->mtime.tv_sec == st.st_mtim.tv_sec
+			&& entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+		stats->memory_hits++;
+		forms = copy_code(entry->forms);
+		pthread_mutex_unlock(&cache_lock);
+		execute_forms(filename, forms, env);
+		release_expression(forms);
+		return true;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	uint64_t tag = file_tag(&st);
+	char *cache_filename = NULL;
+	bool from_disk = false;
+	if (disk_cache) {
+		size_t len = strlen(filename);
+		cache_filename = xmalloc(len + sizeof DISK_CACHE_EXT);
+		memcpy(cache_filename, filename, len);
+		memcpy(cache_filename + len, DISK_CACHE_EXT, sizeof DISK_CACHE_EXT);
+		uint64_t cache_tag;
+		if (!load_expression_image(cache_filename, &forms, &cache_tag)) {
+			from_disk = cache_tag == tag;
+			if (!from_disk) {
+				release_expression(forms);
+			}
+		}
+	}
+
+	if (!from_disk) {
+		struct FileContents contents;
+		if (!map_file(filename, &contents)) {
+			free(cache_filename);
+			return false;
+		}
+		if (!parse_forms(contents.data, contents.length, &forms)) {
+			// Execute the file without caching it, so that the forms before
+			// the parse error run and the error is reported as usual.
+			execute(filename, contents.data, contents.length, env, false);
+			unmap_file(contents);
+			free(cache_filename);
+			return true;
+		}
+		unmap_file(contents);
+	}
+
+	// Save the forms before executing them, since executing can mutate their
+	// literals. Failing to save is not an error.
+	if (cache_filename && !from_disk) {
+		save_expression_image(cache_filename, forms, tag);
+	}
+	free(cache_filename);
+	struct Expression copy = copy_code(forms);
+	pthread_mutex_lock(&cache_lock);
+	if (from_disk) {
+		stats->disk_hits++;
+	}
+	store_entry(filename, &st, forms);
+	pthread_mutex_unlock(&cache_lock);
+	execute_forms(filename, copy, env);
+	release_expression(copy);
+	return true;
+}
@@ -0,0 +1,39 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Environment;
+
+// LoadStats counts how 'load_file' got the code for each file.
+struct LoadStats {
+	size_t loads;       // number of calls to 'load_file'
+	size_t memory_hits; // code reused from the in-memory cache
+	size_t disk_hits;   // code read from an on-disk cache file
+};
+
+// Enables or disables the on-disk cache (disabled by default). When enabled,
+// the parsed code of a loaded file is saved as an image next to the source,
+// with the extension ".evc" appended, and later runs use it instead of parsing
+// the source again.
+void set_disk_cache(bool enabled);
+
+// Executes the Scheme file 'filename' in 'env', like 'execute'. The parsed code
+// is cached in memory, keyed by the path together with the file's modification
+// time and size, so loading the same unchanged file again skips reading and
+// parsing it. Each load executes a fresh copy of the cached code, so literals
+// mutated by one load do not affect the next. Returns false if the file could
+// not be opened (and sets the global 'errno'). Otherwise, returns true, even if
+// executing failed.
+bool load_file(const char *filename, struct Environment *env);
+
+// Returns statistics about loading files in the current context.
+struct LoadStats load_stats(void);
+
+// Empties the in-memory cache. Called by 'free_context'.
+void free_load_cache(void);
+
+#endif
@@ -5,6 +5,9 @@
 #include "env.h"
 #include "error.h"
 #include "list.h"
+#include "future.h"
+#include "module.h"
+#include "timing.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -13,12 +16,23 @@
 typedef struct EvalResult (*Implementation)(
 		struct Expression *args, size_t n, struct Environment *env);
 
+// Names an anonymous procedure or macro after the variable it is being bound
+// to, so that it can be identified in profiles.
+static void name_procedure(struct Expression expr, InternId name) {
+	if ((expr.type == E_PROCEDURE || expr.type == E_MACRO)
+			&& expr.box->name == ANONYMOUS) {
+		expr.box->name = name;
+	}
+}
+
 static struct EvalResult f_define(
 		struct Expression *args, size_t n, struct Environment *env) {
 	(void)n;
 	struct EvalResult result = eval(args[1], env, false);
 	if (!result.err) {
-		bind(env, args[0].symbol_id, result.expr);
+		name_procedure(result.expr, args[0].symbol_id);
+		bind_variable(env, args[0].symbol_id, result.expr);
+		release_expression(result.expr);
 	}
 	result.expr = new_void();
 	return result;
@@ -36,7 +50,7 @@ static struct EvalResult f_set(
 		result = eval(args[1], env, false);
 		if (!result.err) {
 			release_expression(*ptr);
-			*ptr = retain_expression(result.expr);
+			*ptr = result.expr;
 		}
 	} else {
 		result.err = new_eval_error_symbol(ERR_UNBOUND_VAR, key);
@@ -131,7 +145,8 @@ static struct EvalResult f_let(
 		if (result.err) {
 			break;
 		}
-		bind(aug, id, result.expr);
+		name_procedure(result.expr, id);
+		bind_variable(aug, id, result.expr);
 		release_expression(result.expr);
 		list = list.box->cdr;
 	}
@@ -159,7 +174,8 @@ static struct EvalResult f_let_star(
 		if (result.err) {
 			break;
 		}
-		bind(aug, id, result.expr);
+		name_procedure(result.expr, id);
+		bind_variable(aug, id, result.expr);
 		release_expression(result.expr);
 		list = list.box->cdr;
 	}
@@ -206,6 +222,42 @@ static struct EvalResult f_or(
 	return result;
 }
 
+static struct EvalResult f_define_module(
+		struct Expression *args, size_t n, struct Environment *env) {
+	(void)env;
+	return define_module(args[0].symbol_id, args[1], args + 2, n - 2);
+}
+
+static struct EvalResult f_import(
+		struct Expression *args, size_t n, struct Environment *env) {
+	for (size_t i = 0; i < n; i++) {
+		struct EvalResult result = import_module(args[i].symbol_id, env);
+		if (result.err) {
+			return result;
+		}
+		release_expression(result.expr);
+	}
+	return (struct EvalResult){ .expr = new_void(), .err = NULL };
+}
+
+static struct EvalResult f_time(
+		struct Expression *args, size_t n, struct Environment *env) {
+	(void)n;
+	struct Timing start = timing_now();
+	struct EvalResult result = eval(args[0], env, false);
+	print_timing(timing_since(start));
+	return result;
+}
+
+static struct EvalResult f_future(
+		struct Expression *args, size_t n, struct Environment *env) {
+	(void)n;
+	return (struct EvalResult){
+		.expr = new_future(spawn_future(args[0], env)),
+		.err = NULL
+	};
+}
+
 // A mapping from standard macros to their implementations.
 static const Implementation implementation_table[N_STANDARD_PROCEDURES] = {
 	[F_DEFINE]           = f_define,
@@ -222,6 +274,10 @@ static const Implementation implementation_table[N_STANDARD_PROCEDURES] = {
 	[F_LET_STAR]         = f_let_star,
 	[F_AND]              = f_and,
 	[F_OR]               = f_or,
+	[F_DEFINE_MODULE]    = f_define_module,
+	[F_IMPORT]           = f_import,
+	[F_TIME]             = f_time,
+	[F_FUTURE]           = f_future,
 };
 
 struct EvalResult invoke_stdmacro(
@@ -1,14 +1,25 @@
 // Copyright 2016 Mitchell Kember. Subject to the MIT License.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "env.h"
 #include "error.h"
 #include "eval.h"
 #include "expr.h"
+#include "heap.h"
+#include "image.h"
+#include "intern.h"
+#include "jobs.h"
+#include "load.h"
+#include "module.h"
 #include "prelude.h"
+#include "profile.h"
 #include "repl.h"
+#include "serve.h"
 #include "util.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,13 +33,203 @@
 
 // The usage message for the program.
 static const char *const usage_message =
-	"usage: eva [-n] [-e code] [file ...]\n";
+	"usage: eva [-n] [--stats] [--alloc-sites] [--cache] [--profile file]"
+	" [--image file] [--save-image file] [-j jobs] [--serve socket]"
+	" [--client socket] [--lines proc [--begin code] [--end code]]"
+	" [-e code] [file ...]\n";
+
+// Name of the default image file, which is looked for in the same directory as
+// the executable.
+static const char *const default_image_name = "prelude.img";
 
 // Error message used when an option argument is missing.
 static const char *const err_opt_argument = "Option requires an argument";
 
-// Processes the command line arguments. Returns true on success.
-static bool process_args(int argc, char **argv, struct Environment *env) {
+// Error message used when the number of jobs is not a positive integer.
+static const char *const err_jobs = "Number of jobs must be a positive integer";
+
+// Error message used when --begin or --end is given without --lines.
+static const char *const err_lines = "Option requires --lines";
+
+// Error message used when the connection to a server fails.
+static const char *const err_connection = "Connection to server failed";
+
+// Whether to print memory statistics before exiting.
+static bool stats = false;
+
+// File to write the folded stacks to when profiling, or NULL.
+static const char *profile_file = NULL;
+
+// Prints statistics about memory usage to standard error.
+static void print_stats(void) {
+	struct InternStats in = intern_stats();
+	struct LoadStats ld = load_stats();
+	struct HeapStats hs = heap_stats();
+	double seconds = hs.seconds > 0 ? hs.seconds : 1;
+	fprintf(stderr,
+			"intern: %zu strings, %zu bytes of names\n"
+			"intern: %zu arenas, %zu of %zu bytes used\n"
+			"intern: %zu bytes in hash table and index\n"
+			"load: %zu loads, %zu memory cache hits, %zu disk cache hits\n"
+			"heap: %zu pairs, %zu strings, %zu procedures, %zu ports live\n"
+			"heap: %zu bytes live in boxes\n"
+			"heap: %zu allocations, %zu frees in %.3f s of CPU time"
+			" (%.0f allocations/s, %.0f frees/s)\n"
+			"env: %zu live environments, average depth %.2f\n",
+			in.count, in.string_bytes,
+			in.arena_count, in.arena_used, in.arena_bytes,
+			in.table_bytes,
+			ld.loads, ld.memory_hits, ld.disk_hits,
+			hs.pairs, hs.strings, hs.procedures, hs.ports,
+			hs.bytes,
+			hs.allocations, hs.frees, hs.seconds,
+			(double)hs.allocations / seconds, (double)hs.frees / seconds,
+			hs.environments,
+			hs.environments == 0
+				? 0.0
+				: (double)hs.depth_total / (double)hs.environments);
+}
+
+// Returns a hash of the prelude source, used as the tag for images that were
+// saved with the prelude loaded.
+static uint64_t prelude_hash(void) {
+	uint64_t h = 14695981039346656037u;
+	for (const char *s = prelude_source; *s; s++) {
+		h ^= (unsigned char)*s;
+		h *= 1099511628211u;
+	}
+	return h;
+}
+
+// Returns the path of the default image in a newly allocated string, or NULL
+// if the location of the executable cannot be determined.
+static char *default_image_path(const char *argv0) {
+	char exe[4096];
+	const char *path = argv0;
+#ifndef _WIN32
+	ssize_t n = readlink("/proc/self/exe", exe, sizeof exe - 1);
+	if (n > 0) {
+		exe[n] = '\0';
+		path = exe;
+	}
+#endif
+	const char *slash = strrchr(path, '/');
+	if (!slash) {
+		return NULL;
+	}
+	size_t dir_len = (size_t)(slash - path) + 1;
+	size_t name_len = strlen(default_image_name);
+	char *result = xmalloc(dir_len + name_len + 1);
+	memcpy(result, path, dir_len);
+	memcpy(result + dir_len, default_image_name, name_len + 1);
+	return result;
+}
+
+// Creates the initial environment. If 'image' is not NULL, loads it from that
+// image file. Otherwise, if 'prelude' is true, uses the default image if it was
+// saved with the current prelude, and falls back to executing the prelude.
+// Stores the tag to use when saving the environment in 'tag'. Returns NULL if
+// the image could not be loaded. If 'prelude' is true, modules are also set up
+// to use the default image.
+static struct Environment *initial_environment(
+		const char *argv0, const char *image, bool prelude, uint64_t *tag) {
+	char *path = prelude ? default_image_path(argv0) : NULL;
+	if (path) {
+		set_module_image(path, prelude_hash());
+	}
+	struct Environment *env;
+	if (image) {
+		free(path);
+		const char *err = load_image(image, &env, tag);
+		if (err) {
+			print_error(image, err);
+			return NULL;
+		}
+		return env;
+	}
+
+	*tag = prelude ? prelude_hash() : 0;
+	uint64_t image_tag;
+	bool loaded = path && !load_image(path, &env, &image_tag);
+	free(path);
+	if (loaded) {
+		if (image_tag == *tag) {
+			return env;
+		}
+		release_environment(env);
+	}
+	env = new_standard_environment();
+	if (prelude) {
+		execute(PRELUDE_FILENAME, prelude_source, strlen(prelude_source),
+				env, false);
+	}
+	return env;
+}
+
+// Sends the file 'filename' to the server on the connection 'fd', and stores
+// whether it succeeded in 'success'. Returns false if the connection failed or
+// the file could not be read, after printing an error.
+static bool request_file(
+		int fd, const char *path, const char *filename, bool *success) {
+	struct FileContents contents;
+	if (!map_file(filename, &contents)) {
+		print_file_error(filename);
+		return false;
+	}
+	bool ok = request_evaluation(fd, contents.data, contents.length, success);
+	unmap_file(contents);
+	if (!ok) {
+		print_error(path, err_connection);
+	}
+	return ok;
+}
+
+// Sends code to the server listening on 'path' instead of evaluating it: the
+// code of each '-e' option, the contents of each file argument, or standard
+// input if there are none. Stops after the first request that fails. Returns
+// true if all of them succeeded.
+static bool run_client(const char *path, int argc, char **argv, int n_args) {
+	int fd = connect_to_server(path);
+	if (fd == -1) {
+		print_file_error(path);
+		return false;
+	}
+	bool success = true;
+	if (n_args == 0) {
+		if (!request_file(fd, path, "/dev/stdin", &success)) {
+			success = false;
+		}
+	}
+	for (int i = 1; i < argc && n_args > 0 && success; i++) {
+		if (argv[i] == NULL) {
+			continue;
+		}
+		if (is_opt(argv[i], 'e', "expression")) {
+			if (i == argc - 1) {
+				print_error(argv[i], err_opt_argument);
+				success = false;
+				break;
+			}
+			i++;
+			if (!request_evaluation(fd, argv[i], strlen(argv[i]), &success)) {
+				print_error(path, err_connection);
+				success = false;
+			}
+		} else {
+			const char *filename =
+				strcmp(argv[i], "-") == 0 ? "/dev/stdin" : argv[i];
+			if (!request_file(fd, path, filename, &success)) {
+				success = false;
+			}
+		}
+	}
+	close(fd);
+	return success;
+}
+
+// Processes the command line arguments, and stores the environment in 'env'.
+// Returns true on success.
+static bool process_args(int argc, char **argv, struct Environment **env) {
 	if (argc == 2 && is_opt(argv[1], 'h', "help")) {
 		fputs(usage_message, stdout);
 		return true;
@@ -36,58 +237,176 @@ static bool process_args(int argc, char **argv, struct Environment *env) {
 
 	bool tty = isatty(0);
 	bool prelude = true;
+	const char *image = NULL;
+	const char *save_image_file = NULL;
+	size_t jobs = 0;
+	const char *serve_path = NULL;
+	const char *client_path = NULL;
+	const char *lines_code = NULL;
+	const char *begin_code = NULL;
+	const char *end_code = NULL;
+	int n_args = argc - 1;
 	for (int i = 1; i < argc; i++) {
-		if (is_opt(argv[i], 'n', "no-prelude")) {
+		int n = 1;
+		if (is_opt(argv[i], 'e', "expression")) {
+			// Skip the code, which might look like an option.
+			i++;
+			continue;
+		} else if (is_opt(argv[i], 'n', "no-prelude")) {
 			prelude = false;
-			argv[i] = NULL;
-			break;
+			set_module_prelude(false);
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			stats = true;
+		} else if (strcmp(argv[i], "--alloc-sites") == 0) {
+			enable_alloc_sites();
+		} else if (strcmp(argv[i], "--cache") == 0) {
+			set_disk_cache(true);
+		} else if (strcmp(argv[i], "--image") == 0
+				|| strcmp(argv[i], "--save-image") == 0
+				|| strcmp(argv[i], "--profile") == 0
+				|| is_opt(argv[i], 'j', "jobs")
+				|| strcmp(argv[i], "--serve") == 0
+				|| strcmp(argv[i], "--client") == 0
+				|| strcmp(argv[i], "--lines") == 0
+				|| strcmp(argv[i], "--begin") == 0
+				|| strcmp(argv[i], "--end") == 0) {
+			if (i == argc - 1) {
+				print_error(argv[i], err_opt_argument);
+				return false;
+			}
+			if (is_opt(argv[i], 'j', "jobs")) {
+				char *end;
+				long value = strtol(argv[i + 1], &end, 10);
+				if (*argv[i + 1] == '\0' || *end != '\0' || value < 1) {
+					print_error(argv[i + 1], err_jobs);
+					return false;
+				}
+				jobs = (size_t)value;
+			} else if (strcmp(argv[i], "--image") == 0) {
+				image = argv[i + 1];
+			} else if (strcmp(argv[i], "--save-image") == 0) {
+				save_image_file = argv[i + 1];
+			} else if (strcmp(argv[i], "--serve") == 0) {
+				serve_path = argv[i + 1];
+			} else if (strcmp(argv[i], "--client") == 0) {
+				client_path = argv[i + 1];
+			} else if (strcmp(argv[i], "--lines") == 0) {
+				lines_code = argv[i + 1];
+			} else if (strcmp(argv[i], "--begin") == 0) {
+				begin_code = argv[i + 1];
+			} else if (strcmp(argv[i], "--end") == 0) {
+				end_code = argv[i + 1];
+			} else {
+				profile_file = argv[i + 1];
+			}
+			argv[i + 1] = NULL;
+			n = 2;
+		} else {
+			continue;
 		}
+		argv[i] = NULL;
+		n_args -= n;
+		i += n - 1;
 	}
-	if (prelude) {
-		execute(PRELUDE_FILENAME, prelude_source, env, false);
+
+	if (!lines_code && (begin_code || end_code)) {
+		print_error(begin_code ? "--begin" : "--end", err_lines);
+		return false;
+	}
+	if (client_path) {
+		return run_client(client_path, argc, argv, n_args);
 	}
 
-	if (argc == 1 || (argc == 2 && !prelude)) {
-		repl(env, tty);
+	uint64_t tag;
+	*env = initial_environment(argv[0], image, prelude, &tag);
+	if (!*env) {
+		return false;
+	}
+	if (profile_file) {
+		start_profile();
+	}
+
+	if (n_args == 0 && !save_image_file && !serve_path && !lines_code) {
+		repl(*env, tty);
 		return true;
 	}
+	// With -j, files are collected here and run at the end.
+	char **files = NULL;
+	size_t n_files = 0;
+	if (jobs > 0) {
+		files = xmalloc((size_t)argc * sizeof *files);
+	}
 	for (int i = 1; i < argc; i++) {
 		if (argv[i] == NULL) {
 			continue;
 		}
 
 		if (strcmp(argv[i], "-") == 0) {
-			repl(env, tty);
+			repl(*env, tty);
 		} else if (is_opt(argv[i], 'e', "expression")) {
 			// Execute the next argument.
 			if (i == argc - 1) {
 				print_error(argv[i], err_opt_argument);
 				return false;
 			}
-			if (!execute(argv_filename, argv[++i], env, true)) {
+			i++;
+			if (!execute(argv_filename, argv[i], strlen(argv[i]), *env, true)) {
+				free(files);
 				return false;
 			}
+		} else if (jobs > 0) {
+			files[n_files++] = argv[i];
 		} else {
 			// Assume the argument is a filename.
-			char *text = read_file(argv[i]);
-			if (!text) {
-				print_file_error(argv[i]);
-				return false;
-			}
-			bool success = execute(argv[i], text, env, false);
-			free(text);
-			if (!success) {
+			if (!execute_file(argv[i], *env)) {
 				return false;
 			}
 		}
 	}
+	if (jobs > 0) {
+		bool success = run_jobs(files, n_files, jobs, *env);
+		free(files);
+		if (!success) {
+			return false;
+		}
+	}
+
+	if (lines_code && !process_lines(lines_code, begin_code, end_code, *env)) {
+		return false;
+	}
+
+	if (save_image_file) {
+		const char *err = save_image(save_image_file, *env, tag);
+		if (err) {
+			print_error(save_image_file, err);
+			return false;
+		}
+	}
+	if (serve_path && !serve(serve_path, *env)) {
+		print_file_error(serve_path);
+		return false;
+	}
 	return true;
 }
 
 int main(int argc, char **argv) {
 	setup_readline();
-	struct Environment *env = new_standard_environment();
-	bool success = process_args(argc, argv, env);
+	struct Environment *env = NULL;
+	bool success = process_args(argc, argv, &env);
+	if (profile_file && profile_enabled) {
+		const char *err = stop_profile(profile_file);
+		if (err) {
+			print_error(profile_file, err);
+			success = false;
+		}
+	}
+	// Report on the heap before releasing the global environment.
+	if (stats) {
+		print_stats();
+	}
+	if (alloc_sites_enabled) {
+		print_alloc_sites();
+	}
 	release_environment(env);
 	return success ? 0 : 1;
 }
@@ -0,0 +1,283 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "module.h"
+
+#include "context.h"
+#include "env.h"
+#include "error.h"
+#include "image.h"
+#include "load.h"
+#include "prelude.h"
+#include "repl.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Extension of module source files.
+#define MODULE_EXT ".scm"
+
+// Initial capacity of the module and loading arrays.
+#define DEFAULT_MODULES_CAP 16
+
+// A module registered by 'define_module'. The exports are a list of symbols.
+struct Module {
+	InternId name;
+	struct Expression exports;
+	struct Environment *env;
+};
+
+// A module whose file is being loaded by an import on 'thread'.
+struct Loading {
+	InternId name;
+	pthread_t thread;
+};
+
+// Each context has its own registry of modules, which is searched linearly
+// since programs use few modules. It also keeps a stack of the modules whose
+// files are being loaded by an import, and the parent of all module
+// environments, which is created when it is first needed. Worker threads of
+// parallel operations and futures share the context of their caller, so all of
+// this is only accessed with 'registry_lock' held. Module code is evaluated
+// outside the lock, since it can define and import other modules.
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Image to build module environments from, and the tag it must have.
+static char *module_image = NULL;
+static uint64_t module_image_tag;
+
+void set_module_image(const char *path, uint64_t tag) {
+	free(module_image);
+	size_t len = strlen(path);
+	module_image = xmalloc(len + 1);
+	memcpy(module_image, path, len + 1);
+	module_image_tag = tag;
+}
+
+void set_module_prelude(bool enabled) {
+	current_context->module.without_prelude = !enabled;
+}
+
+bool module_prelude(void) {
+	return !current_context->module.without_prelude;
+}
+
+void free_modules(void) {
+	struct EvaContext *ctx = current_context;
+	for (size_t i = 0; i < ctx->module.modules_len; i++) {
+		release_expression(ctx->module.modules[i].exports);
+		clear_environment(ctx->module.modules[i].env);
+		release_environment(ctx->module.modules[i].env);
+	}
+	free(ctx->module.modules);
+	free(ctx->module.loading);
+	if (ctx->module.base) {
+		clear_environment(ctx->module.base);
+	}
+	release_environment(ctx->module.base);
+	bool without_prelude = ctx->module.without_prelude;
+	memset(&ctx->module, 0, sizeof ctx->module);
+	ctx->module.without_prelude = without_prelude;
+}
+
+// Loads the module image into 'out'. Returns false if there is none, or if it
+// cannot be loaded or has the wrong tag.
+static bool load_module_image(struct Environment **out) {
+	uint64_t tag;
+	if (!module_image || load_image(module_image, out, &tag)) {
+		return false;
+	}
+	if (tag != module_image_tag) {
+		release_environment(*out);
+		return false;
+	}
+	return true;
+}
+
+// Returns the environment shared by all modules, creating it if necessary. It
+// comes from the module image if there is one, and otherwise the prelude is
+// executed in a new standard environment. Must be called with the lock held.
+static struct Environment *module_base(void) {
+	struct EvaContext *ctx = current_context;
+	if (!ctx->module.base) {
+		if (ctx->module.without_prelude) {
+			ctx->module.base = new_standard_environment();
+		} else if (!load_module_image(&ctx->module.base)) {
+			ctx->module.base = new_standard_environment();
+			execute(PRELUDE_FILENAME, prelude_source, strlen(prelude_source),
+					ctx->module.base, false);
+		}
+	}
+	return ctx->module.base;
+}
+
+// Returns the registered module called 'name', or NULL if there is none. Must
+// be called with the lock held.
+static struct Module *find_module(InternId name) {
+	struct Module *modules = current_context->module.modules;
+	for (size_t i = 0; i < current_context->module.modules_len; i++) {
+		if (modules[i].name == name) {
+			return modules + i;
+		}
+	}
+	return NULL;
+}
+
+struct EvalResult define_module(
+		InternId name,
+		struct Expression exports,
+		struct Expression *body,
+		size_t n) {
+	pthread_mutex_lock(&registry_lock);
+	struct Environment *env = new_environment(module_base(), 0);
+	pthread_mutex_unlock(&registry_lock);
+	for (size_t i = 0; i < n; i++) {
+		struct EvalResult result = eval(body[i], env, true);
+		if (result.err) {
+			release_environment(env);
+			return result;
+		}
+		release_expression(result.expr);
+	}
+	for (struct Expression e = exports; e.type != E_NULL; e = e.box->cdr) {
+		InternId id = e.box->car.symbol_id;
+		if (!lookup(env, id)) {
+			release_environment(env);
+			return (struct EvalResult){
+				.err = new_eval_error_symbol(ERR_UNBOUND_VAR, id)
+			};
+		}
+	}
+
+	pthread_mutex_lock(&registry_lock);
+	struct Module *module = find_module(name);
+	if (module) {
+		release_expression(module->exports);
+		release_environment(module->env);
+	} else {
+		struct EvaContext *ctx = current_context;
+		if (ctx->module.modules_len == ctx->module.modules_cap) {
+			size_t cap = ctx->module.modules_cap;
+			cap = cap == 0 ? DEFAULT_MODULES_CAP : cap * 2;
+			ctx->module.modules =
+				xrealloc(ctx->module.modules, cap * sizeof *module);
+			ctx->module.modules_cap = cap;
+		}
+		module = ctx->module.modules + ctx->module.modules_len++;
+		module->name = name;
+	}
+	module->exports = retain_expression(exports);
+	module->env = env;
+	pthread_mutex_unlock(&registry_lock);
+	return (struct EvalResult){ .expr = new_void(), .err = NULL };
+}
+
+// Executes the file "DIR/NAME.scm" in 'env', or "NAME.scm" if 'dir' is empty.
+// Returns false if the file could not be opened.
+static bool load_module_file(
+		const char *dir, size_t dir_len, InternId name, struct Environment *env) {
+	size_t name_len = find_string_length(name);
+	char *path = xmalloc(dir_len + 1 + name_len + sizeof MODULE_EXT);
+	size_t i = 0;
+	if (dir_len > 0) {
+		memcpy(path, dir, dir_len);
+		i = dir_len;
+		path[i++] = '/';
+	}
+	memcpy(path + i, find_string(name), name_len);
+	memcpy(path + i + name_len, MODULE_EXT, sizeof MODULE_EXT);
+	bool found = load_file(path, env);
+	free(path);
+	return found;
+}
+
+// Searches for the source file of the module 'name' and executes it in a new
+// environment, so that definitions outside the module are discarded.
+static void load_module(InternId name) {
+	pthread_mutex_lock(&registry_lock);
+	struct Environment *env = new_environment(module_base(), 0);
+	pthread_mutex_unlock(&registry_lock);
+	bool found = load_module_file("", 0, name, env);
+	const char *dirs = getenv("EVA_PATH");
+	while (!found && dirs && *dirs) {
+		const char *end = strchr(dirs, ':');
+		size_t len = end ? (size_t)(end - dirs) : strlen(dirs);
+		if (len > 0) {
+			found = load_module_file(dirs, len, name, env);
+		}
+		dirs = end ? end + 1 : NULL;
+	}
+	release_environment(env);
+}
+
+// Removes the last entry for 'name' and the calling thread from the stack of
+// modules being loaded. Must be called with the lock held.
+static void finish_loading(InternId name) {
+	struct EvaContext *ctx = current_context;
+	pthread_t self = pthread_self();
+	for (size_t i = ctx->module.loading_len; i-- > 0;) {
+		struct Loading *entry = ctx->module.loading + i;
+		if (entry->name == name && pthread_equal(entry->thread, self)) {
+			memmove(entry, entry + 1,
+					(ctx->module.loading_len - i - 1) * sizeof *entry);
+			ctx->module.loading_len--;
+			return;
+		}
+	}
+}
+
+struct EvalResult import_module(InternId name, struct Environment *env) {
+	struct EvaContext *ctx = current_context;
+	pthread_t self = pthread_self();
+	pthread_mutex_lock(&registry_lock);
+	struct Module *module = find_module(name);
+	if (!module) {
+		// Only imports on the calling thread form a cycle. Another thread may
+		// be loading the same module, in which case both load it.
+		for (size_t i = 0; i < ctx->module.loading_len; i++) {
+			if (ctx->module.loading[i].name == name
+					&& pthread_equal(ctx->module.loading[i].thread, self)) {
+				pthread_mutex_unlock(&registry_lock);
+				return (struct EvalResult){
+					.err = new_eval_error_symbol(ERR_IMPORT_CYCLE, name)
+				};
+			}
+		}
+		if (ctx->module.loading_len == ctx->module.loading_cap) {
+			size_t cap = ctx->module.loading_cap;
+			cap = cap == 0 ? DEFAULT_MODULES_CAP : cap * 2;
+			ctx->module.loading =
+				xrealloc(ctx->module.loading, cap * sizeof *ctx->module.loading);
+			ctx->module.loading_cap = cap;
+		}
+		ctx->module.loading[ctx->module.loading_len++] =
+			(struct Loading){ .name = name, .thread = self };
+		pthread_mutex_unlock(&registry_lock);
+		load_module(name);
+		pthread_mutex_lock(&registry_lock);
+		finish_loading(name);
+		// Look the module up again, since loading can move the array.
+		module = find_module(name);
+		if (!module) {
+			pthread_mutex_unlock(&registry_lock);
+			return (struct EvalResult){
+				.err = new_eval_error_symbol(ERR_MODULE, name)
+			};
+		}
+	}
+
+	// Another thread can redefine the module once the lock is released.
+	struct Expression exports = retain_expression(module->exports);
+	struct Environment *module_env = retain_environment(module->env);
+	pthread_mutex_unlock(&registry_lock);
+	for (struct Expression e = exports; e.type != E_NULL; e = e.box->cdr) {
+		InternId id = e.box->car.symbol_id;
+		bind_variable(env, id, *lookup(module_env, id));
+	}
+	release_expression(exports);
+	release_environment(module_env);
+	return (struct EvalResult){ .expr = new_void(), .err = NULL };
+}
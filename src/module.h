@@ -0,0 +1,60 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "eval.h"
+#include "expr.h"
+#include "intern.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct Environment;
+
+// A module is a group of definitions evaluated in an environment of its own.
+// The parent of every module environment is a standard environment shared by
+// all modules, so modules cannot see the definitions of the program that
+// imports them. Only the names a module exports are visible to importers. Each
+// module is evaluated once, and all importers share its environment.
+
+// Sets whether the environment shared by modules in the current context has the
+// prelude loaded (true by default). Only has an effect before the first module
+// is defined.
+void set_module_prelude(bool enabled);
+
+// Returns true if modules in the current context get the prelude.
+bool module_prelude(void);
+
+// Sets an image file, saved with the prelude loaded, to build the environment
+// shared by modules from instead of executing the prelude again. The image is
+// only used if its tag is 'tag'. Applies to all contexts in the process, and
+// should be called before any modules are defined.
+void set_module_image(const char *path, uint64_t tag);
+
+// Evaluates the 'n' expressions in 'body' in a new module environment, checks
+// that all the symbols in the list 'exports' are bound in it, and registers the
+// module under 'name', replacing any previous module with that name. On
+// success, returns a void expression. Otherwise, allocates and returns an
+// error, and does not register the module.
+struct EvalResult define_module(
+		InternId name,
+		struct Expression exports,
+		struct Expression *body,
+		size_t n);
+
+// Binds the exports of the module 'name' in 'env', to the values they have in
+// the module environment at the time of the import. If no module by that name
+// has been defined, first loads the file "NAME.scm" from the current directory
+// or one of the directories listed in the EVA_PATH environment variable
+// (separated by colons), which is expected to define it. Loading goes through
+// 'load_file', so the file is cached like any other. On success, returns a void
+// expression. Otherwise, allocates and returns an error.
+struct EvalResult import_module(InternId name, struct Environment *env);
+
+// Releases all the modules registered in the current context. Called by
+// 'free_context'.
+void free_modules(void);
+
+#endif
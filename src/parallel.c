@@ -0,0 +1,426 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+
+#include "context.h"
+#include "error.h"
+#include "future.h"
+#include "heap.h"
+#include "list.h"
+#include "profile.h"
+#include "util.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// Maximum number of threads working on an operation, including the caller.
+#define MAX_THREADS 64
+
+// Each claim takes this fraction of the remaining elements per thread, so
+// chunks start large and shrink towards the end to balance the load.
+#define CHUNK_DIVISOR 2
+
+int parallel_operations = 0;
+
+// Kinds of parallel operations.
+enum JobKind {
+	JOB_MAP,
+	JOB_FOR_EACH,
+	JOB_REDUCE
+};
+
+// Counters kept by each thread while it works on a job, and added to the
+// context when the job is done.
+struct Counters {
+	struct HeapStats stats;
+	size_t evals;
+};
+
+// A Job is a parallel operation over the elements of a list. Threads claim
+// chunks of consecutive elements by advancing 'next', and store the result for
+// each element (for JOB_MAP) or each chunk (for JOB_REDUCE, at the index of
+// its first element) in 'results'. After a failure, no new chunks are claimed,
+// and the error of the earliest element is kept.
+struct Job {
+	enum JobKind kind;
+	struct EvaContext *ctx;
+	struct Expression proc;
+	struct Environment *env;
+	struct Expression *items;
+	size_t n;
+	size_t threads;
+	struct Expression *results;
+	bool *chunk_starts;
+	struct Counters counters[MAX_THREADS];
+	size_t next;
+	bool failed;
+	pthread_mutex_t err_lock;
+	struct EvalError *err;
+	size_t err_index;
+};
+
+// The pool has a fixed number of worker threads, created on first use. They
+// wait for a job to be posted, and the calling thread works on the job along
+// with them. Only one job runs at a time: operations started while the pool is
+// busy (including nested ones started by the workers) run on the calling
+// thread instead.
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	pthread_cond_t posted;
+	pthread_cond_t finished;
+	size_t size;
+	bool busy;
+	struct Job *job;
+	unsigned long generation;
+	size_t running;
+} pool = {
+	.once = PTHREAD_ONCE_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.posted = PTHREAD_COND_INITIALIZER,
+	.finished = PTHREAD_COND_INITIALIZER
+};
+
+// Applies the job's procedure to the 'n' arguments in 'args'. The standard
+// procedure "error" keeps its argument array in the error, which must be on
+// the heap, so in that case the error gets a copy of 'args'.
+static struct EvalResult call(
+		struct Job *job, struct Expression *args, size_t n) {
+	struct EvalResult result = apply_procedure(job->proc, args, n, job->env);
+	if (result.err && result.err->type == ERR_CUSTOM
+			&& result.err->array.exprs == args) {
+		struct Expression *copy = xmalloc(n * sizeof *copy);
+		memcpy(copy, args, n * sizeof *copy);
+		result.err->array.exprs = copy;
+	}
+	return result;
+}
+
+// Records that processing element 'index' failed with 'err'.
+static void fail(struct Job *job, size_t index, struct EvalError *err) {
+	pthread_mutex_lock(&job->err_lock);
+	if (!job->err || index < job->err_index) {
+		if (job->err) {
+			free_eval_error(job->err);
+		}
+		job->err = err;
+		job->err_index = index;
+	} else {
+		free_eval_error(err);
+	}
+	pthread_mutex_unlock(&job->err_lock);
+	__atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+}
+
+// Claims the next chunk of elements, storing its bounds in 'start' and 'end'.
+// Returns false if there are none left, or if the job has failed.
+static bool claim(struct Job *job, size_t *start, size_t *end) {
+	size_t next = __atomic_load_n(&job->next, __ATOMIC_RELAXED);
+	for (;;) {
+		if (next >= job->n || __atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+			return false;
+		}
+		size_t size = (job->n - next) / (CHUNK_DIVISOR * job->threads);
+		size = MAX(size, 1);
+		if (__atomic_compare_exchange_n(&job->next, &next, next + size, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			*start = next;
+			*end = next + size;
+			return true;
+		}
+	}
+}
+
+// Processes the elements from 'start' to 'end'.
+static void run_chunk(struct Job *job, size_t start, size_t end) {
+	if (job->kind == JOB_REDUCE) {
+		struct Expression acc = retain_expression(job->items[start]);
+		for (size_t i = start + 1; i < end; i++) {
+			struct Expression args[2] = { acc, job->items[i] };
+			struct EvalResult result = call(job, args, 2);
+			release_expression(acc);
+			if (result.err) {
+				fail(job, i, result.err);
+				return;
+			}
+			acc = result.expr;
+		}
+		job->results[start] = acc;
+		job->chunk_starts[start] = true;
+		return;
+	}
+	for (size_t i = start; i < end; i++) {
+		struct EvalResult result = call(job, job->items + i, 1);
+		if (result.err) {
+			fail(job, i, result.err);
+			return;
+		}
+		if (job->kind == JOB_MAP) {
+			job->results[i] = result.expr;
+		} else {
+			release_expression(result.expr);
+		}
+	}
+}
+
+// Works on the job as thread number 'index' until there are no chunks left.
+static void run_job(struct Job *job, size_t index) {
+	if (index >= job->threads) {
+		return;
+	}
+	// A job running on the calling thread alone counts as usual. This includes
+	// nested jobs on worker threads, which keep counting for the outer job.
+	bool shared = job->threads > 1;
+	struct HeapStats *saved_stats = NULL;
+	size_t *saved_evals = NULL;
+	if (shared) {
+		saved_stats = redirect_heap_stats(&job->counters[index].stats);
+		saved_evals = redirect_eval_count(&job->counters[index].evals);
+	}
+	size_t start, end;
+	while (claim(job, &start, &end)) {
+		run_chunk(job, start, end);
+	}
+	if (shared) {
+		redirect_heap_stats(saved_stats);
+		redirect_eval_count(saved_evals);
+	}
+}
+
+// Waits for jobs and works on them. The argument is the thread number.
+static void *worker_main(void *arg) {
+	size_t index = (size_t)arg;
+	unsigned long seen = 0;
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (pool.generation == seen) {
+			pthread_cond_wait(&pool.posted, &pool.lock);
+		}
+		seen = pool.generation;
+		struct Job *job = pool.job;
+		pthread_mutex_unlock(&pool.lock);
+		use_context(job->ctx);
+		run_job(job, index);
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.running == 0) {
+			pthread_cond_signal(&pool.finished);
+		}
+	}
+	return NULL;
+}
+
+size_t parallel_threads(void) {
+	const char *var = getenv("EVA_THREADS");
+	long count = var ? strtol(var, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1) {
+		return 1;
+	}
+	return count > MAX_THREADS ? MAX_THREADS : (size_t)count;
+}
+
+bool start_thread(void *(*routine)(void *), void *arg) {
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+			&& limit.rlim_cur > PTHREAD_STACK_MIN) {
+		pthread_attr_setstacksize(&attr, (size_t)limit.rlim_cur);
+	}
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_t thread;
+	bool started = pthread_create(&thread, &attr, routine, arg) == 0;
+	if (started) {
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+	return started;
+}
+
+size_t start_workers(size_t n, void *(*routine)(void *)) {
+	size_t started = 0;
+	while (started < n && start_thread(routine, (void *)(started + 1))) {
+		started++;
+	}
+	return started;
+}
+
+// Starts the worker threads of the pool.
+static void start_pool(void) {
+	pool.size = start_workers(parallel_threads() - 1, worker_main);
+}
+
+void reset_threads_after_fork(void) {
+	pthread_once_t once = PTHREAD_ONCE_INIT;
+	pool.once = once;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.posted, NULL);
+	pthread_cond_init(&pool.finished, NULL);
+	pool.size = 0;
+	pool.busy = false;
+	pool.job = NULL;
+	pool.running = 0;
+	reset_scheduler();
+}
+
+// Reserves the pool for a job. Returns false if the job should run on the
+// calling thread instead: when the pool is busy or has no workers, and when
+// the profiler or allocation site tracking is on, since their state is not
+// shared between threads.
+static bool acquire_pool(void) {
+	if (profile_enabled || alloc_sites_enabled) {
+		return false;
+	}
+	pthread_once(&pool.once, start_pool);
+	pthread_mutex_lock(&pool.lock);
+	bool acquired = !pool.busy && pool.size > 0;
+	if (acquired) {
+		pool.busy = true;
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return acquired;
+}
+
+// Runs the job on the pool, and waits for all the threads to finish.
+static void run_on_pool(struct Job *job) {
+	__atomic_add_fetch(&parallel_operations, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&pool.lock);
+	pool.job = job;
+	pool.generation++;
+	pool.running = pool.size;
+	pthread_cond_broadcast(&pool.posted);
+	pthread_mutex_unlock(&pool.lock);
+
+	run_job(job, 0);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.running > 0) {
+		pthread_cond_wait(&pool.finished, &pool.lock);
+	}
+	pool.job = NULL;
+	pool.busy = false;
+	pthread_mutex_unlock(&pool.lock);
+	__atomic_sub_fetch(&parallel_operations, 1, __ATOMIC_RELEASE);
+
+	for (size_t i = 0; i < job->threads; i++) {
+		merge_heap_stats(&job->counters[i].stats);
+		add_eval_count(job->counters[i].evals);
+	}
+	if (!parallel_active()) {
+		release_retired_code();
+	}
+}
+
+// Runs a job over the elements of 'list'. On success, the results are left in
+// 'job->results' (if it is not NULL) for the caller to take. On failure, they
+// are released, and the error is returned.
+static struct EvalError *run(
+		enum JobKind kind,
+		struct Expression proc,
+		struct Expression list,
+		struct Environment *env,
+		struct Job *job) {
+	struct Array array = list_to_array(list, false);
+	memset(job, 0, sizeof *job);
+	job->kind = kind;
+	job->ctx = current_context;
+	job->proc = proc;
+	job->env = env;
+	job->items = array.exprs;
+	job->n = array.size;
+	if (kind != JOB_FOR_EACH) {
+		job->results = xcalloc(MAX(job->n, 1), sizeof *job->results);
+	}
+	if (kind == JOB_REDUCE) {
+		job->chunk_starts = xcalloc(MAX(job->n, 1), sizeof *job->chunk_starts);
+	}
+	pthread_mutex_init(&job->err_lock, NULL);
+
+	if (job->n > 1 && acquire_pool()) {
+		job->threads = MIN(pool.size + 1, job->n);
+		run_on_pool(job);
+	} else {
+		job->threads = 1;
+		run_job(job, 0);
+	}
+
+	pthread_mutex_destroy(&job->err_lock);
+	free_array(array);
+	if (job->err && job->results) {
+		for (size_t i = 0; i < job->n; i++) {
+			release_expression(job->results[i]);
+		}
+	}
+	return job->err;
+}
+
+struct EvalResult parallel_map(
+		struct Expression proc,
+		struct Expression list,
+		struct Environment *env) {
+	struct Job job;
+	struct EvalResult result;
+	result.err = run(JOB_MAP, proc, list, env, &job);
+	if (!result.err) {
+		result.expr = new_null();
+		for (size_t i = job.n; i-- > 0;) {
+			result.expr = new_pair(job.results[i], result.expr);
+		}
+	}
+	free(job.results);
+	return result;
+}
+
+struct EvalResult parallel_for_each(
+		struct Expression proc,
+		struct Expression list,
+		struct Environment *env) {
+	struct Job job;
+	struct EvalResult result;
+	result.err = run(JOB_FOR_EACH, proc, list, env, &job);
+	result.expr = new_void();
+	return result;
+}
+
+struct EvalResult parallel_reduce(
+		struct Expression proc,
+		struct Expression init,
+		struct Expression list,
+		struct Environment *env) {
+	struct Job job;
+	struct EvalResult result;
+	result.err = run(JOB_REDUCE, proc, list, env, &job);
+	if (!result.err) {
+		// Fold the partial results of the chunks in order.
+		struct Expression acc = retain_expression(init);
+		for (size_t i = 0; i < job.n; i++) {
+			if (!job.chunk_starts[i]) {
+				continue;
+			}
+			if (result.err) {
+				release_expression(job.results[i]);
+				continue;
+			}
+			struct Expression args[2] = { acc, job.results[i] };
+			result = call(&job, args, 2);
+			release_expression(acc);
+			release_expression(job.results[i]);
+			acc = result.expr;
+		}
+		if (!result.err) {
+			result.expr = acc;
+		}
+	}
+	free(job.results);
+	free(job.chunk_starts);
+	return result;
+}
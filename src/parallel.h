@@ -0,0 +1,82 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "eval.h"
+#include "expr.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Environment;
+
+// Number of parallel operations and unfinished futures in the process (see
+// future.h). While it is nonzero, worker threads share the boxes,
+// environments, and intern table of the context that started the operation, so
+// reference counts are updated atomically, the intern table is locked, and
+// code rewrites are serialized.
+extern int parallel_operations;
+
+// Returns true if parallel operations are running.
+static inline bool parallel_active(void) {
+	return __atomic_load_n(&parallel_operations, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Adds 'delta' to the reference count '*ref_count', and returns the new count.
+// The update is atomic while parallel operations are running.
+static inline int adjust_ref_count(int *ref_count, int delta) {
+	if (parallel_active()) {
+		return __atomic_add_fetch(ref_count, delta, __ATOMIC_ACQ_REL);
+	}
+	return *ref_count += delta;
+}
+
+// Returns the number of threads to use for parallel work, including the calling
+// thread. This is the value of the environment variable EVA_THREADS if it is
+// set, and the number of online processors otherwise.
+size_t parallel_threads(void);
+
+// Starts a detached thread that calls 'routine' with 'arg'. Returns false if
+// it could not be created. The thread blocks all signals, so that signal
+// handlers such as the profiler's only run on the main thread, and it gets the
+// same stack size as the main thread, since evaluation is recursive.
+bool start_thread(void *(*routine)(void *), void *arg);
+
+// Starts 'n' threads like 'start_thread', passing each its number (starting at
+// 1) cast to a pointer, and returns how many were started.
+size_t start_workers(size_t n, void *(*routine)(void *));
+
+// Resets the thread pool and the future scheduler in a child process, which has
+// none of the worker threads of its parent. Parallel operations and futures in
+// the child start new workers when they are first used. Futures that a worker
+// was evaluating at the time of the fork never finish in the child. Must be
+// called right after 'fork' in the child, before evaluating anything.
+void reset_threads_after_fork(void);
+
+// Applies 'proc' to each element of 'list' on the thread pool, and returns a
+// new list of the results in the same order. If any application fails, returns
+// the error of the first element that failed.
+struct EvalResult parallel_map(
+		struct Expression proc,
+		struct Expression list,
+		struct Environment *env);
+
+// Applies 'proc' to each element of 'list' on the thread pool, in no particular
+// order, and returns void.
+struct EvalResult parallel_for_each(
+		struct Expression proc,
+		struct Expression list,
+		struct Environment *env);
+
+// Combines 'init' and the elements of 'list' with the binary procedure 'proc'.
+// The result is the same as folding from the left, provided that 'proc' is
+// associative: each thread folds contiguous runs of elements, and the partial
+// results are folded in order, starting with 'init'.
+struct EvalResult parallel_reduce(
+		struct Expression proc,
+		struct Expression init,
+		struct Expression list,
+		struct Environment *env);
+
+#endif
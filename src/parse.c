@@ -7,11 +7,48 @@
 #include "util.h"
 
 #include <assert.h>
-#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Initial capacity of the parser stack.
+#define DEFAULT_STACK_CAP 16
+
+// Kinds of frames on the parser stack.
+enum FrameKind {
+	FRAME_LIST,    // inside a list, before any dot
+	FRAME_DOT,     // after the dot in a list, expecting the final cdr
+	FRAME_DOT_END, // after the final cdr in a list, expecting ')'
+	FRAME_QUOTE    // after a quote character, expecting the quoted expression
+};
+
+// A frame on the parser stack represents an expression that is not finished.
+// For lists, 'list' contains the elements parsed so far and 'last' points to
+// the last pair (or NULL if there are none). For quotations, 'stdmacro' is the
+// standard macro to wrap around the next expression.
+struct Frame {
+	enum FrameKind kind;
+	enum StandardMacro stdmacro;
+	struct Expression list;
+	struct Box *last;
+};
+
+// A parser is an explicit stack of unfinished expressions, together with the
+// position in the text where parsing should continue.
+struct Parser {
+	size_t pos;
+	bool pending;
+	size_t depth;
+	size_t cap;
+	struct Frame *frames;
+};
+
 bool parse_number(const char *s, size_t n, Number *result) {
 	Number val = 0;
 	Number sign = 1;
@@ -82,8 +119,8 @@ static struct Expression parse_string(const char *s, size_t n) {
 	char* ptr = buf;
 	for (size_t i = 0; i < n; i++) {
 		char c = s[i];
-		if (s[i-1] == '\\') {
-			switch (c) {
+		if (c == '\\' && i + 1 < n) {
+			switch (s[++i]) {
 			case 'n':
 				*ptr++ = '\n';
 				break;
@@ -94,10 +131,10 @@ static struct Expression parse_string(const char *s, size_t n) {
 				*ptr++ = '\t';
 				break;
 			default:
-				*ptr++ = c;
+				*ptr++ = s[i];
 				break;
 			}
-		} else if (c != '\\') {
+		} else {
 			*ptr++ = c;
 		}
 	}
@@ -105,212 +142,424 @@ static struct Expression parse_string(const char *s, size_t n) {
 	return new_string(buf, (size_t)(ptr - buf));
 }
 
-// Returns the number of leading whitespace characters in 'text'. Comments,
-// which go from a semicolon to the end of the line, are treated as whitespace.
-static size_t skip_whitespace(const char *text) {
-	const char *s = text;
-	bool comment = false;
-	while (*s) {
-		if (comment) {
-			if (*s == '\n') {
-				comment = false;
-			}
-		} else {
-			if (*s == ';') {
-				comment = true;
-			} else if (!isspace(*s)) {
-				break;
-			}
+// Returns true if 'c' is a whitespace character. This matches 'isspace' in the
+// C locale, and never depends on the sign of 'char'.
+static inline bool is_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Returns true if 'c' ends a symbol, number, or other atom.
+static inline bool is_delimiter(char c) {
+	return is_space(c) || c == ';' || c == '(' || c == ')';
+}
+
+// The scanning functions below classify 16 characters at a time using SSE2 when
+// it is available, and jump directly to the first character of interest. They
+// finish with a scalar loop for the last few characters. All character classes
+// are ASCII, so bytes 0x80 to 0xff (negative as signed chars) never match.
+#if defined(__SSE2__)
+
+#define SIMD_WIDTH 16
+
+// Returns a 16-bit mask with bit 'i' set if 'v[i]' is a whitespace character.
+static inline unsigned space_mask(__m128i v) {
+	__m128i ctrl = _mm_and_si128(
+			_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+	__m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctrl, space));
+}
+
+// Returns a 16-bit mask with bit 'i' set if 'v[i]' is a delimiter.
+static inline unsigned delimiter_mask(__m128i v) {
+	__m128i punct = _mm_or_si128(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8(';')),
+			_mm_or_si128(
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('(')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8(')'))));
+	return space_mask(v) | (unsigned)_mm_movemask_epi8(punct);
+}
+
+// Returns a 16-bit mask with bit 'i' set if 'v[i]' is a double quote or a
+// backslash.
+static inline unsigned string_mask(__m128i v) {
+	return (unsigned)_mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+}
+
+#endif
+
+// Returns a pointer to the first character from 's' to 'end' that is not
+// whitespace, or 'end' if there is none.
+static const char *find_nonspace(const char *s, const char *end) {
+#if defined(__SSE2__)
+	while (end - s >= SIMD_WIDTH) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		unsigned mask = ~space_mask(v) & 0xffff;
+		if (mask) {
+			return s + __builtin_ctz(mask);
 		}
+		s += SIMD_WIDTH;
+	}
+#endif
+	while (s < end && is_space(*s)) {
 		s++;
 	}
-	return (size_t)(s - text);
+	return s;
 }
 
-// Returns the number of symbol characters at the beginning of 'text'.
-static size_t skip_symbol(const char *text) {
-	const char *s = text;
-	while (*s && *s != ';' && *s != '(' && *s != ')' && !isspace(*s)) {
+// Returns a pointer to the first delimiter from 's' to 'end', or 'end' if there
+// is none.
+static const char *find_delimiter(const char *s, const char *end) {
+#if defined(__SSE2__)
+	while (end - s >= SIMD_WIDTH) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		unsigned mask = delimiter_mask(v);
+		if (mask) {
+			return s + __builtin_ctz(mask);
+		}
+		s += SIMD_WIDTH;
+	}
+#endif
+	while (s < end && !is_delimiter(*s)) {
 		s++;
 	}
-	return (size_t)(s - text);
+	return s;
 }
 
-// Returns the number of string characters at the beginning of 'text'. Assumes
-// 'text[-1]' is a double quote. The string continues until (but not including)
-// the next double quote character that is not escaped by a backslash.
-static size_t skip_string(const char* text) {
-	const char *s = text;
-	while (*s && !(s[-1] != '\\' && *s == '"')) {
+// Returns a pointer to the first double quote or backslash from 's' to 'end',
+// or 'end' if there is none.
+static const char *find_string_special(const char *s, const char *end) {
+#if defined(__SSE2__)
+	while (end - s >= SIMD_WIDTH) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		unsigned mask = string_mask(v);
+		if (mask) {
+			return s + __builtin_ctz(mask);
+		}
+		s += SIMD_WIDTH;
+	}
+#endif
+	while (s < end && *s != '"' && *s != '\\') {
 		s++;
 	}
-	return (size_t)(s - text);
+	return s;
 }
 
-// Parses a pair, assuming the opening left parenthesis has already been read.
-static struct ParseResult parse_pair(const char *text) {
-	struct ParseResult result;
-	result.err_type = -1;
-	const char *s = text;
-	s += skip_whitespace(s);
-
-	if (*s == ')') {
-		s++;
-		result.expr = new_null();
-		goto chars_read;
+// Skips whitespace and comments in the text from 's' to 'end', and returns a
+// pointer to the first character that is not skipped. If the text ends in the
+// middle of a comment, stores the start of the comment in 'comment'. Otherwise,
+// stores NULL in it.
+static const char *skip_space(
+		const char *s, const char *end, const char **comment) {
+	*comment = NULL;
+	for (;;) {
+		s = find_nonspace(s, end);
+		if (s == end || *s != ';') {
+			return s;
+		}
+		const char *newline = memchr(s, '\n', (size_t)(end - s));
+		if (!newline) {
+			*comment = s;
+			return end;
+		}
+		s = newline + 1;
 	}
+}
 
-	struct ParseResult first = parse(s);
-	s += first.chars_read;
-	if (first.err_type != -1) {
-		result.err_type = first.err_type;
-		goto chars_read;
-	}
+size_t skip_whitespace(const char *text, size_t n) {
+	const char *comment;
+	return (size_t)(skip_space(text, text + n, &comment) - text);
+}
 
-	if (*s == '.') {
-		s++;
-		struct ParseResult second = parse(s);
-		s += second.chars_read;
-		if (second.err_type != -1) {
-			result.err_type = second.err_type;
-			release_expression(first.expr);
-			goto chars_read;
-		}
-		if (*s != ')') {
-			result.err_type = *s ? ERR_EXPECTED_RPAREN : ERR_UNEXPECTED_EOI;
-			release_expression(first.expr);
-			goto chars_read;
-		}
-		s++;
-		result.expr = new_pair(first.expr, second.expr);
-	} else {
-		struct ParseResult rest = parse_pair(s);
-		s += rest.chars_read;
-		if (rest.err_type != -1) {
-			result.err_type = rest.err_type;
-			release_expression(first.expr);
-			goto chars_read;
+// Returns the number of symbol characters at the beginning of 'text', looking
+// at no more than 'n' characters.
+static size_t skip_symbol(const char *text, size_t n) {
+	return (size_t)(find_delimiter(text, text + n) - text);
+}
+
+// Returns the number of string characters at the beginning of 'text', looking
+// at no more than 'n' characters. Assumes 'text[-1]' is a double quote. The
+// string continues until (but not including) the next double quote character
+// that is not escaped by a backslash. Returns 'n' if there is no such quote.
+static size_t skip_string(const char* text, size_t n) {
+	size_t i = 0;
+	while (i < n) {
+		i = (size_t)(find_string_special(text + i, text + n) - text);
+		if (i == n || text[i] == '"') {
+			break;
 		}
-		result.expr = new_pair(first.expr, rest.expr);
+		// Skip the backslash and the escaped character.
+		i += 2;
 	}
+	return MIN(i, n);
+}
 
-chars_read:
-	result.chars_read = (size_t)(s - text);
-	return result;
+struct Parser *new_parser(void) {
+	struct Parser *parser = xmalloc(sizeof *parser);
+	parser->pos = 0;
+	parser->pending = false;
+	parser->depth = 0;
+	parser->cap = 0;
+	parser->frames = NULL;
+	return parser;
 }
 
-// Parses any expression.
-struct ParseResult parse(const char *text) {
-	struct ParseResult result;
-	result.err_type = PARSE_SUCCESS;
-	const char *s = text;
-	s += skip_whitespace(s);
+void reset_parser(struct Parser *parser) {
+	for (size_t i = 0; i < parser->depth; i++) {
+		release_expression(parser->frames[i].list);
+	}
+	parser->pos = 0;
+	parser->pending = false;
+	parser->depth = 0;
+}
+
+void free_parser(struct Parser *parser) {
+	reset_parser(parser);
+	free(parser->frames);
+	free(parser);
+}
+
+bool parser_pending(const struct Parser *parser) {
+	return parser->pending;
+}
 
+// Pushes a new frame onto the parser stack.
+static void push_frame(
+		struct Parser *parser,
+		enum FrameKind kind,
+		enum StandardMacro stdmacro) {
+	if (parser->depth == parser->cap) {
+		parser->cap = parser->cap == 0 ? DEFAULT_STACK_CAP : parser->cap * 2;
+		parser->frames = xrealloc(parser->frames,
+				parser->cap * sizeof *parser->frames);
+	}
+	struct Frame *frame = parser->frames + parser->depth++;
+	frame->kind = kind;
+	frame->stdmacro = stdmacro;
+	frame->list = new_null();
+	frame->last = NULL;
+}
+
+// Parses an atom (a token that is not a list, quote, or string) beginning at
+// 's', where there are 'n' characters available. On success, stores the atom in
+// 'out'. Returns the number of characters read, and sets 'err_type' to
+// PARSE_SUCCESS or a ParseErrorType value. The error index is the start of the
+// atom plus the number of characters read.
+static size_t parse_atom(
+		const char *s, size_t n, struct Expression *out, int *err_type) {
+	*err_type = PARSE_SUCCESS;
 	size_t len;
-	switch (*s) {
-	case '\0':
-		result.err_type = ERR_UNEXPECTED_EOI;
-		break;
-	case '(':
-		s++;
-		result = parse_pair(s);
-		s += result.chars_read;
-		break;
-	case ')':
-		result.err_type = ERR_UNEXPECTED_RPAREN;
-		break;
-	case '.':
-		result.err_type = ERR_INVALID_DOT;
-		break;
-	case '#':
-		len = skip_symbol(s + 1);
+	if (*s == '#') {
+		len = skip_symbol(s + 1, n - 1);
 		if (len == 1 && s[1] == 't') {
-			s += 2;
-			result.expr = new_boolean(true);
-		} else if (len == 1 && s[1] == 'f') {
-			s += 2;
-			result.expr = new_boolean(false);
-		} else if (len > 2 && s[1] == '\\') {
+			*out = new_boolean(true);
+			return 2;
+		}
+		if (len == 1 && s[1] == 'f') {
+			*out = new_boolean(false);
+			return 2;
+		}
+		if (len > 2 && s[1] == '\\') {
 			char c = parse_char_name(s + 2, len - 1);
 			if (c == '\0') {
-				s += 2;
-				result.err_type = ERR_UNKNOWN_CHARACTER;
-			} else {
-				s += 1 + len;
-				result.expr = new_character(c);
+				*err_type = ERR_UNKNOWN_CHARACTER;
+				return 2;
 			}
-		} else if (s[1] == '\\' && s[2] && !isspace(s[2])) {
-			result.expr = new_character(s[2]);
-			s += 3;
-		} else {
-			result.err_type = ERR_INVALID_LITERAL;
+			*out = new_character(c);
+			return 1 + len;
 		}
-		break;
-	case '\'':
-		s++;
-		result = parse(s);
-		s += result.chars_read;
-		if (result.err_type == PARSE_SUCCESS) {
-			result.expr = new_pair(
-					new_stdmacro(F_QUOTE),
-					new_pair(result.expr, new_null()));
+		if (n > 2 && s[1] == '\\' && !is_space(s[2])) {
+			*out = new_character(s[2]);
+			return 3;
 		}
-		break;
-	case '`':
-		s++;
-		result = parse(s);
-		s += result.chars_read;
-		if (result.err_type == PARSE_SUCCESS) {
-			result.expr = new_pair(
-					new_stdmacro(F_QUASIQUOTE),
-					new_pair(result.expr, new_null()));
+		*err_type = ERR_INVALID_LITERAL;
+		return 0;
+	}
+
+	len = skip_symbol(s, n);
+	assert(len > 0);
+	Number number;
+	if (parse_number(s, len, &number)) {
+		*out = new_number(number);
+	} else {
+		*out = new_symbol(intern_string_n(s, len));
+	}
+	return len;
+}
+
+struct ParseResult continue_parse(
+		struct Parser *parser, const char *text, size_t n, bool final) {
+	struct ParseResult result;
+	const char *s = text + parser->pos;
+	const char *end = text + n;
+	const char *comment;
+	struct Expression expr;
+
+	for (;;) {
+		s = skip_space(s, end, &comment);
+		if (s == end) {
+			// Resume from the start of an unfinished comment, since the rest
+			// of it might not have been read yet.
+			if (comment && !final) {
+				s = comment;
+			}
+			parser->pending = parser->depth > 0;
+			goto incomplete;
 		}
-		break;
-	case ',':
-		s++;
-		enum StandardMacro stdmacro = F_UNQUOTE;
-		if (*s == '@') {
+
+		struct Frame *top = parser->depth > 0
+				? parser->frames + parser->depth - 1
+				: NULL;
+		if (top && top->kind == FRAME_DOT_END) {
+			if (*s != ')') {
+				result.err_type = ERR_EXPECTED_RPAREN;
+				goto error;
+			}
+			s++;
+			expr = top->list;
+			parser->depth--;
+			goto finish_expr;
+		}
+
+		size_t len;
+		switch (*s) {
+		case '(':
+			s++;
+			push_frame(parser, FRAME_LIST, F_QUOTE);
+			continue;
+		case ')':
+			if (!top || top->kind != FRAME_LIST) {
+				result.err_type = ERR_UNEXPECTED_RPAREN;
+				goto error;
+			}
+			s++;
+			expr = top->list;
+			parser->depth--;
+			goto finish_expr;
+		case '.':
+			if (!top || top->kind != FRAME_LIST || !top->last) {
+				result.err_type = ERR_INVALID_DOT;
+				goto error;
+			}
 			s++;
-			stdmacro = F_UNQUOTE_SPLICING;
+			top->kind = FRAME_DOT;
+			continue;
+		case '\'':
+			s++;
+			push_frame(parser, FRAME_QUOTE, F_QUOTE);
+			continue;
+		case '`':
+			s++;
+			push_frame(parser, FRAME_QUOTE, F_QUASIQUOTE);
+			continue;
+		case ',':
+			if (end - s < 2 && !final) {
+				// We can't tell yet if this is unquote-splicing.
+				parser->pending = true;
+				goto incomplete;
+			}
+			if (end - s >= 2 && s[1] == '@') {
+				s += 2;
+				push_frame(parser, FRAME_QUOTE, F_UNQUOTE_SPLICING);
+			} else {
+				s++;
+				push_frame(parser, FRAME_QUOTE, F_UNQUOTE);
+			}
+			continue;
+		case '"':
+			len = skip_string(s + 1, (size_t)(end - s - 1));
+			if (s + 1 + len == end) {
+				parser->pending = true;
+				goto incomplete;
+			}
+			expr = parse_string(s + 1, len);
+			s += len + 2;
+			goto finish_expr;
+		default:;
+			len = skip_symbol(s, (size_t)(end - s));
+			if (s + len == end && !final) {
+				// The atom might continue in text that has not been read yet.
+				parser->pending = true;
+				goto incomplete;
+			}
+			int err_type;
+			len = parse_atom(s, (size_t)(end - s), &expr, &err_type);
+			s += len;
+			if (err_type != PARSE_SUCCESS) {
+				result.err_type = err_type;
+				goto error;
+			}
+			goto finish_expr;
 		}
-		result = parse(s);
-		s += result.chars_read;
-		if (result.err_type == PARSE_SUCCESS) {
-			result.expr = new_pair(
-					new_stdmacro(stdmacro),
-					new_pair(result.expr, new_null()));
+
+finish_expr:
+		// Add the expression to its enclosing frames, if there are any.
+		while (parser->depth > 0) {
+			top = parser->frames + parser->depth - 1;
+			if (top->kind != FRAME_QUOTE) {
+				break;
+			}
+			expr = new_pair(
+					new_stdmacro(top->stdmacro),
+					new_pair(expr, new_null()));
+			parser->depth--;
 		}
-		break;
-	case '"':
-		s++;
-		len = skip_string(s);
-		if (!(s[len-1] == '\\' && (len < 2 || s[len-2] == '\\'))
-				&& s[len] == '"') {
-			result.expr = parse_string(s, len);
-		} else {
-			result.err_type = ERR_UNEXPECTED_EOI;
+		if (parser->depth == 0) {
+			s = skip_space(s, end, &comment);
+			if (comment && !final) {
+				s = comment;
+			}
+			result.err_type = PARSE_SUCCESS;
+			result.expr = expr;
+			result.chars_read = (size_t)(s - text);
+			parser->pos = 0;
+			parser->pending = false;
+			return result;
 		}
-		s += len;
-		s++;
-		break;
-	default:;
-		len = skip_symbol(s);
-		assert(len > 0);
-		Number number;
-		if (parse_number(s, len, &number)) {
-			result.expr = new_number(number);
+		if (top->kind == FRAME_LIST) {
+			struct Expression pair = new_pair(expr, new_null());
+			if (top->last) {
+				top->last->cdr = pair;
+			} else {
+				top->list = pair;
+			}
+			top->last = pair.box;
 		} else {
-			InternId symbol_id = intern_string_n(s, len);
-			result.expr = new_symbol(symbol_id);
+			assert(top->kind == FRAME_DOT);
+			top->last->cdr = expr;
+			top->kind = FRAME_DOT_END;
 		}
-		s += len;
-		break;
 	}
 
-	if (result.err_type == PARSE_SUCCESS) {
-		s += skip_whitespace(s);
-		assert(s > text);
-	}
+incomplete:
+	// Save the position so that parsing can continue when there is more text.
+	parser->pos = (size_t)(s - text);
+	result.err_type = ERR_UNEXPECTED_EOI;
+	result.chars_read = n;
+	return result;
+
+error:
+	reset_parser(parser);
 	result.chars_read = (size_t)(s - text);
 	return result;
 }
+
+struct ParseResult parse(const char *text) {
+	return parse_n(text, strlen(text));
+}
+
+struct ParseResult parse_n(const char *text, size_t n) {
+	struct Parser parser = {
+		.pos = 0,
+		.pending = false,
+		.depth = 0,
+		.cap = 0,
+		.frames = NULL
+	};
+	struct ParseResult result = continue_parse(&parser, text, n, true);
+	reset_parser(&parser);
+	free(parser.frames);
+	return result;
+}
@@ -5,6 +5,7 @@
 
 #include "expr.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 
 // Constant indicating that a parse was successful.
@@ -18,11 +19,50 @@ struct ParseResult {
 	int err_type;           // PARSE_SUCCESS or a ParseErrorType value
 };
 
+// A Parser holds the state of an unfinished parse, so that parsing can continue
+// when more text becomes available instead of starting over.
+struct Parser;
+
 // Parses a string as an s-expression of pairs, symbols, and numbers. On
 // success, returns the parse result with 'err_type' set to PARSE_SUCCESS.
 // Otherwise, returns a ParseErrorType in the result.
 struct ParseResult parse(const char *text);
 
+// Parses a string of 'n' characters as an s-expression. Does not require a null
+// terminator, so it can be used directly on memory-mapped files.
+struct ParseResult parse_n(const char *text, size_t n);
+
+// Creates a new parser with no unfinished expression.
+struct Parser *new_parser(void);
+
+// Discards the unfinished expression in the parser, if there is one.
+void reset_parser(struct Parser *parser);
+
+// Frees the memory associated with a parser.
+void free_parser(struct Parser *parser);
+
+// Parses 'text' of 'n' characters like 'parse_n', but picks up where the last
+// call left off. If the result is ERR_UNEXPECTED_EOI, the parser remembers its
+// progress, and the next call must pass the same text with more characters
+// appended (the text may move in memory). Otherwise, the parser is reset, and
+// the next call starts a new expression at the beginning of 'text'. In all
+// cases, 'chars_read' counts from the beginning of 'text'.
+//
+// If 'final' is false, more characters might follow 'text' directly, so an atom
+// or comment that runs into the end is considered unfinished. If it is true,
+// the end of 'text' acts as a delimiter.
+struct ParseResult continue_parse(
+		struct Parser *parser, const char *text, size_t n, bool final);
+
+// Returns true if the last call to 'continue_parse' on the parser ended in the
+// middle of an expression, as opposed to finding only whitespace.
+bool parser_pending(const struct Parser *parser);
+
+// Returns the number of leading whitespace characters in the first 'n'
+// characters of 'text'. Comments, which go from a semicolon to the end of the
+// line, are treated as whitespace.
+size_t skip_whitespace(const char *text, size_t n);
+
 // Attempts to parse a string of 'n' characters as a number. Does not require
 // a null terminator. On success, stores the integer in 'result' and returns
 // true. Otherwise, returns false.
@@ -0,0 +1,276 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "port.h"
+
+#include "error.h"
+#include "expr.h"
+#include "green.h"
+#include "parse.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size of the user-space buffer for each port.
+#define PORT_BUFFER_SIZE (1 << 16)
+
+// The buffer of an input port holds the unread characters in the range from
+// 'start' to 'end'. When more input is needed, the unread characters are moved
+// to the front and the buffer is filled from 'fd'. If the buffer is already
+// full, its capacity doubles. For regular files, the buffer is instead a
+// read-only mapping of the entire file, and 'eof' is true from the start.
+struct Port {
+	bool input;
+	bool open;
+	// Used by input ports:
+	int fd;
+	bool eof;
+	bool mapped;
+	char *buf;
+	size_t cap;
+	size_t start;
+	size_t end;
+	struct Parser *parser;
+	// Used by output ports:
+	FILE *stream;
+};
+
+struct Port *open_input_port(const char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct Port *port = open_input_fd(fd);
+	if (!port) {
+		close(fd);
+	}
+	return port;
+}
+
+struct Port *open_input_fd(int fd) {
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		return NULL;
+	}
+	struct Port *port = xmalloc(sizeof *port);
+	port->input = true;
+	port->open = true;
+	port->fd = fd;
+	port->parser = new_parser();
+	port->stream = NULL;
+
+	// Map regular files into memory, and fall back to reading for the rest.
+	// The mapping starts at the beginning of the file, so unread characters
+	// begin at the current file offset.
+	void *addr = MAP_FAILED;
+	off_t offset = 0;
+	if (S_ISREG(st.st_mode) && st.st_size > 0
+			&& (offset = lseek(fd, 0, SEEK_CUR)) != -1) {
+		addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (addr != MAP_FAILED) {
+		posix_madvise(addr, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+		port->eof = true;
+		port->mapped = true;
+		port->buf = addr;
+		port->cap = (size_t)st.st_size;
+		port->end = port->cap;
+		port->start = (size_t)offset < port->end ? (size_t)offset : port->end;
+	} else {
+		port->eof = false;
+		port->mapped = false;
+		port->cap = PORT_BUFFER_SIZE;
+		port->buf = xmalloc(port->cap);
+		port->start = 0;
+		port->end = 0;
+	}
+	return port;
+}
+
+struct Port *open_output_port(const char *filename) {
+	FILE *stream = fopen(filename, "w");
+	if (!stream) {
+		return NULL;
+	}
+	setvbuf(stream, NULL, _IOFBF, PORT_BUFFER_SIZE);
+	struct Port *port = xmalloc(sizeof *port);
+	port->input = false;
+	port->open = true;
+	port->fd = -1;
+	port->eof = true;
+	port->mapped = false;
+	port->buf = NULL;
+	port->cap = 0;
+	port->start = 0;
+	port->end = 0;
+	port->parser = NULL;
+	port->stream = stream;
+	return port;
+}
+
+bool port_is_input(const struct Port *port) {
+	return port->input;
+}
+
+bool port_is_open(const struct Port *port) {
+	return port->open;
+}
+
+void close_port(struct Port *port) {
+	if (!port->open) {
+		return;
+	}
+	port->open = false;
+	if (port->input) {
+		close(port->fd);
+		if (port->mapped) {
+			munmap(port->buf, port->cap);
+		} else {
+			free(port->buf);
+		}
+		port->buf = NULL;
+		port->start = 0;
+		port->end = 0;
+		free_parser(port->parser);
+		port->parser = NULL;
+	} else {
+		fclose(port->stream);
+		port->stream = NULL;
+	}
+}
+
+void free_port(struct Port *port) {
+	close_port(port);
+	free(port);
+}
+
+// Reads another block of input into the buffer of an input port. Returns false
+// if no more characters could be read because the end of the file was reached.
+static bool fill_port(struct Port *port) {
+	if (port->eof) {
+		return false;
+	}
+	// Move the unread characters to the front of the buffer.
+	if (port->start > 0) {
+		memmove(port->buf, port->buf + port->start, port->end - port->start);
+		port->end -= port->start;
+		port->start = 0;
+	}
+	// Double the buffer's capacity if it is full.
+	if (port->end == port->cap) {
+		port->cap *= 2;
+		port->buf = xrealloc(port->buf, port->cap);
+	}
+
+	wait_readable(port->fd);
+	ssize_t n;
+	do {
+		n = read(port->fd, port->buf + port->end, port->cap - port->end);
+	} while (n == -1 && errno == EINTR);
+	if (n <= 0) {
+		port->eof = true;
+		return false;
+	}
+	port->end += (size_t)n;
+	return true;
+}
+
+int port_read_char(struct Port *port) {
+	int c = port_peek_char(port);
+	if (c != EOF) {
+		port->start++;
+	}
+	return c;
+}
+
+int port_peek_char(struct Port *port) {
+	assert(port->input && port->open);
+	if (port->start == port->end && !fill_port(port)) {
+		return EOF;
+	}
+	return (unsigned char)port->buf[port->start];
+}
+
+bool port_match(struct Port *port, const char *prefix) {
+	assert(port->input && port->open);
+	size_t length = strlen(prefix);
+	while (port->end - port->start < length) {
+		if (!fill_port(port)) {
+			return false;
+		}
+	}
+	return memcmp(port->buf + port->start, prefix, length) == 0;
+}
+
+bool port_read_line(struct Port *port, char **out, size_t *length) {
+	assert(port->input && port->open);
+	// Number of characters after 'start' already known not to be newlines.
+	size_t scanned = 0;
+	for (;;) {
+		size_t avail = port->end - port->start;
+		char *line = port->buf + port->start;
+		char *newline = memchr(line + scanned, '\n', avail - scanned);
+		if (newline || (port->eof && avail > 0)) {
+			size_t len = newline ? (size_t)(newline - line) : avail;
+			*out = xmalloc(len);
+			memcpy(*out, line, len);
+			*length = len;
+			port->start += newline ? len + 1 : len;
+			return true;
+		}
+		scanned = avail;
+		if (!fill_port(port) && port->start == port->end) {
+			return false;
+		}
+	}
+}
+
+struct ParseError *port_read_sexpr(struct Port *port, struct Expression *out) {
+	assert(port->input && port->open);
+	for (;;) {
+		const char *text = port->buf + port->start;
+		size_t avail = port->end - port->start;
+		// Unless the end of the file has been reached, the expression might
+		// continue in the next block. The parser keeps its progress, so only
+		// the new characters are scanned after filling the buffer.
+		struct ParseResult result =
+			continue_parse(port->parser, text, avail, port->eof);
+		if (result.err_type == PARSE_SUCCESS) {
+			port->start += result.chars_read;
+			*out = result.expr;
+			return NULL;
+		}
+		if (result.err_type == ERR_UNEXPECTED_EOI && !port->eof) {
+			fill_port(port);
+			continue;
+		}
+		if (result.err_type == ERR_UNEXPECTED_EOI
+				&& !parser_pending(port->parser)) {
+			// Only whitespace is left.
+			port->start = port->end;
+			*out = new_eof();
+			return NULL;
+		}
+		// Give a copy of the unread input to the parse error, and discard it
+		// from the port.
+		reset_parser(port->parser);
+		char *copy = xmalloc(avail);
+		memcpy(copy, text, avail);
+		port->start = port->end;
+		return new_parse_error((enum ParseErrorType)result.err_type,
+				copy, avail, result.chars_read);
+	}
+}
+
+FILE *port_stream(struct Port *port) {
+	assert(!port->input && port->open);
+	return port->stream;
+}
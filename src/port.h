@@ -0,0 +1,66 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef PORT_H
+#define PORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct Expression;
+struct ParseError;
+
+// A port is a handle to a file opened for either input or output. Input ports
+// read from the file descriptor in large blocks into a user-space buffer, so
+// that reading characters and lines does not require a system call each time.
+// Output ports use a stdio stream with an equally large buffer.
+struct Port;
+
+// Opens a file for reading or writing. On success, returns the new port.
+// Otherwise, returns NULL and sets the global 'errno'.
+struct Port *open_input_port(const char *filename);
+struct Port *open_output_port(const char *filename);
+
+// Creates an input port that reads from an open file descriptor, starting at
+// its current offset. Returns NULL and sets 'errno' on failure. The port takes
+// ownership of the file descriptor, and closes it when the port is closed.
+struct Port *open_input_fd(int fd);
+
+// Returns true if the port was opened for input (as opposed to output).
+bool port_is_input(const struct Port *port);
+
+// Returns true if the port has not been closed yet.
+bool port_is_open(const struct Port *port);
+
+// Closes the port, flushing any buffered output. This is a no-op if the port is
+// already closed. The port itself remains valid until 'free_port' is called.
+void close_port(struct Port *port);
+
+// Closes the port if necessary and frees its memory.
+void free_port(struct Port *port);
+
+// Reads a character from an open input port and returns it (as an unsigned char
+// converted to an int). Returns EOF if there are no more characters. The 'peek'
+// variant does not consume the character.
+int port_read_char(struct Port *port);
+int port_peek_char(struct Port *port);
+
+// Returns true if the next unread characters of an open input port are equal
+// to 'prefix'. Does not consume any characters.
+bool port_match(struct Port *port, const char *prefix);
+
+// Reads a line from an open input port, not including the newline character.
+// On success, stores a newly allocated buffer in 'out' and its length in
+// 'length', and returns true. Returns false if there are no more characters.
+bool port_read_line(struct Port *port, char **out, size_t *length);
+
+// Reads and parses an s-expression from an open input port, reading more input
+// as necessary. On success, stores the expression in 'out' and returns NULL.
+// If there are no more expressions, stores an EOF expression instead. If the
+// parse fails, allocates and returns a parse error.
+struct ParseError *port_read_sexpr(struct Port *port, struct Expression *out);
+
+// Returns the stdio stream for an open output port.
+FILE *port_stream(struct Port *port);
+
+#endif
@@ -219,6 +219,11 @@
 
 (define (force promise) (promise))
 
+;;; Input and output
+
+(define close-input-port close-port)
+(define close-output-port close-port)
+
 ;;;;; Other procedures
 
 ;;; Printing
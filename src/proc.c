@@ -2,9 +2,13 @@
 
 #include "proc.h"
 
+#include "actor.h"
 #include "expr.h"
+#include "green.h"
+#include "heap.h"
 #include "intern.h"
 #include "parse.h"
+#include "port.h"
 #include "util.h"
 
 #include <stdbool.h>
@@ -338,7 +342,7 @@ static struct Expression s_string_to_symbol(struct Expression *args, size_t n) {
 static struct Expression s_symbol_to_string(struct Expression *args, size_t n) {
 	(void)n;
 	const char* str = find_string(args[0].symbol_id);
-	size_t len = strlen(str);
+	size_t len = find_string_length(args[0].symbol_id);
 	char *buf = xmalloc(len);
 	memcpy(buf, str, len);
 	return new_string(buf, len);
@@ -361,49 +365,156 @@ static struct Expression s_number_to_string(struct Expression *args, size_t n) {
 	return new_string(buf, len);
 }
 
+// Returns the output stream for a standard procedure that takes an optional
+// output port as argument number 'i'. Uses standard output if it is omitted.
+static FILE *output_stream(struct Expression *args, size_t n, size_t i) {
+	return n > i ? port_stream(args[i].box->port) : stdout;
+}
+
 static struct Expression s_write(struct Expression *args, size_t n) {
-	(void)n;
-	print_expression(args[0], stdout);
-	putchar('\n');
+	FILE *stream = output_stream(args, n, 1);
+	print_expression(args[0], stream);
+	putc('\n', stream);
+	return new_void();
+}
+
+static struct Expression s_write_shared(struct Expression *args, size_t n) {
+	FILE *stream = output_stream(args, n, 1);
+	print_expression_shared(args[0], stream);
+	putc('\n', stream);
 	return new_void();
 }
 
 static struct Expression s_display(struct Expression *args, size_t n) {
-	(void)n;
+	FILE *stream = output_stream(args, n, 1);
 	switch (args[0].type) {
 	case E_CHARACTER:
-		putchar(args[0].character);
+		putc(args[0].character, stream);
 		break;
 	case E_STRING:
-		printf("%.*s", (int)args[0].box->len, args[0].box->str);
+		fwrite(args[0].box->str, 1, args[0].box->len, stream);
 		break;
 	default:
-		print_expression(args[0], stdout);
+		print_expression(args[0], stream);
 		break;
 	}
 	return new_void();
 }
 
 static struct Expression s_newline(struct Expression *args, size_t n) {
+	putc('\n', output_stream(args, n, 0));
+	return new_void();
+}
+
+static struct Expression s_close_port(struct Expression *args, size_t n) {
 	(void)n;
+	close_port(args[0].box->port);
+	return new_void();
+}
+
+static struct Expression s_read_char(struct Expression *args, size_t n) {
+	(void)n;
+	int c = port_read_char(args[0].box->port);
+	return c == EOF ? new_eof() : new_character((char)c);
+}
+
+static struct Expression s_peek_char(struct Expression *args, size_t n) {
+	(void)n;
+	int c = port_peek_char(args[0].box->port);
+	return c == EOF ? new_eof() : new_character((char)c);
+}
+
+static struct Expression s_read_line(struct Expression *args, size_t n) {
+	(void)n;
+	char *buf;
+	size_t len;
+	if (!port_read_line(args[0].box->port, &buf, &len)) {
+		return new_eof();
+	}
+	return new_string(buf, len);
+}
+
+static struct Expression s_write_string(struct Expression *args, size_t n) {
+	fwrite(args[0].box->str, 1, args[0].box->len, output_stream(args, n, 1));
+	return new_void();
+}
+
+static struct Expression s_heap_stats(struct Expression *args, size_t n) {
 	(void)args;
-	putchar('\n');
+	(void)n;
+	struct HeapStats hs = heap_stats();
+	const struct {
+		const char *name;
+		size_t value;
+	} fields[] = {
+		{"pairs", hs.pairs},
+		{"strings", hs.strings},
+		{"procedures", hs.procedures},
+		{"ports", hs.ports},
+		{"bytes", hs.bytes},
+		{"allocations", hs.allocations},
+		{"frees", hs.frees},
+		{"environments", hs.environments},
+		{"environment-depth", hs.environments == 0
+			? 0
+			: (hs.depth_total + hs.environments / 2) / hs.environments},
+		{"cpu-milliseconds", (size_t)(hs.seconds * 1000)}
+	};
+	// Build the association list backwards.
+	struct Expression list = new_null();
+	for (size_t i = sizeof fields / sizeof *fields; i-- > 0;) {
+		struct Expression entry = new_pair(
+				new_symbol(intern_string(fields[i].name)),
+				new_number((Number)fields[i].value));
+		list = new_pair(entry, list);
+	}
+	return list;
+}
+
+static struct Expression s_yield(struct Expression *args, size_t n) {
+	(void)args;
+	(void)n;
+	yield_green_thread();
 	return new_void();
 }
 
+static struct Expression s_make_channel(struct Expression *args, size_t n) {
+	(void)args;
+	(void)n;
+	return new_channel(make_channel());
+}
+
+static struct Expression s_actor_self(struct Expression *args, size_t n) {
+	(void)args;
+	(void)n;
+	return new_actor(retain_actor(self_actor()));
+}
+
+static struct Expression s_actor_recv(struct Expression *args, size_t n) {
+	(void)args;
+	(void)n;
+	return receive_message();
+}
+
 // A mapping from standard procedures to their implementations.
 static const Implementation implementation_table[N_STANDARD_PROCEDURES] = {
 	[S_EVAL]             = NULL,
 	[S_APPLY]            = NULL,
 	[S_MACRO]            = s_macro,
+	[S_VOIDP]            = NULL,
+	[S_EOFP]             = NULL,
 	[S_NULLP]            = NULL,
 	[S_SYMBOLP]          = NULL,
 	[S_NUMBERP]          = NULL,
 	[S_BOOLEANP]         = NULL,
 	[S_STRINGP]          = NULL,
+	[S_PORTP]            = NULL,
 	[S_PAIRP]            = NULL,
 	[S_MACROP]           = NULL,
 	[S_PROCEDUREP]       = NULL,
+	[S_FUTUREP]          = NULL,
+	[S_CHANNELP]         = NULL,
+	[S_ACTORP]           = NULL,
 	[S_EQ]               = s_eq,
 	[S_NUM_EQ]           = s_num_eq,
 	[S_NUM_LT]           = s_num_lt,
@@ -449,15 +560,41 @@ static const Implementation implementation_table[N_STANDARD_PROCEDURES] = {
 	[S_NUMBER_TO_STRING] = s_number_to_string,
 	[S_READ]             = NULL,
 	[S_WRITE]            = s_write,
+	[S_WRITE_SHARED]     = s_write_shared,
 	[S_DISPLAY]          = s_display,
 	[S_NEWLINE]          = s_newline,
 	[S_ERROR]            = NULL,
-	[S_LOAD]             = NULL
+	[S_LOAD]             = NULL,
+	[S_OPEN_INPUT_FILE]  = NULL,
+	[S_OPEN_OUTPUT_FILE] = NULL,
+	[S_CLOSE_PORT]       = s_close_port,
+	[S_CALL_INPUT_FILE]  = NULL,
+	[S_CALL_OUTPUT_FILE] = NULL,
+	[S_READ_CHAR]        = s_read_char,
+	[S_PEEK_CHAR]        = s_peek_char,
+	[S_READ_LINE]        = s_read_line,
+	[S_WRITE_STRING]     = s_write_string,
+	[S_HEAP_STATS]       = s_heap_stats,
+	[S_CALL_WITH_TIMING] = NULL,
+	[S_PMAP]             = NULL,
+	[S_PFOR_EACH]        = NULL,
+	[S_PREDUCE]          = NULL,
+	[S_TOUCH]            = NULL,
+	[S_SPAWN]            = NULL,
+	[S_YIELD]            = s_yield,
+	[S_MAKE_CHANNEL]     = s_make_channel,
+	[S_CHANNEL_SEND]     = NULL,
+	[S_CHANNEL_RECV]     = NULL,
+	[S_SPAWN_ACTOR]      = NULL,
+	[S_ACTOR_SELF]       = s_actor_self,
+	[S_ACTOR_SEND]       = NULL,
+	[S_ACTOR_RECV]       = s_actor_recv
 };
 
 // A mapping from expression types to the type predicates they satisfy.
 static const enum StandardProcedure predicate_table[N_EXPRESSION_TYPES] = {
 	[E_VOID]         = S_VOIDP,
+	[E_EOF]          = S_EOFP,
 	[E_NULL]         = S_NULLP,
 	[E_SYMBOL]       = S_SYMBOLP,
 	[E_NUMBER]       = S_NUMBERP,
@@ -468,13 +605,17 @@ static const enum StandardProcedure predicate_table[N_EXPRESSION_TYPES] = {
 	[E_PAIR]         = S_PAIRP,
 	[E_STRING]       = S_STRINGP,
 	[E_MACRO]        = S_MACROP,
-	[E_PROCEDURE]    = S_PROCEDUREP
+	[E_PROCEDURE]    = S_PROCEDUREP,
+	[E_PORT]         = S_PORTP,
+	[E_FUTURE]       = S_FUTUREP,
+	[E_CHANNEL]      = S_CHANNELP,
+	[E_ACTOR]        = S_ACTORP
 };
 
 struct Expression invoke_stdprocedure(
 		enum StandardProcedure stdproc, struct Expression *args, size_t n) {
 	// Handle predicates as a special case.
-	if (stdproc >= S_VOIDP && stdproc <= S_PROCEDUREP) {
+	if (stdproc >= S_VOIDP && stdproc <= S_ACTORP) {
 		return new_boolean(predicate_table[args[0].type] == stdproc);
 	}
 	// Look up the implementation in the table.
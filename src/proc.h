@@ -10,7 +10,8 @@
 // Invokes the implementation for the standard procedure applied to 'args' (an
 // array of 'n' arguments), and returns the resulting expression. Assumes the
 // application has already been type-checked. The standard procedure cannot be
-// S_EVAL, S_APPLY, S_READ, S_ERROR, or S_LOAD.
+// S_EVAL, S_APPLY, S_READ, S_ERROR, S_LOAD, S_OPEN_INPUT_FILE,
+// S_OPEN_OUTPUT_FILE, S_CALL_INPUT_FILE, or S_CALL_OUTPUT_FILE.
 struct Expression invoke_stdprocedure(
 		enum StandardProcedure stdproc, struct Expression *args, size_t n);
 
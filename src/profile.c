@@ -0,0 +1,390 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "profile.h"
+
+#include "intern.h"
+#include "util.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Sampling interval, in microseconds of CPU time.
+#define INTERVAL_US 1000
+
+// Maximum depth of the call stack that is recorded. Deeper calls are counted,
+// but their frames are not stored.
+#define STACK_CAP (1 << 20)
+
+// Maximum number of frames kept in a sample, counting from the innermost.
+#define SAMPLE_DEPTH 256
+
+// Capacity of the sample buffer in frames. Samples are aggregated once the
+// buffer is half full, so that the signal handler rarely finds it full.
+#define BUFFER_CAP (1 << 20)
+
+// Initial capacity of the hash tables used for aggregating samples.
+#define DEFAULT_TABLE_CAP 256
+
+// Number of procedures listed in each report.
+#define REPORT_ROWS 20
+
+// A frame identifies a procedure. It is either the interned name of a procedure
+// created by 'define', ANONYMOUS, a standard procedure with STDPROC_BIT set, or
+// one of the pseudo-frames below.
+#define STDPROC_BIT 0x80000000u
+#define FRAME_TOPLEVEL (ANONYMOUS - 1)
+#define FRAME_TRUNCATED (ANONYMOUS - 2)
+
+bool profile_enabled = false;
+
+// True on the thread that started the profiler. Other threads, such as those of
+// actors, are not profiled.
+static _Thread_local bool profiled_thread = false;
+
+// The call stack maintained by 'profile_enter' and 'profile_leave'.
+static uint32_t *stack = NULL;
+static volatile size_t stack_depth = 0;
+
+// Samples not yet aggregated, written by the signal handler. Each sample is its
+// number of frames followed by the frames, from the outermost to innermost.
+static uint32_t *buffer = NULL;
+static volatile size_t buffer_len = 0;
+static volatile sig_atomic_t drain_pending = 0;
+static volatile size_t dropped = 0;
+
+// A distinct stack that was sampled, and the number of times it was seen.
+struct Stack {
+	uint32_t *frames; // NULL for an empty slot
+	size_t n_frames;
+	size_t count;
+	uint64_t hash;
+};
+
+// Open-addressing hash table of sampled stacks.
+static struct Stack *stacks = NULL;
+static size_t stacks_len = 0;
+static size_t stacks_cap = 0;
+static size_t total_samples = 0;
+
+static uint64_t hash_frames(const uint32_t *frames, size_t n) {
+	uint64_t h = 14695981039346656037u;
+	for (size_t i = 0; i < n; i++) {
+		h ^= frames[i];
+		h *= 1099511628211u;
+	}
+	return h;
+}
+
+// Inserts a stack into 'table', which must have room for it.
+static struct Stack *insert_stack(
+		struct Stack *table, size_t cap, const struct Stack *s) {
+	size_t mask = cap - 1;
+	size_t i = (size_t)s->hash & mask;
+	while (table[i].frames) {
+		i = (i + 1) & mask;
+	}
+	table[i] = *s;
+	return table + i;
+}
+
+// Counts one occurrence of the stack 'frames' (an array of 'n' frames).
+static void add_stack(const uint32_t *frames, size_t n) {
+	total_samples++;
+	uint64_t hash = hash_frames(frames, n);
+	if (stacks_cap > 0) {
+		size_t mask = stacks_cap - 1;
+		for (size_t i = (size_t)hash & mask; stacks[i].frames;
+				i = (i + 1) & mask) {
+			struct Stack *s = stacks + i;
+			if (s->hash == hash && s->n_frames == n
+					&& memcmp(s->frames, frames, n * sizeof *frames) == 0) {
+				s->count++;
+				return;
+			}
+		}
+	}
+
+	if (2 * (stacks_len + 1) > stacks_cap) {
+		size_t cap = stacks_cap == 0 ? DEFAULT_TABLE_CAP : stacks_cap * 2;
+		struct Stack *table = xmalloc(cap * sizeof *table);
+		memset(table, 0, cap * sizeof *table);
+		for (size_t i = 0; i < stacks_cap; i++) {
+			if (stacks[i].frames) {
+				insert_stack(table, cap, stacks + i);
+			}
+		}
+		free(stacks);
+		stacks = table;
+		stacks_cap = cap;
+	}
+	struct Stack s = {
+		.frames = xmalloc(n * sizeof *frames),
+		.n_frames = n,
+		.count = 1,
+		.hash = hash
+	};
+	memcpy(s.frames, frames, n * sizeof *frames);
+	insert_stack(stacks, stacks_cap, &s);
+	stacks_len++;
+}
+
+// Aggregates the samples in the buffer, with SIGPROF blocked.
+static void drain(void) {
+	sigset_t set, old;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPROF);
+	sigprocmask(SIG_BLOCK, &set, &old);
+	size_t i = 0;
+	while (i < buffer_len) {
+		size_t n = buffer[i];
+		add_stack(buffer + i + 1, n);
+		i += n + 1;
+	}
+	buffer_len = 0;
+	drain_pending = 0;
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+static void handle_sigprof(int sig) {
+	(void)sig;
+	size_t depth = stack_depth;
+	size_t stored = MIN(depth, (size_t)STACK_CAP);
+	bool truncated = depth > SAMPLE_DEPTH;
+	size_t n = truncated ? SAMPLE_DEPTH : MAX(depth, (size_t)1);
+	size_t len = buffer_len;
+	if (len + n + 1 > BUFFER_CAP) {
+		dropped++;
+		drain_pending = 1;
+		return;
+	}
+	uint32_t *out = buffer + len;
+	*out++ = (uint32_t)n;
+	if (depth == 0) {
+		*out++ = FRAME_TOPLEVEL;
+	} else if (truncated) {
+		*out++ = FRAME_TRUNCATED;
+		memcpy(out, stack + stored - (n - 1), (n - 1) * sizeof *stack);
+	} else {
+		memcpy(out, stack, n * sizeof *stack);
+	}
+	buffer_len = len + n + 1;
+	if (buffer_len > BUFFER_CAP / 2) {
+		drain_pending = 1;
+	}
+}
+
+void start_profile(void) {
+	stack = xmalloc(STACK_CAP * sizeof *stack);
+	buffer = xmalloc(BUFFER_CAP * sizeof *buffer);
+	profile_enabled = true;
+	profiled_thread = true;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof action);
+	action.sa_handler = handle_sigprof;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, NULL);
+
+	struct itimerval timer = {
+		.it_interval = { .tv_sec = 0, .tv_usec = INTERVAL_US },
+		.it_value = { .tv_sec = 0, .tv_usec = INTERVAL_US }
+	};
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void profile_enter(struct Expression expr) {
+	if (!profiled_thread) {
+		return;
+	}
+	uint32_t frame = expr.type == E_STDPROCEDURE || expr.type == E_STDPROCMACRO
+		? STDPROC_BIT | (uint32_t)expr.stdproc
+		: expr.box->name;
+	size_t depth = stack_depth;
+	if (depth < STACK_CAP) {
+		stack[depth] = frame;
+	}
+	// Make sure the frame is stored before the signal handler can see it.
+	atomic_signal_fence(memory_order_release);
+	stack_depth = depth + 1;
+	if (drain_pending) {
+		drain();
+	}
+}
+
+void profile_leave(void) {
+	if (!profiled_thread) {
+		return;
+	}
+	stack_depth--;
+}
+
+static const char *frame_name(uint32_t frame) {
+	switch (frame) {
+	case ANONYMOUS:
+		return "<lambda>";
+	case FRAME_TOPLEVEL:
+		return "<toplevel>";
+	case FRAME_TRUNCATED:
+		return "...";
+	default:
+		if (frame & STDPROC_BIT) {
+			return stdproc_name((enum StandardProcedure)(frame & ~STDPROC_BIT));
+		}
+		return find_string(frame);
+	}
+}
+
+// Time attributed to a frame. The 'stamp' field remembers the last stack that
+// counted towards 'total', so that recursive calls are only counted once.
+struct FrameTime {
+	uint32_t frame;
+	bool used;
+	size_t self;
+	size_t total;
+	size_t stamp;
+};
+
+// Returns the entry for 'frame' in 'table', an open-addressing hash table with
+// capacity 'cap' that is always large enough.
+static struct FrameTime *frame_time(
+		struct FrameTime *table, size_t cap, uint32_t frame) {
+	size_t mask = cap - 1;
+	size_t i = (frame * 2654435761u) & mask;
+	while (table[i].used && table[i].frame != frame) {
+		i = (i + 1) & mask;
+	}
+	if (!table[i].used) {
+		table[i] = (struct FrameTime){ .frame = frame, .used = true };
+	}
+	return table + i;
+}
+
+static int compare_self(const void *lhs, const void *rhs) {
+	const struct FrameTime *a = lhs, *b = rhs;
+	return (a->self < b->self) - (a->self > b->self);
+}
+
+static int compare_total(const void *lhs, const void *rhs) {
+	const struct FrameTime *a = lhs, *b = rhs;
+	return (a->total < b->total) - (a->total > b->total);
+}
+
+static void print_rows(const char *title, const struct FrameTime *rows,
+		size_t n, bool by_self) {
+	fprintf(stderr, "%s\n%8s %6s %8s %6s  %s\n",
+			title, "self", "self%", "total", "total%", "procedure");
+	for (size_t i = 0; i < MIN(n, (size_t)REPORT_ROWS); i++) {
+		if ((by_self ? rows[i].self : rows[i].total) == 0) {
+			break;
+		}
+		fprintf(stderr, "%8zu %5.1f%% %8zu %5.1f%%  %s\n",
+				rows[i].self, 100.0 * (double)rows[i].self / total_samples,
+				rows[i].total, 100.0 * (double)rows[i].total / total_samples,
+				frame_name(rows[i].frame));
+	}
+}
+
+// Prints the flat and cumulative reports to standard error.
+static void print_report(void) {
+	size_t n_frames = 0;
+	for (size_t i = 0; i < stacks_cap; i++) {
+		n_frames += stacks[i].frames ? stacks[i].n_frames : 0;
+	}
+	size_t cap = DEFAULT_TABLE_CAP;
+	while (cap < 2 * n_frames) {
+		cap *= 2;
+	}
+	struct FrameTime *table = xmalloc(cap * sizeof *table);
+	memset(table, 0, cap * sizeof *table);
+	for (size_t i = 0; i < stacks_cap; i++) {
+		const struct Stack *s = stacks + i;
+		if (!s->frames) {
+			continue;
+		}
+		for (size_t j = 0; j < s->n_frames; j++) {
+			struct FrameTime *t = frame_time(table, cap, s->frames[j]);
+			if (t->stamp != i + 1) {
+				t->stamp = i + 1;
+				t->total += s->count;
+			}
+			if (j == s->n_frames - 1) {
+				t->self += s->count;
+			}
+		}
+	}
+
+	// Pack the used entries at the start of the table.
+	size_t n = 0;
+	for (size_t i = 0; i < cap; i++) {
+		if (table[i].used) {
+			table[n++] = table[i];
+		}
+	}
+
+	fprintf(stderr, "profile: %zu samples, %d us interval, %zu dropped\n",
+			total_samples, INTERVAL_US, (size_t)dropped);
+	qsort(table, n, sizeof *table, compare_self);
+	print_rows("flat:", table, n, true);
+	qsort(table, n, sizeof *table, compare_total);
+	print_rows("cumulative:", table, n, false);
+	free(table);
+}
+
+// Writes the sampled stacks to 'filename' in the folded format: each line has
+// the frames from outermost to innermost separated by semicolons, a space, and
+// the number of samples.
+static bool write_folded(const char *filename) {
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		return false;
+	}
+	for (size_t i = 0; i < stacks_cap; i++) {
+		const struct Stack *s = stacks + i;
+		if (!s->frames) {
+			continue;
+		}
+		for (size_t j = 0; j < s->n_frames; j++) {
+			if (j > 0) {
+				putc(';', file);
+			}
+			fputs(frame_name(s->frames[j]), file);
+		}
+		fprintf(file, " %zu\n", s->count);
+	}
+	return fclose(file) == 0;
+}
+
+const char *stop_profile(const char *filename) {
+	struct itimerval timer;
+	memset(&timer, 0, sizeof timer);
+	setitimer(ITIMER_PROF, &timer, NULL);
+	signal(SIGPROF, SIG_IGN);
+	profile_enabled = false;
+	profiled_thread = false;
+	drain();
+
+	print_report();
+	const char *err = write_folded(filename)
+		? NULL
+		: "Failed to write profile";
+
+	for (size_t i = 0; i < stacks_cap; i++) {
+		free(stacks[i].frames);
+	}
+	free(stacks);
+	free(stack);
+	free(buffer);
+	stacks = NULL;
+	stacks_len = stacks_cap = total_samples = 0;
+	stack = buffer = NULL;
+	return err;
+}
@@ -0,0 +1,35 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "expr.h"
+
+#include <stdbool.h>
+
+// The profiler samples the Scheme call stack on a timer driven by SIGPROF, so
+// it measures CPU time. The evaluator keeps a stack of the procedures being
+// applied while profiling is enabled, and the signal handler only copies it
+// into a buffer. Samples are aggregated outside the handler.
+
+// True while the profiler is running. The evaluator checks this before calling
+// 'profile_enter' and 'profile_leave'.
+extern bool profile_enabled;
+
+// Starts sampling the call stack.
+void start_profile(void);
+
+// Stops sampling, prints a flat profile (by time spent in each procedure
+// itself) and a cumulative profile (by time spent in each procedure and its
+// callees) to standard error, and writes every sampled stack to 'filename' in
+// the folded format used by flame graph tools. Returns NULL on success.
+// Otherwise, returns an error message.
+const char *stop_profile(const char *filename);
+
+// Pushes the procedure or macro 'expr' onto the profiled call stack.
+void profile_enter(struct Expression expr);
+
+// Pops the last procedure pushed by 'profile_enter'.
+void profile_leave(void);
+
+#endif
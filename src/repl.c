@@ -2,9 +2,12 @@
 
 #include "repl.h"
 
+#include "context.h"
+#include "env.h"
 #include "error.h"
 #include "eval.h"
 #include "parse.h"
+#include "port.h"
 #include "util.h"
 
 #include <readline/readline.h>
@@ -13,14 +16,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // String constants for prompts.
 static const char *const primary_prompt = "eva> ";
 static const char *const secondary_prompt = "...> ";
 
-// Storage for buffers in between calls to 'read_sexpr'.
-static char *saved_buffer = NULL;
-static size_t saved_buffer_offset = 0;
+// Each context stores leftover input in between calls to 'read_sexpr' in its
+// 'saved_buffer', and the parser used by 'read_sexpr' in 'read_parser', which
+// keeps its state across lines. Its 'stdin_port' is used for reading standard
+// input when it is not a terminal. The port is shared by the REPL and
+// 'read_sexpr', since either may leave input in its buffer.
+
+// Returns the port for standard input, creating it if necessary. The port reads
+// from a duplicate of the descriptor, so freeing it leaves standard input open.
+static struct Port *get_stdin_port(void) {
+	struct EvaContext *ctx = current_context;
+	if (!ctx->repl.stdin_port) {
+		int fd = dup(STDIN_FILENO);
+		ctx->repl.stdin_port = fd == -1 ? NULL : open_input_fd(fd);
+		if (!ctx->repl.stdin_port) {
+			perror(stdin_filename);
+			exit(1);
+		}
+	}
+	return ctx->repl.stdin_port;
+}
+
+void free_repl_state(void) {
+	struct EvaContext *ctx = current_context;
+	free(ctx->repl.saved_buffer);
+	if (ctx->repl.read_parser) {
+		free_parser(ctx->repl.read_parser);
+	}
+	if (ctx->repl.stdin_port) {
+		free_port(ctx->repl.stdin_port);
+	}
+	memset(&ctx->repl, 0, sizeof ctx->repl);
+}
 
 void setup_readline(void) {
 	// Disable tab completion.
@@ -28,30 +61,43 @@ void setup_readline(void) {
 }
 
 struct ParseError *read_sexpr(struct Expression *out) {
+	struct EvaContext *ctx = current_context;
+	if (ctx->repl.stdin_port || !isatty(STDIN_FILENO)) {
+		return port_read_sexpr(get_stdin_port(), out);
+	}
+	if (!ctx->repl.read_parser) {
+		ctx->repl.read_parser = new_parser();
+	}
+	struct Parser *read_parser = ctx->repl.read_parser;
 	char *buf;
 	size_t buf_length;
+	size_t offset;
 	struct ParseResult data;
-	if (saved_buffer) {
+	if (ctx->repl.saved_buffer) {
 		// If there is leftover input, use it.
-		buf = strdup(saved_buffer + saved_buffer_offset);
-		free(saved_buffer);
-		saved_buffer = NULL;
-		saved_buffer_offset = 0;
-		buf_length = strlen(buf);
-		data = parse(buf);
+		buf = ctx->repl.saved_buffer;
+		buf_length = ctx->repl.saved_buffer_length;
+		offset = ctx->repl.saved_buffer_offset;
+		ctx->repl.saved_buffer = NULL;
+		data = continue_parse(
+				read_parser, buf + offset, buf_length - offset, true);
 	} else {
 		// Otherwise, start with an empty string.
-		buf = strdup("");
+		buf = NULL;
 		buf_length = 0;
+		offset = 0;
+		data.chars_read = 0;
 		data.err_type = ERR_UNEXPECTED_EOI;
 	}
 
 	// Read lines until the string is parsed successfully, or until a parse
-	// error is encountered that cannot be fixed by reading more input.
+	// error is encountered that cannot be fixed by reading more input. The
+	// parser keeps its progress, so each line is only scanned once.
 	while (data.err_type == ERR_UNEXPECTED_EOI) {
 		char *line = readline("");
 		if (!line) {
 			// EOF: stop reading.
+			reset_parser(read_parser);
 			break;
 		} else if (!*line) {
 			// Empty string: keep reading.
@@ -68,20 +114,27 @@ struct ParseError *read_sexpr(struct Expression *out) {
 		free(line);
 		buf[buf_length + line_length + 1] = '\0';
 		buf_length += line_length + 1;
-		// Attempt to parse the new buffer.
-		data = parse(buf);
+		// Continue parsing with the new line.
+		data = continue_parse(
+				read_parser, buf + offset, buf_length - offset, true);
 	}
 
 	if (data.err_type != PARSE_SUCCESS) {
 		// Give ownership of the buffer to the parse erorr.
+		if (!buf) {
+			buf = xmalloc(1);
+			buf[0] = '\0';
+		}
 		return new_parse_error((enum ParseErrorType)data.err_type,
-				buf, data.chars_read);
+				buf, buf_length, offset + data.chars_read);
 	}
 
 	// Save leftover input, if there is any.
-	if (data.chars_read > 0 && data.chars_read < buf_length) {
-		saved_buffer = buf;
-		saved_buffer_offset = data.chars_read;
+	offset += data.chars_read;
+	if (offset < buf_length) {
+		ctx->repl.saved_buffer = buf;
+		ctx->repl.saved_buffer_length = buf_length;
+		ctx->repl.saved_buffer_offset = offset;
 	} else {
 		free(buf);
 	}
@@ -90,39 +143,31 @@ struct ParseError *read_sexpr(struct Expression *out) {
 	return NULL;
 }
 
-// Returns the number of shebang characters at the beginning of 'text'. A
-// shebang consists of "#!" followed by any characters until the end of the
-// line, including the newline character.
-static size_t skip_shebang(const char *text) {
-	const char *s = text;
-	if (*s++ != '#' || *s++ != '!') {
+size_t skip_shebang(const char *text, size_t length) {
+	if (length < 2 || text[0] != '#' || text[1] != '!') {
 		return 0;
 	}
-	while (*s && *s != '\n') {
-		s++;
-	}
-	if (*s) {
-		s++;
-	}
-	return (size_t)(s - text);
+	const char *newline = memchr(text, '\n', length);
+	return newline ? (size_t)(newline - text) + 1 : length;
 }
 
 bool execute(
 		const char *filename,
 		const char *text,
+		size_t length,
 		struct Environment *env,
 		bool print) {
-	size_t length = strlen(text);
-	size_t offset = skip_shebang(text);
+	size_t offset = skip_shebang(text, length);
 
 	// Parse and evaluate until there is no text left.
 	while (offset < length) {
 		// Parse from the current offset.
-		struct ParseResult code = parse(text + offset);
+		struct ParseResult code = parse_n(text + offset, length - offset);
 		if (code.err_type != PARSE_SUCCESS) {
 			struct ParseError err = {
 				.type = (enum ParseErrorType)code.err_type,
 				.text = text,
+				.length = length,
 				.index = offset + code.chars_read
 			};
 			print_parse_error(filename, &err);
@@ -148,40 +193,195 @@ bool execute(
 	return true;
 }
 
+bool execute_in_child(
+		const char *filename,
+		const char *text,
+		size_t length,
+		struct Environment *env,
+		bool print) {
+	struct Environment *child = new_environment(env, 0);
+	bool success = execute(filename, text, length, child, print);
+	release_environment(child);
+	return success;
+}
+
+bool execute_file(const char *filename, struct Environment *env) {
+	struct FileContents contents;
+	if (!map_file(filename, &contents)) {
+		print_file_error(filename);
+		return false;
+	}
+	bool success = execute(filename, contents.data, contents.length, env,
+			false);
+	unmap_file(contents);
+	return success;
+}
+
+// Writes the expression to 'stream' like the 'display' procedure.
+static void display_expression(struct Expression expr, FILE *stream) {
+	switch (expr.type) {
+	case E_CHARACTER:
+		putc(expr.character, stream);
+		break;
+	case E_STRING:
+		fwrite(expr.box->str, 1, expr.box->len, stream);
+		break;
+	default:
+		print_expression(expr, stream);
+		break;
+	}
+}
+
+// Parses and evaluates the single expression in 'code'. On success, stores
+// the result in 'out' and returns true. Otherwise, prints an error message and
+// returns false.
+static bool evaluate_argument(
+		const char *code, struct Environment *env, struct Expression *out) {
+	size_t length = strlen(code);
+	struct ParseResult parsed = parse_n(code, length);
+	if (parsed.err_type != PARSE_SUCCESS) {
+		struct ParseError err = {
+			.type = (enum ParseErrorType)parsed.err_type,
+			.text = code,
+			.length = length,
+			.index = parsed.chars_read
+		};
+		print_parse_error(argv_filename, &err);
+		return false;
+	}
+	struct EvalResult result = eval(parsed.expr, env, true);
+	release_expression(parsed.expr);
+	if (result.err) {
+		print_eval_error(argv_filename, result.err);
+		free_eval_error(result.err);
+		return false;
+	}
+	*out = result.expr;
+	return true;
+}
+
+bool process_lines(
+		const char *proc_code,
+		const char *begin,
+		const char *end,
+		struct Environment *env) {
+	if (begin && !execute(argv_filename, begin, strlen(begin), env, false)) {
+		return false;
+	}
+	struct Expression proc;
+	if (!evaluate_argument(proc_code, env, &proc)) {
+		return false;
+	}
+
+	struct Port *port = get_stdin_port();
+	bool success = true;
+	char *line;
+	size_t length;
+	while (port_read_line(port, &line, &length)) {
+		struct Expression arg = new_string(line, length);
+		struct EvalResult result = apply_procedure(proc, &arg, 1, env);
+		if (result.err) {
+			// The standard procedure "error" keeps its argument array in the
+			// error, which must be on the heap.
+			if (result.err->type == ERR_CUSTOM
+					&& result.err->array.exprs == &arg) {
+				result.err->array.exprs = xmalloc(sizeof arg);
+				result.err->array.exprs[0] = arg;
+			}
+			print_eval_error(stdin_filename, result.err);
+			free_eval_error(result.err);
+			release_expression(arg);
+			success = false;
+			break;
+		}
+		release_expression(arg);
+		if (result.expr.type != E_VOID) {
+			display_expression(result.expr, stdout);
+			putchar('\n');
+		}
+		release_expression(result.expr);
+	}
+	release_expression(proc);
+
+	if (success && end) {
+		success = execute(argv_filename, end, strlen(end), env, false);
+	}
+	fflush(stdout);
+	return success;
+}
+
+// Runs the REPL in batch mode. Instead of going through GNU Readline line by
+// line, reads standard input in large blocks and parses expressions directly
+// from the port's buffer. Stops at EOF or after the first error.
+static void batch_repl(struct Environment *env) {
+	struct Port *port = get_stdin_port();
+	if (port_match(port, "#!")) {
+		char *line;
+		size_t length;
+		if (port_read_line(port, &line, &length)) {
+			free(line);
+		}
+	}
+
+	for (;;) {
+		struct Expression code;
+		struct ParseError *parse_err = port_read_sexpr(port, &code);
+		if (parse_err) {
+			print_parse_error(stdin_filename, parse_err);
+			free_parse_error(parse_err);
+			return;
+		}
+		if (code.type == E_EOF) {
+			return;
+		}
+		struct EvalResult result = eval(code, env, true);
+		release_expression(code);
+		if (result.err) {
+			print_eval_error(stdin_filename, result.err);
+			free_eval_error(result.err);
+			return;
+		}
+		if (result.expr.type != E_VOID) {
+			print_expression(result.expr, stdout);
+			putchar('\n');
+		}
+		release_expression(result.expr);
+	}
+}
+
 void repl(struct Environment *env, bool interactive) {
-	const char *prompt1 = interactive ? primary_prompt : "";
-	const char *prompt2 = interactive ? secondary_prompt : "";
-	bool shebang = !interactive;
+	if (!interactive) {
+		batch_repl(env);
+		return;
+	}
+	struct Parser *parser = new_parser();
 
 	for (;;) {
-		char *buf = readline(prompt1);
+		char *buf = readline(primary_prompt);
 		if (!buf) {
 			// EOF: stop the loop.
-			if (interactive) {
-				putchar('\n');
-			}
+			putchar('\n');
+			free_parser(parser);
 			return;
 		}
 		if (*buf) {
-			// Add to the GNU Readline history if necessary.
-			if (interactive) {
-				add_history(buf);
-			}
+			// Add to the GNU Readline history.
+			add_history(buf);
 		} else {
 			// Empty string: ignore it.
 			free(buf);
 			continue;
 		}
 
-		// Skip the shebang on the first line of non-interactive sessions.
 		size_t buf_length = strlen(buf);
-		size_t offset = shebang ? skip_shebang(buf) : 0;
-		shebang = false;
+		size_t offset = 0;
 
 		// Parse and evaluate until there is no text left.
 		while (offset < buf_length) {
-			// Parse from the current offset.
-			struct ParseResult code = parse(buf + offset);
+			// Parse from the current offset. After an incomplete expression,
+			// the parser resumes where it stopped instead of starting over.
+			struct ParseResult code = continue_parse(
+					parser, buf + offset, buf_length - offset, true);
 			if (code.err_type == PARSE_SUCCESS) {
 				// Evaluate the expression.
 				struct EvalResult result = eval(code.expr, env, true);
@@ -189,12 +389,7 @@ void repl(struct Environment *env, bool interactive) {
 					print_eval_error(stdin_filename, result.err);
 					free_eval_error(result.err);
 					release_expression(code.expr);
-					if (interactive) {
-						break;
-					} else {
-						free(buf);
-						return;
-					}
+					break;
 				}
 				if (result.expr.type != E_VOID) {
 					print_expression(result.expr, stdout);
@@ -208,24 +403,19 @@ void repl(struct Environment *env, bool interactive) {
 					struct ParseError err = {
 						.type = (enum ParseErrorType)code.err_type,
 						.text = buf,
+						.length = buf_length,
 						.index = offset + code.chars_read
 					};
 					print_parse_error(stdin_filename, &err);
-					if (interactive) {
-						break;
-					} else {
-						free(buf);
-						return;
-					}
+					break;
 				}
 				// Read another line of input.
-				char *line = readline(prompt2);
+				char *line = readline(secondary_prompt);
 				if (!line) {
 					// EOF: stop the loop.
 					free(buf);
-					if (interactive) {
-						putchar('\n');
-					}
+					putchar('\n');
+					free_parser(parser);
 					return;
 				}
 				if (!*line) {
@@ -233,10 +423,8 @@ void repl(struct Environment *env, bool interactive) {
 					free(line);
 					continue;
 				}
-				if (interactive) {
-					// Add to the GNU Readline history.
-					add_history(line);
-				}
+				// Add to the GNU Readline history.
+				add_history(line);
 				size_t line_length = strlen(line);
 				// Concatenate the line to the end of the buffer.
 				buf = xrealloc(buf, buf_length + line_length + 2);
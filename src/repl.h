@@ -4,6 +4,7 @@
 #define REPL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct Environment;
 struct Expression;
@@ -12,24 +13,63 @@ struct ParseError;
 // This should be called once at the beginning of the program.
 void setup_readline(void);
 
-// Reads and parses an s-expression from standard input using GNU Readline
-// (without prompts). If the parse is incomplete at the end of a line, waits for
-// another line to be entered. If there is leftover input, saves it and starts
-// reading from it on the next call.
+// Reads and parses an s-expression from standard input. If standard input is a
+// terminal, uses GNU Readline (without prompts): if the parse is incomplete at
+// the end of a line, waits for another line to be entered, and if there is
+// leftover input, saves it and starts reading from it on the next call.
+// Otherwise, reads from the same buffered port as the batch-mode REPL.
 //
-// On success, stores the parsed expression in 'out' and returns NULL.
-// Otherwise, allocates and returns a parse error.
+// On success, stores the parsed expression in 'out' and returns NULL. At the
+// end of piped input, stores an EOF expression instead. Otherwise, allocates
+// and returns a parse error.
 struct ParseError *read_sexpr(struct Expression *out);
 
-// Executes the given program. If 'print' is true, prints each expression after
+// Frees the input state kept by 'read_sexpr' and the REPL for standard input.
+// Called by 'free_context'.
+void free_repl_state(void);
+
+// Returns the number of shebang characters at the beginning of 'text', which
+// has 'length' characters. A shebang consists of "#!" followed by any characters
+// until the end of the line, including the newline character.
+size_t skip_shebang(const char *text, size_t length);
+
+// Executes the given program of 'length' characters (it does not need to be
+// null-terminated). If 'print' is true, prints each expression after
 // evaluation. Upon encountering an error, prints an error message and returns
 // false. Otherwise, returns true. The filename is only used for error messages.
 bool execute(
 		const char *filename,
 		const char *text,
+		size_t length,
 		struct Environment *env,
 		bool print);
 
+// Executes the program like 'execute', but in a new child environment of
+// 'env', so that its definitions are discarded afterwards.
+bool execute_in_child(
+		const char *filename,
+		const char *text,
+		size_t length,
+		struct Environment *env,
+		bool print);
+
+// Executes the file 'filename' like 'execute', without printing results.
+// Prints an error message and returns false if the file cannot be opened.
+bool execute_file(const char *filename, struct Environment *env);
+
+// Runs Eva as a line filter, like awk. First executes 'begin' if it is not
+// NULL, and evaluates 'proc_code' to get a procedure. Then calls the procedure
+// on each line of standard input as a string, without the newline character,
+// and displays each result that is not void on its own line. Finally executes
+// 'end' if it is not NULL. All of the code comes from the command line. Stops
+// after the first error, printing an error message and returning false.
+// Otherwise, returns true.
+bool process_lines(
+		const char *proc_code,
+		const char *begin,
+		const char *end,
+		struct Environment *env);
+
 // Runs the Read-Eval-Print Loop. Each iteration has five steps:
 //
 // 1. Present the promp "eva> ".
@@ -41,9 +81,11 @@ bool execute(
 // Updates the environment with top-level defintions as they are encountered.
 // Returns upon EOF (Ctrl-D) or SIGINT (Ctrl-C).
 //
-// If 'interactive' is false, skips steps 1, and exits after encountering the
-// first error. If 'interactive' is true, continues after encountering an error,
-// but discards the rest of the current line.
+// If 'interactive' is true, continues after encountering an error, but discards
+// the rest of the current line. If 'interactive' is false, runs in batch mode
+// instead: skips step 1, reads standard input in large blocks without GNU
+// Readline, parses expressions directly from the buffer, and exits after
+// encountering the first error.
 void repl(struct Environment *env, bool interactive);
 
 #endif
@@ -0,0 +1,227 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "serve.h"
+
+#include "error.h"
+#include "parallel.h"
+#include "repl.h"
+#include "util.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Maximum size of a request, to protect the server from bogus lengths.
+#define MAX_REQUEST_SIZE (64 << 20)
+
+// Filename to use in the errors of requests.
+static const char *const request_filename = "<request>";
+
+// Error message used when the server cannot fork a process for a connection.
+static const char *const err_fork = "Could not start a connection process";
+
+// Fills in the socket address for 'path'. Returns false if it is too long.
+static bool socket_address(const char *path, struct sockaddr_un *addr) {
+	if (strlen(path) >= sizeof addr->sun_path) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+// Executes a request in a new child environment of 'env' with its output
+// going to a temporary file, and sends the response on 'fd'. Returns false if
+// the connection failed.
+static bool handle_request(
+		int fd, const char *text, size_t length, struct Environment *env) {
+	FILE *out = tmpfile();
+	if (!out) {
+		return false;
+	}
+	dup2(fileno(out), STDOUT_FILENO);
+	dup2(fileno(out), STDERR_FILENO);
+	bool success = execute_in_child(request_filename, text, length, env, true);
+	fflush(stdout);
+	fflush(stderr);
+
+	off_t size = lseek(fileno(out), 0, SEEK_END);
+	if (size < 0) {
+		size = 0;
+	}
+	uint32_t header[2] = { htonl(success ? 0 : 1), htonl((uint32_t)size) };
+	bool ok = write_exactly(fd, header, sizeof header);
+	char buf[8192];
+	for (off_t offset = 0; ok && offset < size;) {
+		ssize_t n = pread(fileno(out), buf, sizeof buf, offset);
+		if (n <= 0) {
+			ok = false;
+			break;
+		}
+		ok = write_exactly(fd, buf, (size_t)n);
+		offset += n;
+	}
+	fclose(out);
+	return ok;
+}
+
+// Reports that the server could not fork a process for the connection 'fd',
+// based on the value of global 'errno'. Prints the error, and also sends it to
+// the client as a failed response, since no process will read its requests.
+static void refuse_connection(int fd, const char *path) {
+	char msg[256];
+	snprintf(msg, sizeof msg, "%s: %s", err_fork, strerror(errno));
+	print_error(path, msg);
+	size_t length = strlen(msg);
+	uint32_t header[2] = { htonl(1), htonl((uint32_t)length + 1) };
+	if (write_exactly(fd, header, sizeof header)
+			&& write_exactly(fd, msg, length)) {
+		write_exactly(fd, "\n", 1);
+	}
+}
+
+// Serves requests on a connection until the client closes it. Runs in the
+// process forked for the connection, and exits when it is done.
+static void serve_connection(int fd, struct Environment *env) {
+	int null_fd = open("/dev/null", O_RDONLY);
+	if (null_fd != -1) {
+		dup2(null_fd, STDIN_FILENO);
+		close(null_fd);
+	}
+	uint32_t length;
+	while (read_exactly(fd, &length, sizeof length)) {
+		length = ntohl(length);
+		if (length > MAX_REQUEST_SIZE) {
+			break;
+		}
+		char *text = xmalloc(length);
+		bool ok = read_exactly(fd, text, length)
+			&& handle_request(fd, text, length, env);
+		free(text);
+		if (!ok) {
+			break;
+		}
+	}
+	close(fd);
+	_exit(0);
+}
+
+bool serve(const char *path, struct Environment *env) {
+	struct sockaddr_un addr;
+	if (!socket_address(path, &addr)) {
+		return false;
+	}
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd == -1) {
+		return false;
+	}
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) == -1
+			|| listen(listen_fd, SOMAXCONN) == -1) {
+		int saved = errno;
+		close(listen_fd);
+		errno = saved;
+		return false;
+	}
+
+	// Connection processes are reaped automatically, and a client that goes
+	// away only ends its own connection.
+	struct sigaction action = { .sa_handler = SIG_IGN };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPIPE, &action, NULL);
+	action.sa_flags = SA_NOCLDWAIT;
+	sigaction(SIGCHLD, &action, NULL);
+
+	for (;;) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE
+					|| errno == ENFILE) {
+				continue;
+			}
+			int saved = errno;
+			close(listen_fd);
+			errno = saved;
+			return false;
+		}
+		// Flush buffered output so that the child does not write it again.
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if (pid == 0) {
+			reset_threads_after_fork();
+			close(listen_fd);
+			serve_connection(fd, env);
+		} else if (pid == -1) {
+			refuse_connection(fd, path);
+		}
+		close(fd);
+	}
+}
+
+int connect_to_server(const char *path) {
+	struct sockaddr_un addr;
+	if (!socket_address(path, &addr)) {
+		return -1;
+	}
+	struct sigaction action = { .sa_handler = SIG_IGN };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPIPE, &action, NULL);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+	return fd;
+}
+
+bool request_evaluation(
+		int fd, const char *text, size_t length, bool *success) {
+	if (length > MAX_REQUEST_SIZE) {
+		return false;
+	}
+	// Even if sending fails, the server may have responded before closing the
+	// connection, such as when it could not fork a process for it.
+	uint32_t n = htonl((uint32_t)length);
+	uint32_t header[2];
+	if (write_exactly(fd, &n, sizeof n)) {
+		write_exactly(fd, text, length);
+	}
+	if (!read_exactly(fd, header, sizeof header)) {
+		return false;
+	}
+	*success = ntohl(header[0]) == 0;
+	size_t remaining = ntohl(header[1]);
+	char buf[8192];
+	while (remaining > 0) {
+		size_t chunk = MIN(remaining, sizeof buf);
+		if (!read_exactly(fd, buf, chunk)) {
+			return false;
+		}
+		fwrite(buf, 1, chunk, stdout);
+		remaining -= chunk;
+	}
+	fflush(stdout);
+	return true;
+}
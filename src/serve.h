@@ -0,0 +1,36 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Environment;
+
+// An evaluation server listens on a Unix domain socket, and forks a process
+// for each connection that shares the server's environment copy-on-write.
+// Clients send requests consisting of a 32-bit length in network byte order
+// followed by that much code. Each request is executed in a new child
+// environment of the server's, printing the results like '-e' does. The server
+// responds with a 32-bit status (0 on success, 1 on error) and a 32-bit length,
+// both in network byte order, followed by the output of the request (standard
+// output and standard error together).
+
+// Listens on the socket 'path', replacing a socket left there by an earlier
+// server, and serves requests until the process is killed. Returns false and
+// sets 'errno' if the socket cannot be set up.
+bool serve(const char *path, struct Environment *env);
+
+// Connects to the server listening on 'path'. Returns the file descriptor of
+// the connection, or -1 and sets 'errno' on failure. Also ignores SIGPIPE, so
+// that a server closing the connection does not kill the process.
+int connect_to_server(const char *path);
+
+// Sends 'length' characters of code to be evaluated on the connection 'fd',
+// and writes the output to standard output. Stores whether the evaluation
+// succeeded in 'success'. Returns false if the connection failed.
+bool request_evaluation(
+		int fd, const char *text, size_t length, bool *success);
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "timing.h"
+
+#include "eval.h"
+#include "heap.h"
+#include "intern.h"
+
+#include <stdio.h>
+#include <time.h>
+
+static double clock_seconds(clockid_t id) {
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+struct Timing timing_now(void) {
+	struct HeapStats hs = heap_stats();
+	return (struct Timing){
+		.wall = clock_seconds(CLOCK_MONOTONIC),
+		.cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID),
+		.evals = eval_count(),
+		.allocations = hs.allocations,
+		.frees = hs.frees,
+		.environments = hs.environments_created
+	};
+}
+
+struct Timing timing_since(struct Timing start) {
+	struct Timing now = timing_now();
+	return (struct Timing){
+		.wall = now.wall - start.wall,
+		.cpu = now.cpu - start.cpu,
+		.evals = now.evals - start.evals,
+		.allocations = now.allocations - start.allocations,
+		.frees = now.frees - start.frees,
+		.environments = now.environments - start.environments
+	};
+}
+
+void print_timing(struct Timing timing) {
+	fprintf(stderr, "time: %.3f ms wall, %.3f ms cpu, %zu evals, "
+			"%zu allocations, %zu frees, %zu environments\n",
+			timing.wall * 1e3, timing.cpu * 1e3, timing.evals,
+			timing.allocations, timing.frees, timing.environments);
+}
+
+struct Expression timing_to_list(struct Timing timing) {
+	const struct {
+		const char *name;
+		Number value;
+	} fields[] = {
+		{"wall-microseconds", (Number)(timing.wall * 1e6)},
+		{"cpu-microseconds", (Number)(timing.cpu * 1e6)},
+		{"evals", (Number)timing.evals},
+		{"allocations", (Number)timing.allocations},
+		{"frees", (Number)timing.frees},
+		{"environments", (Number)timing.environments}
+	};
+	// Build the association list backwards.
+	struct Expression list = new_null();
+	for (size_t i = sizeof fields / sizeof *fields; i-- > 0;) {
+		struct Expression entry = new_pair(
+				new_symbol(intern_string(fields[i].name)),
+				new_number(fields[i].value));
+		list = new_pair(entry, list);
+	}
+	return list;
+}
@@ -0,0 +1,34 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "expr.h"
+
+#include <stddef.h>
+
+// Timing measures the cost of evaluating some code. A snapshot holds the
+// absolute values of the counters, and 'timing_since' turns a snapshot into
+// the differences up to the present.
+struct Timing {
+	double wall;         // elapsed real time in seconds
+	double cpu;          // CPU time used by the process in seconds
+	size_t evals;        // calls to 'eval'
+	size_t allocations;  // boxes allocated
+	size_t frees;        // boxes freed
+	size_t environments; // environments created
+};
+
+// Returns a snapshot of the current time and counters.
+struct Timing timing_now(void);
+
+// Returns the time and counter differences since the snapshot 'start'.
+struct Timing timing_since(struct Timing start);
+
+// Prints a one-line report of 'timing' to standard error.
+void print_timing(struct Timing timing);
+
+// Returns 'timing' as an association list, with times in microseconds.
+struct Expression timing_to_list(struct Timing timing);
+
+#endif
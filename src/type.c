@@ -4,6 +4,7 @@
 
 #include "error.h"
 #include "list.h"
+#include "port.h"
 #include "set.h"
 
 #include <assert.h>
@@ -20,6 +21,17 @@
 		return new_eval_error_expr(ERR_RANGE, args[j]); \
 	}
 
+// Checks that expression number 'i' is an open port, and that it is an input
+// port if 'in' is true or an output port if 'in' is false.
+#define CHECK_PORT(i, in) \
+	CHECK_TYPE(E_PORT, i); \
+	if (!port_is_open(args[i].box->port)) { \
+		return new_eval_error_expr(ERR_CLOSED_PORT, args[i]); \
+	} \
+	if (port_is_input(args[i].box->port) != (in)) { \
+		return new_eval_error_expr(ERR_PORT_DIRECTION, args[i]); \
+	}
+
 static struct EvalError *check_stdmacro(
 		enum StandardMacro stdmacro, struct Expression *args, size_t n) {
 	size_t length;
@@ -108,6 +120,26 @@ static struct EvalError *check_stdmacro(
 		}
 		free_set(set);
 		break;
+	case F_DEFINE_MODULE:
+		if (args[0].type != E_SYMBOL) {
+			return new_eval_error_expr(ERR_TYPE_VAR, args[0]);
+		}
+		if (!count_list(&length, args[1])) {
+			return new_syntax_error(args[1]);
+		}
+		for (expr = args[1]; expr.type != E_NULL; expr = expr.box->cdr) {
+			if (expr.box->car.type != E_SYMBOL) {
+				return new_eval_error_expr(ERR_TYPE_VAR, expr.box->car);
+			}
+		}
+		break;
+	case F_IMPORT:
+		for (size_t i = 0; i < n; i++) {
+			if (args[i].type != E_SYMBOL) {
+				return new_eval_error_expr(ERR_TYPE_VAR, args[i]);
+			}
+		}
+		break;
 	default:
 		break;
 	}
@@ -180,6 +212,8 @@ static struct EvalError *check_stdproc(
 	case S_STRING_TO_SYMBOL:
 	case S_STRING_TO_NUMBER:
 	case S_LOAD:
+	case S_OPEN_INPUT_FILE:
+	case S_OPEN_OUTPUT_FILE:
 		for (size_t i = 0; i < n; i++) {
 			CHECK_TYPE(E_STRING, i);
 		}
@@ -226,6 +260,86 @@ static struct EvalError *check_stdproc(
 	case S_SYMBOL_TO_STRING:
 		CHECK_TYPE(E_SYMBOL, 0);
 		break;
+	case S_READ:
+	case S_NEWLINE:
+		if (n > 1) {
+			return new_arity_error(1, n);
+		}
+		if (n == 1) {
+			CHECK_PORT(0, stdproc == S_READ);
+		}
+		break;
+	case S_WRITE:
+	case S_WRITE_SHARED:
+	case S_DISPLAY:
+		if (n > 2) {
+			return new_arity_error(2, n);
+		}
+		if (n == 2) {
+			CHECK_PORT(1, false);
+		}
+		break;
+	case S_WRITE_STRING:
+		if (n > 2) {
+			return new_arity_error(2, n);
+		}
+		CHECK_TYPE(E_STRING, 0);
+		if (n == 2) {
+			CHECK_PORT(1, false);
+		}
+		break;
+	case S_CLOSE_PORT:
+		CHECK_TYPE(E_PORT, 0);
+		break;
+	case S_CALL_INPUT_FILE:
+	case S_CALL_OUTPUT_FILE:
+		CHECK_TYPE(E_STRING, 0);
+		if (!expression_arity(&arity, args[1])) {
+			return new_eval_error_expr(ERR_TYPE_OPERATOR, args[1]);
+		}
+		if (!arity_allows(arity, 1)) {
+			return new_arity_error(arity, 1);
+		}
+		break;
+	case S_CALL_WITH_TIMING:
+	case S_SPAWN:
+		if (!expression_arity(&arity, args[0])) {
+			return new_eval_error_expr(ERR_TYPE_OPERATOR, args[0]);
+		}
+		if (!arity_allows(arity, 0)) {
+			return new_arity_error(arity, 0);
+		}
+		break;
+	case S_PMAP:
+	case S_PFOR_EACH:
+	case S_PREDUCE:;
+		size_t n_params = stdproc == S_PREDUCE ? 2 : 1;
+		if ((args[0].type != E_STDPROCEDURE && args[0].type != E_PROCEDURE)
+				|| !expression_arity(&arity, args[0])) {
+			return new_eval_error_expr(ERR_TYPE_OPERATOR, args[0]);
+		}
+		if (!arity_allows(arity, n_params)) {
+			return new_arity_error(arity, n_params);
+		}
+		if (!count_list(&length, args[n-1])) {
+			return new_syntax_error(args[n-1]);
+		}
+		break;
+	case S_TOUCH:
+		CHECK_TYPE(E_FUTURE, 0);
+		break;
+	case S_CHANNEL_SEND:
+	case S_CHANNEL_RECV:
+		CHECK_TYPE(E_CHANNEL, 0);
+		break;
+	case S_ACTOR_SEND:
+		CHECK_TYPE(E_ACTOR, 0);
+		break;
+	case S_READ_CHAR:
+	case S_PEEK_CHAR:
+	case S_READ_LINE:
+		CHECK_PORT(0, true);
+		break;
 	default:
 		break;
 	}
@@ -1,10 +1,20 @@
 // Copyright 2016 Mitchell Kember. Subject to the MIT License.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "util.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size of blocks to read at a time from files that cannot be mapped.
+#define READ_BLOCK_SIZE (1 << 16)
 
 // Prints the errno message to standard error and exits with exit status 2.
 static void die(void) __attribute__((noreturn));
@@ -43,28 +53,100 @@ bool is_opt(const char *arg, char short_opt, const char *long_opt) {
 				|| (arg[1] == '-' && strcmp(arg + 2, long_opt) == 0));
 }
 
-char *read_file(const char *filename) {
-	FILE *file = fopen(filename, "rb");
-	if (file == NULL) {
-		return NULL;
+// Reads the rest of the file 'fd' into a heap buffer.
+static bool read_all(int fd, struct FileContents *out) {
+	size_t cap = READ_BLOCK_SIZE;
+	size_t len = 0;
+	char *buf = xmalloc(cap);
+	for (;;) {
+		if (len == cap) {
+			cap *= 2;
+			buf = xrealloc(buf, cap);
+		}
+		ssize_t n = read(fd, buf + len, cap - len);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			free(buf);
+			return false;
+		}
+		if (n == 0) {
+			break;
+		}
+		len += (size_t)n;
 	}
-	if (fseek(file, 0, SEEK_END) != 0) {
-		fclose(file);
-		return NULL;
+	out->data = buf;
+	out->length = len;
+	out->mapped = false;
+	return true;
+}
+
+bool read_exactly(int fd, void *buf, size_t n) {
+	char *p = buf;
+	while (n > 0) {
+		ssize_t r = read(fd, p, n);
+		if (r == -1 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return false;
+		}
+		p += r;
+		n -= (size_t)r;
 	}
-	long bufsize = ftell(file);
-	if (bufsize == -1) {
-		fclose(file);
-		return NULL;
+	return true;
+}
+
+bool write_exactly(int fd, const void *buf, size_t n) {
+	const char *p = buf;
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w == -1 && errno == EINTR) {
+			continue;
+		}
+		if (w <= 0) {
+			return false;
+		}
+		p += w;
+		n -= (size_t)w;
 	}
-	if (fseek(file, 0, SEEK_SET) != 0) {
-		fclose(file);
-		return NULL;
+	return true;
+}
+
+bool map_file(const char *filename, struct FileContents *out) {
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+
+	bool success;
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+				fd, 0);
+		success = addr != MAP_FAILED;
+		if (success) {
+			posix_madvise(addr, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+			out->data = addr;
+			out->length = (size_t)st.st_size;
+			out->mapped = true;
+		}
+	} else {
+		success = read_all(fd, out);
 	}
+	close(fd);
+	return success;
+}
 
-	char *buf = xmalloc((size_t)bufsize + 1);
-	size_t length = fread(buf, 1, (size_t)bufsize, file);
-	fclose(file);
-	buf[length+1] = '\0';
-	return buf;
+void unmap_file(struct FileContents contents) {
+	if (contents.mapped) {
+		munmap((void *)contents.data, contents.length);
+	} else {
+		free((void *)contents.data);
+	}
 }
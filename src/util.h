@@ -20,8 +20,26 @@ void *xrealloc(void *ptr, size_t size);
 // 'long_opt' preceded by "--".
 bool is_opt(const char *arg, char short_opt, const char *long_opt);
 
-// Reads the contents of a file into a null-terminated string. On success,
-// returns the string. Otherwise, returns NULL and sets the global 'errno'.
-char *read_file(const char *filename);
+// Wrappers around 'read' and 'write' that transfer exactly 'n' bytes, retrying
+// after interrupts and partial transfers. They return false on error, and
+// 'read_exactly' also returns false if it reaches EOF first.
+bool read_exactly(int fd, void *buf, size_t n);
+bool write_exactly(int fd, const void *buf, size_t n);
+
+// The contents of a file in memory. Regular files are mapped directly into the
+// address space with 'mmap'. Other files, such as pipes, are read into a heap
+// buffer instead. In either case, 'data' is not null-terminated.
+struct FileContents {
+	const char *data;
+	size_t length;
+	bool mapped;
+};
+
+// Loads the contents of a file into memory. On success, stores the result in
+// 'out' and returns true. Otherwise, returns false and sets the global 'errno'.
+bool map_file(const char *filename, struct FileContents *out);
+
+// Releases the memory used by a result of 'map_file'.
+void unmap_file(struct FileContents contents);
 
 #endif
@@ -93,9 +93,9 @@ for f in "${files[@]}"; do
 
 	if [[ ! -f $src ]]; then
 		echolog "Warning: File $src does not exist"
-		((total--))
+		total=$((total - 1))
 	elif [[ -f $ref && -f $repl_ref ]]; then
-		((total++))
+		total=$((total + 1))
 	fi
 done
 
@@ -122,14 +122,14 @@ regression() {
 		if [[ -f "$ref" ]]; then
 			skip=n
 			bin/eva -n "$src" > "$out" 2>&1
-			compare "$ref" "$out"
-			((reg_counter++))
+			compare "$ref" "$out" || :
+			reg_counter=$((reg_counter + 1))
 		fi
 		if [[ -f "$repl_ref" ]]; then
 			skip=n
 			bin/eva -n < "$src" > "$repl_out" 2>&1
-			compare "$repl_ref" "$repl_out"
-			((reg_counter++))
+			compare "$repl_ref" "$repl_out" || :
+			reg_counter=$((reg_counter + 1))
 		fi
 
 		if [[ $skip == "y" ]]; then
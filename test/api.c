@@ -0,0 +1,223 @@
+// Copyright 2016 Mitchell Kember. Subject to the MIT License.
+
+// Tests for the C interface of libeva. This only includes the public header,
+// and is linked against bin/libeva.a, so it exercises the library the way an
+// embedding program would. Run by "make test".
+
+#include "eva.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of checks that ran and that failed.
+static int n_checks = 0;
+static int n_failures = 0;
+
+// Records the result of a check, printing it if it failed.
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *cond, int line) {
+	n_checks++;
+	if (!ok) {
+		n_failures++;
+		fprintf(stderr, "api.c:%d: check failed: %s\n", line, cond);
+	}
+}
+
+// Returns true if 'value' is written as 'text', and releases it.
+static bool written_as(struct EvaValue *value, const char *text) {
+	if (!value) {
+		return false;
+	}
+	char *actual = eva_to_text(value);
+	bool ok = actual && strcmp(actual, text) == 0;
+	free(actual);
+	eva_release(value);
+	return ok;
+}
+
+// Returns true if the last error of 'eva' contains 'part'.
+static bool error_contains(struct Eva *eva, const char *part) {
+	const char *err = eva_error(eva);
+	return err && strstr(err, part);
+}
+
+// Adds its two number arguments, and fails on anything else.
+static struct EvaValue *add(
+		struct Eva *eva, struct EvaValue *const *args, size_t n, void *data) {
+	long a, b;
+	if (!eva_to_number(args[0], &a) || !eva_to_number(args[1], &b)) {
+		return eva_raise(eva, "add: expected numbers");
+	}
+	(*(int *)data)++;
+	(void)n;
+	return eva_number(eva, a + b);
+}
+
+static void test_eval(void) {
+	struct Eva *eva = eva_new(true);
+	CHECK(written_as(eva_eval(eva, "(map (lambda (x) (* x x)) '(1 2 3))"),
+			"(1 4 9)"));
+	CHECK(eva_error(eva) == NULL);
+	struct EvaValue *none = eva_eval(eva, "");
+	CHECK(none && eva_type(none) == EVA_VOID);
+	eva_release(none);
+
+	// Definitions persist between calls.
+	CHECK(written_as(eva_eval(eva, "(define (sq x) (* x x)) (sq 7)"), "49"));
+	CHECK(written_as(eva_eval_n(eva, "(sq 3) junk", 6), "9"));
+
+	// Errors return NULL and set the message, until the next call.
+	CHECK(eva_eval(eva, "(car 1)") == NULL);
+	CHECK(error_contains(eva, "<api>"));
+	CHECK(eva_eval(eva, "(+ 1") == NULL);
+	CHECK(eva_error(eva) != NULL);
+	CHECK(eva_eval(eva, "undefined-variable") == NULL);
+	CHECK(error_contains(eva, "undefined-variable"));
+	CHECK(written_as(eva_eval(eva, "1"), "1"));
+	CHECK(eva_error(eva) == NULL);
+
+	// Without the prelude, only standard procedures are defined.
+	struct Eva *bare = eva_new(false);
+	CHECK(eva_eval(bare, "(map car '((1)))") == NULL);
+	CHECK(written_as(eva_eval(bare, "(car '(1))"), "1"));
+	eva_free(bare);
+	eva_free(eva);
+}
+
+static void test_call(void) {
+	struct Eva *eva = eva_new(true);
+	eva_release(eva_eval(eva, "(define (f x y) (list y x))"));
+	struct EvaValue *f = eva_lookup(eva, "f");
+	CHECK(f && eva_type(f) == EVA_PROCEDURE);
+	CHECK(eva_lookup(eva, "no-such-variable") == NULL);
+
+	struct EvaValue *args[] = { eva_number(eva, 1), eva_symbol(eva, "a") };
+	CHECK(written_as(eva_call(eva, f, args, 2), "(a 1)"));
+	CHECK(eva_call(eva, f, args, 1) == NULL);
+	CHECK(eva_error(eva) != NULL);
+	CHECK(eva_call(eva, args[0], args, 2) == NULL);
+
+	eva_define(eva, "g", f);
+	CHECK(written_as(eva_eval(eva, "(g 'p 'q)"), "(q p)"));
+	eva_release(args[0]);
+	eva_release(args[1]);
+	eva_release(f);
+	eva_free(eva);
+}
+
+static void test_register(void) {
+	struct Eva *eva = eva_new(false);
+	int calls = 0;
+	eva_register(eva, "add", 2, add, &calls);
+	CHECK(written_as(eva_eval(eva, "(add 2 3)"), "5"));
+	CHECK(calls == 1);
+
+	// The interpreter checks the number of arguments, and the function checks
+	// their types.
+	CHECK(eva_eval(eva, "(add 1)") == NULL);
+	CHECK(eva_eval(eva, "(add 1 'x)") == NULL);
+	CHECK(error_contains(eva, "add: expected numbers"));
+	CHECK(calls == 1);
+
+	// Registered procedures can be called through eva_call too.
+	struct EvaValue *proc = eva_lookup(eva, "add");
+	CHECK(proc && eva_type(proc) == EVA_PROCEDURE);
+	struct EvaValue *args[] = { eva_number(eva, 40), eva_number(eva, 2) };
+	CHECK(written_as(eva_call(eva, proc, args, 2), "42"));
+	eva_release(args[0]);
+	eva_release(args[1]);
+	eva_release(proc);
+	eva_free(eva);
+}
+
+static void test_values(void) {
+	struct Eva *eva = eva_new(false);
+	long number;
+	char character;
+	const char *str;
+	size_t length;
+
+	struct EvaValue *v = eva_number(eva, -5);
+	CHECK(eva_type(v) == EVA_NUMBER);
+	CHECK(eva_to_number(v, &number) && number == -5);
+	CHECK(!eva_to_character(v, &character));
+	CHECK(!eva_to_string(v, &str, &length));
+	CHECK(!eva_to_symbol(v, &str));
+	CHECK(eva_car(v) == NULL && eva_cdr(v) == NULL);
+	CHECK(eva_truthy(v));
+	eva_release(v);
+
+	v = eva_character(eva, 'z');
+	CHECK(eva_type(v) == EVA_CHARACTER);
+	CHECK(eva_to_character(v, &character) && character == 'z');
+	CHECK(!eva_to_number(v, &number));
+	eva_release(v);
+
+	v = eva_string(eva, "a\"b", 3);
+	CHECK(eva_type(v) == EVA_STRING);
+	CHECK(eva_to_string(v, &str, &length) && length == 3
+			&& memcmp(str, "a\"b", 3) == 0);
+	CHECK(written_as(v, "\"a\\\"b\""));
+
+	v = eva_symbol(eva, "sym");
+	CHECK(eva_type(v) == EVA_SYMBOL);
+	CHECK(eva_to_symbol(v, &str) && strcmp(str, "sym") == 0);
+	eva_release(v);
+
+	v = eva_boolean(eva, false);
+	CHECK(eva_type(v) == EVA_BOOLEAN && !eva_truthy(v));
+	eva_release(v);
+	v = eva_void(eva);
+	CHECK(eva_type(v) == EVA_VOID);
+	eva_release(v);
+
+	struct EvaValue *car = eva_number(eva, 1);
+	struct EvaValue *cdr = eva_null(eva);
+	CHECK(eva_type(cdr) == EVA_NULL);
+	v = eva_cons(eva, car, cdr);
+	eva_release(car);
+	eva_release(cdr);
+	CHECK(eva_type(v) == EVA_PAIR);
+	CHECK(written_as(eva_car(v), "1"));
+	CHECK(written_as(eva_cdr(v), "()"));
+	CHECK(written_as(v, "(1)"));
+
+	v = eva_eval(eva, "(lambda (x) x)");
+	CHECK(v && eva_type(v) == EVA_PROCEDURE);
+	eva_release(v);
+	v = eva_eval(eva, "if");
+	CHECK(v && eva_type(v) == EVA_OTHER);
+	eva_release(v);
+	eva_release(NULL);
+	eva_free(eva);
+}
+
+// Creates and frees interpreters with closures in their global environments.
+// Run under a leak checker, this shows that 'eva_free' frees everything.
+static void test_free(void) {
+	for (int i = 0; i < 3; i++) {
+		struct Eva *eva = eva_new(true);
+		eva_release(eva_eval(eva,
+				"(define (loop n) (if (= n 0) 'done (loop (- n 1))))"
+				"(define-module m (h) (define (h) (map car '((1)))))"
+				"(import m)"));
+		CHECK(written_as(eva_eval(eva, "(loop 3)"), "done"));
+		eva_free(eva);
+	}
+}
+
+int main(void) {
+	test_eval();
+	test_call();
+	test_register();
+	test_values();
+	test_free();
+	if (n_failures > 0) {
+		printf("%d of %d API checks failed\n", n_failures, n_checks);
+		return 1;
+	}
+	printf("All %d API checks passed\n", n_checks);
+	return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Checks that processes forked by -j and --serve can use the thread pool and
+# futures after the parent process has started them. Run by "make test".
+
+set -eufo pipefail
+
+cd "$(dirname "$0")/.."
+
+eva=bin/eva
+tmp=$(mktemp -d)
+server=
+cleanup() {
+	if [[ -n $server ]]; then
+		kill "$server" 2> /dev/null || :
+	fi
+	rm -rf "$tmp"
+}
+trap cleanup EXIT
+
+export EVA_THREADS=2
+
+# Starts the thread pool and the future scheduler in the parent.
+setup=(-e "(pmap car '((1) (2)))" -e '(touch (future 1))')
+setup_output=$'(1 2)\n1'
+
+# Uses them again in a forked process.
+code="(display (pmap (lambda (x) (* x x)) '(1 2 3))) (display (touch (future 3)))"
+expected="(1 4 9)3"
+
+fail() {
+	echo "fork.sh: $1" >&2
+	exit 1
+}
+
+echo "$code" > "$tmp/p.scm"
+out=$(timeout 10 "$eva" -n "${setup[@]}" -j 1 "$tmp/p.scm") \
+	|| fail "-j worker failed or hung"
+[[ $out == "$setup_output"$'\n'"$expected" ]] \
+	|| fail "-j worker printed '$out'"
+
+"$eva" -n "${setup[@]}" --serve "$tmp/socket" > /dev/null &
+server=$!
+for _ in {1..50}; do
+	[[ -S $tmp/socket ]] && break
+	sleep 0.1
+done
+out=$(timeout 10 "$eva" --client "$tmp/socket" -e "$code") \
+	|| fail "server connection failed or hung"
+[[ $out == "$expected" ]] || fail "server printed '$out'"
+
+echo "Fork checks passed"
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Checks that -j prints the output of each file in the order of the arguments,
+# even when the workers finish out of order, and that it fails if any file
+# fails or kills its worker. Run by "make test".
+
+set -ufo pipefail
+
+eva=$(realpath "$(dirname "$0")/../bin/eva")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cd "$tmp"
+
+fail() {
+	echo "jobs.sh: $1" >&2
+	exit 1
+}
+
+# The first file runs much longer than the others, so it finishes last.
+cat > slow.scm <<'SCM'
+(define (count i n) (if (< i n) (count (+ i 1) n) i))
+(define (spin k) (if (> k 0) (begin (count 0 1000) (spin (- k 1))) 'done))
+(display (spin 300))
+(newline)
+SCM
+echo '(display "fast") (newline)' > fast.scm
+echo '(car 1)' > error.scm
+# Recursing forever overflows the stack and kills the worker.
+echo '(define (f) (+ 1 (f))) (f)' > crash.scm
+echo '(display "last") (newline)' > last.scm
+
+expected="done
+fast
+ERROR: error.scm: Argument 1: Expected PAIR, got NUMBER: 1
+     (car 1)
+ERROR: crash.scm: Worker process terminated
+last"
+
+out=$(timeout 30 "$eva" -n -j 3 slow.scm fast.scm error.scm crash.scm last.scm \
+	2>&1)
+status=$?
+[[ $status -eq 1 ]] || fail "-j exited with status $status"
+[[ $out == "$expected" ]] || fail "-j printed '$out'"
+
+out=$("$eva" -n -j 2 fast.scm last.scm 2>&1) || fail "-j failed"
+[[ $out == $'fast\nlast' ]] || fail "-j printed '$out'"
+
+echo "Jobs checks passed"
@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# Checks the --lines, --begin and --end options. Run by "make test".
+
+set -ufo pipefail
+
+cd "$(dirname "$0")/.."
+
+eva=bin/eva
+
+fail() {
+	echo "lines.sh: $1" >&2
+	exit 1
+}
+
+# Void results print nothing, and other results are displayed like 'display'.
+proc='(lambda (l)
+  (cond ((= (string-length l) 0) (display ""))
+        ((string=? l "pair") (cons l (string-length l)))
+        ((string=? l "char") (string-ref l 0))
+        (else (string-length l))))'
+out=$(printf 'abc\n\npair\nchar\nlast' | "$eva" -n --lines "$proc") \
+	|| fail "--lines failed"
+[[ $out == $'3\n("pair" . 4)\nc\n4' ]] || fail "--lines printed '$out'"
+
+# --begin runs before the first line and --end after the last one.
+out=$(printf 'x\ny\n' | "$eva" -n --begin '(define n 0) (display "B")' \
+	--end '(display n) (display "E")' --lines '(lambda (l) (set! n (+ n 1)) l)') \
+	|| fail "--begin and --end failed"
+[[ $out == $'Bx\ny\n2E' ]] || fail "--begin and --end printed '$out'"
+
+# An error stops at its line, keeps the earlier output, and skips --end.
+proc='(lambda (l) (if (string=? l "2") (error "bad line" l) l))'
+out=$(printf '1\n2\n3\n' | "$eva" -n --end '(display "E")' --lines "$proc" \
+	2> /dev/null) && fail "--lines succeeded after an error"
+[[ $out == "1" ]] || fail "--lines printed '$out' before an error"
+err=$(printf '1\n2\n' | "$eva" -n --lines "$proc" 2>&1 > /dev/null)
+[[ $err == *'"bad line" "2"'* ]] || fail "--lines reported '$err'"
+
+# The procedure can be "error" itself.
+err=$(printf 'a\n' | "$eva" -n --lines error 2>&1 > /dev/null) \
+	&& fail "--lines error succeeded"
+[[ $err == *'"a"'* ]] || fail "--lines error reported '$err'"
+
+echo "Lines checks passed"
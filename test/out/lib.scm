@@ -0,0 +1 @@
+(set! lib-value (let ((s "hello")) (lambda () s)))
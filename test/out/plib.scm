@@ -0,0 +1 @@
+(define-module plib (tens) (define (tens x) (* x 10)))
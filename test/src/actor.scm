@@ -0,0 +1,24 @@
+(define a (spawn-actor 0))
+(actor? a)
+(actor? (actor-self))
+(actor? 'a)
+(define echo
+  (spawn-actor
+    '(lambda ()
+       (define (serve)
+         (define m (actor-recv))
+         (if (eq? (car m) 'stop)
+           (actor-send (cdr m) 'stopped)
+           (begin (actor-send (car m) (cons 'echo (cdr m))) (serve))))
+       (serve))))
+(actor-send echo (cons (actor-self) '(1 2.5 #\x "str" sym (nested ()) #t)))
+(actor-recv)
+(define s "mutable")
+(actor-send echo (cons (actor-self) s))
+(string-set! s 0 #\M)
+s
+(actor-recv)
+(actor-send echo (cons (actor-self) car))
+(actor-recv)
+(actor-send echo (cons 'stop (actor-self)))
+(actor-recv)
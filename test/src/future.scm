@@ -0,0 +1,20 @@
+(define (fib n)
+  (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(define (pfib n)
+  (if (< n 10)
+    (fib n)
+    (let ((f (future (pfib (- n 1)))))
+      (+ (pfib (- n 2)) (touch f)))))
+(define f (future (+ 1 2)))
+(future? f)
+(future? 3)
+(touch f)
+(touch f)
+(let ((x 10)) (touch (future (* x x))))
+(pfib 20)
+(let ((a (future (fib 5))) (b (future (fib 10))) (c (future (fib 15))))
+  (cons (touch c) (cons (touch b) (touch a))))
+(pmap (lambda (n) (touch (future (fib n)))) '(1 2 3 4 5 6))
+(define bad (future (car '())))
+(future? bad)
+(touch bad)
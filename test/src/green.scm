@@ -0,0 +1,28 @@
+(define c (make-channel))
+(define (produce name i n)
+  (if (< i n)
+    (begin (channel-send c (cons name i)) (produce name (+ i 1) n))
+    'done))
+(define (receive n acc)
+  (if (= n 0) acc (receive (- n 1) (cons (channel-recv c) acc))))
+(channel? c)
+(channel? 'c)
+(spawn (lambda () (produce 'a 0 3)))
+(spawn (lambda () (produce 'b 0 3)))
+(receive 6 '())
+(define log (make-channel))
+(spawn (lambda () (channel-send log 'first)))
+(yield)
+(channel-recv log)
+(define (count i n) (if (< i n) (count (+ i 1) n) i))
+(define done (make-channel))
+(spawn (lambda () (channel-send done (count 0 1000))))
+(channel-recv done)
+;; A thread that runs for a long time is preempted.
+(spawn (lambda () (count 0 3000) (channel-send log 'slow)))
+(spawn (lambda () (channel-send log 'fast)))
+(channel-recv log)
+(channel-recv log)
+(spawn (lambda () (car '())))
+(yield)
+(channel-recv c)
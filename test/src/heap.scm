@@ -0,0 +1,17 @@
+(define (field name)
+  (define (find stats)
+    (if (eq? (car (car stats)) name)
+      (cdr (car stats))
+      (find (cdr stats))))
+  (find (heap-stats)))
+
+;; Code is made of pairs too, so take both measurements within one form.
+(let* ((pairs (field 'pairs))
+       (strings (field 'strings))
+       (frees (field 'frees))
+       (kept (cons 1 (cons 2 (cons (string-copy "three") '())))))
+  (write (- (field 'pairs) pairs))
+  (write (- (field 'strings) strings))
+  (write (> (field 'frees) frees)))
+
+(write (>= (field 'environment-depth) 1))
@@ -0,0 +1,23 @@
+(define (write-lib code)
+  (call-with-output-file "test/out/lib.scm"
+    (lambda (out) (write code out))))
+
+(define loaded 0)
+(define (lib-value) 'none)
+(write-lib '(set! loaded (+ loaded 1)))
+(load "test/out/lib.scm")
+(load "test/out/lib.scm")
+(write loaded)
+
+;; A changed file must not come from the cache.
+(write-lib '(set! lib-value (lambda () (cons "changed" loaded))))
+(load "test/out/lib.scm")
+(write (lib-value))
+
+;; Mutating a literal must not change the cached code.
+(write-lib '(set! lib-value (let ((s "hello")) (lambda () s))))
+(load "test/out/lib.scm")
+(string-set! (lib-value) 0 #\Y)
+(write (lib-value))
+(load "test/out/lib.scm")
+(write (lib-value))
@@ -0,0 +1,21 @@
+(define x 10)
+
+(define-module counter (next!)
+  (define x 0)
+  (define (next!)
+    (set! x (+ x 1))
+    x))
+
+(import counter)
+(write (next!))
+(write (next!))
+(write x)
+
+(define-module pair-counter (next-pair)
+  (import counter)
+  (define (next-pair)
+    (let ((a (next!)))
+      (cons a (next!)))))
+
+(import pair-counter)
+(write (next-pair))
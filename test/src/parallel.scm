@@ -0,0 +1,34 @@
+(define (range a b)
+  (if (>= a b) '() (cons a (range (+ a 1) b))))
+(define (fib n)
+  (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+
+;; Results come back in the order of the list.
+(write (pmap (lambda (x) (* x x)) (range 0 10)))
+(write (pmap fib (range 0 15)))
+(write (pmap car '((a . 1) (b . 2) (c . 3))))
+(write (pmap fib '()))
+
+;; Bodies that get rewritten on first use are evaluated on several threads.
+(write
+  (pmap
+    (lambda (x)
+      (define (twice y) (* 2 y))
+      (cond ((> x 2) (twice x) (+ (twice x) 1))
+            (else x)))
+    (range 0 6)))
+
+;; The partial results are combined in order, so associative procedures give
+;; the same result as folding from the left.
+(write (preduce + 0 (range 1 101)))
+(write (preduce string-append "" (pmap symbol->string '(a b c d e f))))
+(write (preduce + 42 '()))
+
+(write (pfor-each (lambda (x) (string->symbol "shared")) (range 0 50)))
+
+;; Loading files and importing modules is safe on several threads.
+(call-with-output-file "test/out/plib.scm"
+  (lambda (out)
+    (write '(define-module plib (tens) (define (tens x) (* x 10))) out)))
+(write (pmap (lambda (x) (load "test/out/plib.scm") x) (range 0 20)))
+(write (pmap (lambda (x) (import plib) (tens x)) (range 0 5)))
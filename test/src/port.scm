@@ -0,0 +1,25 @@
+(define out (open-output-file "test/out/port.txt"))
+(write-string "first line" out)
+(newline out)
+(display #\x out)
+(display "yz" out)
+(newline out)
+(write '(a "b" #\c) out)
+(display 42 out)
+(close-port out)
+
+(define in (open-input-file "test/out/port.txt"))
+(write (port? in))
+(write (read-line in))
+(write (peek-char in))
+(write (read-char in))
+(write (read-char in))
+(write (read-line in))
+(write (read in))
+(write (read in))
+(write (eof-object? (read in)))
+(write (eof-object? (read-line in)))
+(write (eof-object? (read-char in)))
+(close-port in)
+
+(write (call-with-input-file "test/out/port.txt" read-line))
@@ -0,0 +1,16 @@
+(define x (cons "a\"b\\c\n\td" (cons #\space (cons 'sym (cons -42 '())))))
+(write x)
+(write (cons x (cons x (cons (cons x 0) '()))))
+(write-shared (cons x (cons x (cons (cons x 0) '()))))
+(write '(1 (2 (3 (4 (5 (6 (7 (8 (9 (10 (11 (12 (13 (14 (15 (16 (17 (18 (19 (20 (21 (22 (23 (24 (25 (26 (27 (28 (29 (30 (31 (32 (33 (34 (35))))))))))))))))))))))))))))))))))))
+(write '(1 (2 . 3) . 4))
+(define cycle (cons 1 (cons 2 (cons 3 '()))))
+(set-cdr! (cdr (cdr cycle)) cycle)
+(write-shared cycle)
+(define self (cons 1 (cons 2 '())))
+(set-car! self self)
+(write-shared self)
+(write-shared '(not shared))
+(display x)
+(newline)
+(write (cons #t (cons #f (cons car '()))))
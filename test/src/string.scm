@@ -15,3 +15,8 @@ ss
 
 (string->list s)
 (list->string '(#\a #\space #\b))
+
+"a\\"
+(string-length "a\\")
+(string-length "\\n")
+(string->list "\\t\"")
@@ -0,0 +1,20 @@
+(define (field name alist)
+  (if (eq? (car (car alist)) name)
+    (cdr (car alist))
+    (field name (cdr alist))))
+
+(define result
+  (call-with-timing
+    (lambda ()
+      (cons 1 (cons 2 '())))))
+(write (car result))
+(write (field 'allocations (cdr result)))
+(write (field 'environments (cdr result)))
+(write (> (field 'evals (cdr result)) 0))
+
+;; Each call with an argument binds its parameter in a new environment.
+(define (count-down n)
+  (if (= n 0) 'done (count-down (- n 1))))
+(define result (call-with-timing (lambda () (count-down 10))))
+(write (car result))
+(write (field 'environments (cdr result)))